@@ -4,7 +4,7 @@
 #include <numeric>
 #include "util.hpp"
 #include "Pub_Sub.h"
-#include "raycaster/Hardware_Caster.h"
+#include "raycaster/RayCaster.h"
 #include "LightHandle.h"
 
 
@@ -48,12 +48,12 @@ struct PackedData {
 };
 
 class LightHandle;
-class Hardware_Caster;
+class RayCaster;
 
 class LightController : public VrEventSubscriber {
 public:
 
-	LightController(std::shared_ptr<Hardware_Caster> raycaster);
+	LightController(std::shared_ptr<RayCaster> raycaster);
 	~LightController();
 
 	std::shared_ptr<LightHandle> create_light(LightPrototype light_prototype);
@@ -0,0 +1,49 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+
+// A fixed set of worker threads pulling tasks off a shared queue.
+//
+// enqueue() is fire and forget, parallel_for() splits an index range over the
+// workers and blocks the caller until every index has been run. Don't call
+// parallel_for from inside one of the pool's own tasks, the caller sleeps while
+// it waits so a worker doing it would be waiting on itself
+class ThreadPool {
+public:
+
+	// A thread count of 0 uses one worker per hardware thread
+	ThreadPool(unsigned int thread_count = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void enqueue(std::function<void()> task);
+
+	// Run function(i) for every i in [0, count) and wait for all of them to finish.
+	// Workers each start on a contiguous run of indices and steal from the others
+	// once theirs is done
+	void parallel_for(int count, std::function<void(int)> function);
+
+	unsigned int get_thread_count() const { return static_cast<unsigned int>(workers.size()); }
+
+	// Tasks waiting on the queue, not counting the ones currently running
+	size_t get_queue_depth();
+
+private:
+
+	void worker_loop();
+
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> tasks;
+
+	std::mutex queue_mutex;
+	std::condition_variable queue_condition;
+	bool stopping = false;
+
+};
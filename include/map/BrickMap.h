@@ -0,0 +1,71 @@
+#pragma once
+#include <SFML/System/Vector3.hpp>
+#include <vector>
+#include <cstdint>
+
+// Bricks are BRICK_DIM^3 voxels
+#define BRICK_DIM 8
+#define BRICK_VOXELS (BRICK_DIM * BRICK_DIM * BRICK_DIM)
+
+// Grid entries. 0 is an empty brick, entries with BRICK_SOLID set are a brick filled
+// with the material in the low byte, anything else is 1 + the brick's index in the pool
+#define BRICK_EMPTY 0u
+#define BRICK_SOLID 0x80000000u
+
+// Two level sparse voxel grid.
+//
+// A coarse grid with one entry per BRICK_DIM^3 cell, pointing into a pool of bricks
+// that hold the actual voxels. Only cells with a mix of voxels get a brick, empty and
+// uniformly solid cells live in the grid entry alone. So memory scales with the
+// surface of the world instead of its volume, and a ray can skip a whole empty cell
+// in one step. Voxels keep their material value the same as Old_Map
+class BrickMap {
+public:
+
+	// Dimensions get rounded up to a multiple of BRICK_DIM
+	BrickMap(sf::Vector3i dimensions);
+
+	// Fill from a dense array indexed x + dim.x * (y + dim.y * z), the same as Old_Map for
+	// its cubic maps. Bricks that turn out empty or uniform are never allocated
+	void load_dense(const char *voxel_data, sf::Vector3i dimensions);
+
+	char get_voxel(sf::Vector3i position) const;
+
+	// Allocates a brick when a cell stops being uniform and hands it back to the pool
+	// once it's uniform again
+	void set_voxel(sf::Vector3i position, char value);
+
+	sf::Vector3i get_dimensions() const { return dimensions; }
+	sf::Vector3i get_grid_dimensions() const { return grid_dimensions; }
+
+	// What gets uploaded, the grid entries and the brick pool back to back
+	const std::vector<uint32_t>& get_grid() const { return grid; }
+	const std::vector<char>& get_bricks() const { return bricks; }
+
+	uint64_t bricks_used() const { return bricks.size() / BRICK_VOXELS - free_bricks.size(); }
+	uint64_t bytes_used() const { return grid.size() * sizeof(uint32_t) + bricks.size(); }
+
+private:
+
+	uint32_t& cell(sf::Vector3i position);
+	uint32_t cell(sf::Vector3i position) const;
+
+	// Voxel index within a brick
+	static int brick_offset(sf::Vector3i position) {
+		return (position.x % BRICK_DIM) + BRICK_DIM * ((position.y % BRICK_DIM) + BRICK_DIM * (position.z % BRICK_DIM));
+	}
+
+	// Take a brick off the free list or grow the pool, filled with value
+	uint32_t allocate_brick(char value);
+
+	// If every voxel in the brick is the same, the entry it can collapse into. Otherwise its current entry
+	uint32_t collapse_brick(uint32_t entry);
+
+	sf::Vector3i dimensions;
+	sf::Vector3i grid_dimensions;
+
+	std::vector<uint32_t> grid;
+	std::vector<char> bricks;
+	std::vector<uint32_t> free_bricks;
+
+};
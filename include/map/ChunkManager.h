@@ -0,0 +1,167 @@
+#pragma once
+#include <SFML/System/Vector3.hpp>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include "map/Map.h"
+#include "map/DistanceField.h"
+#include "map/Occupancy.h"
+#include "map/Palette.h"
+#include "ThreadPool.h"
+
+class Camera;
+
+// Chunks are CHUNK_DIM^3 voxels, a multiple of DISTANCE_BLOCK
+#define CHUNK_DIM 64
+#define CHUNK_VOXELS (CHUNK_DIM * CHUNK_DIM * CHUNK_DIM)
+
+struct Chunk {
+
+	// In chunks, world voxel position / CHUNK_DIM
+	sf::Vector3i position;
+
+	// x + CHUNK_DIM * (y + CHUNK_DIM * z), packed against the chunk's own palette
+	PalettedVoxels voxels;
+
+	// Bounded to the chunk, see generate_distance_field
+	std::vector<uint8_t> distance_field;
+
+	// Its words go up to the device for the shadow rays
+	OccupancyGrid occupancy;
+
+	// Last update() the chunk was inside the window or its margin
+	uint64_t last_used_frame = 0;
+};
+
+// Something for the caster to write into the window's ring buffer. A null chunk clears
+// the slot, its old chunk left the window and the new one isn't ready yet
+struct ChunkUpload {
+	sf::Vector3i buffer_position;
+	std::shared_ptr<const Chunk> chunk;
+};
+
+struct ChunkStats {
+
+	// Requested, waiting for a worker
+	size_t generate_queue_depth = 0;
+
+	// On a worker right now
+	size_t generating = 0;
+
+	// Waiting on the caster to take them
+	size_t upload_queue_depth = 0;
+
+	size_t resident_chunks = 0;
+	uint64_t resident_bytes = 0;
+	uint64_t evicted_chunks = 0;
+	uint64_t uploaded_chunks = 0;
+
+	// Packed voxel bytes handed to the caster, and what they'd have been as a char each
+	uint64_t uploaded_voxel_bytes = 0;
+	uint64_t uploaded_dense_bytes = 0;
+
+	// How long the generator takes, and how long from being requested to being resident
+	double generate_ms_average = 0;
+	double generate_ms_max = 0;
+	double latency_ms_average = 0;
+	double latency_ms_max = 0;
+};
+
+// Streams an unbounded world of chunks around the camera.
+//
+// The device only ever sees a window of window_chunks^3 chunks. It's a dense volume like
+// Old_Map's but used as a ring buffer, world voxel p lives at p mod the window size, so when
+// the window moves only the chunks coming into it get written. The camera is kept in the
+// middle chunk by moving it and the window origin by whole chunks (floating origin), so the
+// kernels keep working in small window space coordinates.
+//
+// Chunks get generated on workers closest first, including a one chunk margin around the
+// window so they're ready before the camera gets there. Chunks outside of that are kept
+// around for coming back until memory_budget is hit, then the furthest are evicted
+class ChunkManager {
+public:
+
+	// Fills in voxels, dense in Chunk::voxels' order, for the chunk at chunk_position.
+	// Runs on the workers so it has to be thread safe. Loading from disk goes here too
+	typedef std::function<void(sf::Vector3i chunk_position, char *voxels)> Generator;
+
+	// window_chunks is the side length of the window in chunks. A thread count of 0
+	// uses one worker per hardware thread
+	ChunkManager(int window_chunks, uint64_t memory_budget, Generator generator, unsigned int thread_count = 0);
+	~ChunkManager();
+
+	// Call once a frame. Rebases the camera if it left the middle chunk, queues up the
+	// chunks it's missing, takes in the finished ones and evicts over the budget
+	void update(Camera *camera);
+
+	// Everything that has to go up to the device since the last call
+	std::vector<ChunkUpload> take_uploads();
+
+	// Forget what the ring buffer holds, for when the caster starts over with empty
+	// buffers. The next update() queues every resident chunk in the window again
+	void invalidate_slots();
+
+	// In voxels, the size of the device's volume
+	sf::Vector3i get_window_dimensions() const;
+
+	// World voxel position of window space (0, 0, 0)
+	sf::Vector3i get_window_origin() const { return window_origin; }
+
+	// Where window space (0, 0, 0) lives in the ring buffer
+	sf::Vector3i get_ring_offset() const;
+
+	ChunkStats get_stats();
+
+	// Default generator. Rolling hills from a few octaves of value noise off of terrain_hash,
+	// so a seed always gives the same world no matter which order the chunks come in
+	static void generate_terrain_chunk(uint64_t seed, sf::Vector3i chunk_position, char *voxels);
+
+private:
+
+	// Worker side, generate and hand the chunk back through finished
+	void generate_chunk(sf::Vector3i position);
+
+	// Keep up to one task per worker in flight, closest requests first
+	void dispatch_requests(sf::Vector3i camera_chunk);
+
+	void evict(sf::Vector3i camera_chunk);
+
+	// What a resident chunk costs us
+	static uint64_t chunk_bytes(const Chunk &chunk);
+
+	int window_chunks;
+	uint64_t memory_budget;
+	Generator generator;
+
+	sf::Vector3i window_origin;
+	uint64_t frame = 0;
+
+	std::unordered_map<sf::Vector3i, std::shared_ptr<Chunk>, XYZHasher> chunks;
+	uint64_t resident_bytes = 0;
+
+	// Which chunk each slot of the ring buffer holds, if it holds one
+	std::vector<sf::Vector3i> slot_contents;
+	std::vector<bool> slot_filled;
+
+	std::vector<sf::Vector3i> requests;
+	std::unordered_map<sf::Vector3i, std::chrono::steady_clock::time_point, XYZHasher> requested_at;
+	std::unordered_set<sf::Vector3i, XYZHasher> in_flight;
+
+	std::vector<ChunkUpload> uploads;
+
+	// Shared with the workers
+	std::mutex finished_mutex;
+	std::vector<std::pair<std::shared_ptr<Chunk>, double>> finished;
+
+	ChunkStats stats;
+	double generate_ms_total = 0;
+	double latency_ms_total = 0;
+	uint64_t generated_chunks = 0;
+
+	ThreadPool workers;
+
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include <SFML/System/Vector3.hpp>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// An inclusive box, min to max
+struct DirtyRegion {
+	sf::Vector3i min;
+	sf::Vector3i max;
+
+	uint64_t volume() const {
+		return static_cast<uint64_t>(max.x - min.x + 1) * (max.y - min.y + 1) * (max.z - min.z + 1);
+	}
+};
+
+// Collects the boxes of a volume that changed since they were last taken, so only those
+// have to go back up to the device.
+//
+// Boxes are grown out to granularity aligned blocks, then merged with any box whose union
+// with them would be at most twice the size of the two. A brush stroke of single voxel
+// edits ends up as a handful of boxes instead of thousands of tiny writes. Past
+// max_regions the new box goes into whichever one it grows the least
+class DirtyRegions {
+public:
+
+	DirtyRegions(int granularity = 1, size_t max_regions = 64);
+
+	void add(sf::Vector3i min, sf::Vector3i max);
+
+	void add(sf::Vector3i position) { add(position, position); }
+
+	// Hands back the coalesced boxes and starts over
+	std::vector<DirtyRegion> take();
+
+	bool empty() const { return regions.empty(); }
+
+private:
+
+	static DirtyRegion merged(const DirtyRegion &a, const DirtyRegion &b);
+
+	int granularity;
+	size_t max_regions;
+
+	std::vector<DirtyRegion> regions;
+
+};
@@ -0,0 +1,38 @@
+#pragma once
+#include <SFML/System/Vector3.hpp>
+#include <vector>
+#include <cstdint>
+
+// Side length of the blocks the distance field is measured in
+#define DISTANCE_BLOCK 4
+
+class ThreadPool;
+
+// For every DISTANCE_BLOCK^3 block of voxel_data (indexed x + dim.x * (y + dim.y * z)),
+// the Chebyshev distance in blocks to the nearest block with a voxel in it, capped at 255.
+// 0 means the block itself isn't empty. Rays use it to leap through empty space.
+//
+// bounded treats everything past the edges of the volume as solid, so a leap never
+// leaves it. Chunks need that, their neighbours on the device can be anything.
+// The passes are split over workers if given one
+void generate_distance_field(
+	const char *voxel_data,
+	sf::Vector3i dimensions,
+	std::vector<uint8_t> &field,
+	sf::Vector3i &field_dimensions,
+	bool bounded,
+	ThreadPool *workers = nullptr
+);
+
+// The block at block just got something in it. Lowers every distance that's now nearer to
+// it, a shell of blocks at a time out from it until a whole shell is left alone, which is
+// as far as it can reach since neighbouring distances never differ by more than 1. Not for
+// bounded fields. Returns false if the block already was occupied, otherwise changed_min
+// and changed_max are the box of blocks that changed
+bool mark_distance_field_occupied(
+	std::vector<uint8_t> &field,
+	sf::Vector3i field_dimensions,
+	sf::Vector3i block,
+	sf::Vector3i &changed_min,
+	sf::Vector3i &changed_max
+);
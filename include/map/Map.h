@@ -6,7 +6,15 @@
 #include <queue>
 #include "util.hpp"
 #include "map/Octree.h"
+#include "map/BrickMap.h"
+#include "map/Occupancy.h"
+#include "map/Palette.h"
+#include "ThreadPool.h"
 #include <time.h>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <cstring>
 
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -24,15 +32,66 @@ public:
 
 	Map(uint32_t dimensions);
 
-	void generate_octree();
+	// Copy in an existing dimensions^3 volume instead of generating a random one.
+	// Indexed x + dimensions * (y + dimensions * z), the same as Old_Map
+	Map(uint32_t dimensions, const char *voxel_data);
 
+	// Build the octree from the voxel data, page_size is the slot count of the pool pages.
+	// The top levels are split into subtrees which are built in parallel on thread_count
+	// workers, 0 meaning one per hardware thread
+	void generate_octree(uint64_t page_size = 0x8000, unsigned int thread_count = 0);
+
+	// Print the octree build time for 1 up to hardware_concurrency threads
+	void benchmark_octree_build();
+
+	// Write the voxel data and edit the octree to match, no rebuild needed
 	void setVoxel(sf::Vector3i position, int val);
 
+	// Batched setVoxel, the octree gets one pass per touched node
+	void setVoxels(const std::vector<VoxelEdit> &edits);
+
+	// Time single and batched edits against the voxel data
+	bool validate_edits(int edit_count);
+
+	// Save the octree, map it back in and compare it against the voxel data
+	bool validate_save_load(std::string path);
+
+	// FNV-1a over the dimension and every voxel, what a saved octree of this map is
+	// tagged with so a stale file gets rebuilt instead of loaded
+	uint64_t voxel_key() const;
+
+	// Time the voxel array, get_voxel and the batched get_voxels over every voxel in
+	// linear and shuffled order, and check the batch against the array
+	bool benchmark_queries();
+
+	// Time point queries and ray casts over the pool as generated, breadth first and
+	// van Emde Boas, validating each layout
+	bool benchmark_layouts();
+
+	// Build a brickmap from the voxel data, compare every voxel and then again after
+	// edit_count random edits
+	bool validate_brickmap(int edit_count);
+
+	// Build the occupancy bits from the voxel data, compare every voxel, and time
+	// box_count random is_empty boxes against checking their voxels one at a time
+	bool validate_occupancy(int box_count);
+
+	// Pack the voxel data against a palette and compare every voxel, then again after
+	// edit_count random edits that bring in new materials and widen the indices
+	bool validate_palette(int edit_count);
+
 	bool getVoxelFromOctree(sf::Vector3i position);
 
 	bool getVoxel(sf::Vector3i pos);
 	Octree a;
 
+	// Compare every voxel in the octree against the voxel data
+	bool validate_octree();
+
+	// Cast random rays through the octree and compare them against a plain voxel
+	// stepping cast through the voxel data
+	bool validate_ray_casts(int ray_count);
+
 	void test_map();
 
 private:
@@ -42,10 +101,23 @@ private:
 	std::stringstream output_stream;
 	// =========================
 
-	uint64_t generate_children(sf::Vector3i pos, int dim);
+	// Build the subtree at pos into the given octree's pool
+	PendingDescriptor generate_children(sf::Vector3i pos, int dim, Octree *octree);
+
+	// Turn 8 child descriptors into their parent, copying the valid ones to the pool
+	PendingDescriptor combine_children(const PendingDescriptor *children, Octree *octree);
+
+	// Build the levels above split_level on top of the already built subtrees
+	PendingDescriptor generate_top_levels(sf::Vector3i pos, int dim, int level, int split_level, const std::vector<PendingDescriptor> &subtrees);
+
+	// Andrew Woo's voxel stepping through the voxel data, the ground truth for cast_ray
+	OctreeHit cast_ray_reference(sf::Vector3f origin, sf::Vector3f direction);
 
 	char* voxel_data;
 
+	// Side length of the cubic volume
+	uint32_t dimension;
+
 };
 
 
@@ -0,0 +1,42 @@
+#pragma once
+#include <SFML/System/Vector3.hpp>
+#include <vector>
+#include <cstdint>
+
+// Side length of the blocks the occupancy bits are packed in, 4^3 bits to a 64 bit word
+#define OCCUPANCY_BLOCK 4
+
+class ThreadPool;
+
+// One bit per voxel, solid or not, for the queries that don't care about the material.
+// Each word is a 4^3 block (bit x + 4 * (y + 4 * z) within it) and the words are in block
+// order, so a zero word is 64 empty voxels. summary is the same thing one level up, a
+// bit per block and a word per 4^3 blocks.
+//
+// voxel_data is indexed x + dim.x * (y + dim.y * z), dimensions a multiple of OCCUPANCY_BLOCK
+struct OccupancyGrid {
+
+	std::vector<uint64_t> words;
+	std::vector<uint64_t> summary;
+
+	// In blocks, and summary words
+	sf::Vector3i block_dimensions;
+	sf::Vector3i summary_dimensions;
+
+	// Builds both levels, the slices split over workers if given one
+	void generate(const char *voxel_data, sf::Vector3i dimensions, ThreadPool *workers = nullptr);
+
+	bool is_solid(sf::Vector3i position) const;
+
+	// Keeps the summary bit of the block in step
+	void set_solid(sf::Vector3i position, bool solid);
+
+	// Whether every voxel in [min, max] is empty. Whole summary words and blocks are
+	// skipped at a time, so this is cheap for the big boxes collision checks against.
+	// Outside of the grid counts as empty
+	bool is_empty(sf::Vector3i min, sf::Vector3i max) const;
+
+	static int bit_index(sf::Vector3i position) {
+		return (position.x & 3) + OCCUPANCY_BLOCK * ((position.y & 3) + OCCUPANCY_BLOCK * (position.z & 3));
+	}
+};
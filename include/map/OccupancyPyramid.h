@@ -0,0 +1,52 @@
+#pragma once
+#include <SFML/System/Vector3.hpp>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "map/Occupancy.h"
+
+// Most levels a pyramid will build, level 8 is a cell of 256^3 voxels
+#define MAX_MIP_LEVELS 8
+
+class ThreadPool;
+
+// A mip chain of "anything solid in here" flags over an OccupancyGrid. Level l has a byte
+// per 2^l cube of voxels, so each level is a 2^3 reduction of the one under it. Level 0
+// is the occupancy bits themselves and isn't stored.
+//
+// All the levels live back to back in flags, level l linear x + dim.x * (y + dim.y * z)
+// starting at level_offsets[l]. The kernel takes the coarsest empty cell around a ray in
+// one step and goes back down once it gets near something
+struct OccupancyPyramid {
+
+	std::vector<uint8_t> flags;
+
+	// Indexed by level, 0 unused. In cells
+	std::vector<size_t> level_offsets;
+	std::vector<sf::Vector3i> level_dimensions;
+
+	int levels = 0;
+
+	// As many levels as the dimensions halve evenly, up to MAX_MIP_LEVELS
+	void generate(const OccupancyGrid &occupancy, ThreadPool *workers = nullptr);
+
+	bool is_occupied(int level, sf::Vector3i position) const {
+		sf::Vector3i cell(position.x >> level, position.y >> level, position.z >> level);
+		return flags[cell_index(level, cell)] != 0;
+	}
+
+	// The voxel at position changed in occupancy, redo its cell on every level. Stops
+	// going up as soon as a level comes out the same
+	void update(const OccupancyGrid &occupancy, sf::Vector3i position);
+
+	size_t cell_index(int level, sf::Vector3i cell) const {
+		sf::Vector3i dimensions = level_dimensions[level];
+		return level_offsets[level] + cell.x + dimensions.x * (cell.y + static_cast<size_t>(dimensions.y) * cell.z);
+	}
+
+private:
+
+	// Level 1 straight from the occupancy words, the rest from the 8 cells below
+	uint8_t reduce(const OccupancyGrid &occupancy, int level, sf::Vector3i cell) const;
+
+};
@@ -1,31 +1,269 @@
 #pragma once
 #include <SFML/System/Vector3.hpp>
 #include <vector>
+#include <algorithm>
+#include <cfloat>
+#include <unordered_map>
 #include "util.hpp"
+#include "map/OctreePool.h"
 
 #define OCT_DIM 32
 
+// Points get_voxels traverses together
+#define OCT_BATCH_LANES 16
+
+// A dag gets compressed again once the groups its edits copied out of add up to this
+// many times what it took right after the last compression
+#define DAG_REPLACED_LIMIT 1
+
+// A child descriptor which has been generated but not yet copied to the pool.
+// The child pointer is relative to the page the descriptor ends up on, so it can't
+// be encoded until copy_to_stack places it. Until then we carry the global index
+// of its children alongside it
+struct PendingDescriptor {
+
+	PendingDescriptor() {};
+	PendingDescriptor(uint64_t descriptor, uint64_t child_index) :
+		descriptor(descriptor), child_index(child_index) {};
+
+	uint64_t descriptor = 0;
+	uint64_t child_index = 0;
+};
+
+// The result of casting a ray into the octree
+struct OctreeHit {
+
+	bool hit = false;
+
+	// The voxel the ray hit
+	sf::Vector3i voxel;
+
+	// Normal of the face the ray entered the voxel through. (0, 0, 0) if the
+	// ray started inside of it
+	sf::Vector3i face;
+
+	// Distance along the ray, in units of the direction vector's length
+	float t = 0;
+
+	// Number of octree nodes the traversal visited
+	int steps = 0;
+};
+
+// Version 2 of the on disk octree. The header is padded out to OCTREE_FILE_ALIGNMENT
+// so the descriptor pages that follow start on an OS page boundary and can be mapped
+// straight into the pool. Pages are written back to back, so a global index is also
+// the slot offset from the end of the header. Everything is stored little endian,
+// the same as in memory
+#define OCTREE_FILE_VERSION 2
+#define OCTREE_FILE_ALIGNMENT 4096
+
+struct OctreeFileHeader {
+
+	char magic[4] = { 'S', 'V', 'O', '1' };
+	uint32_t version = OCTREE_FILE_VERSION;
+	uint64_t header_size = OCTREE_FILE_ALIGNMENT;
+
+	// Slots per page and the number of pages after the header
+	uint64_t page_size = 0;
+	uint64_t page_count = 0;
+
+	// Allocator state so edits can carry on after a load
+	uint64_t stack_pos = 0;
+	uint64_t slots_used = 0;
+
+	uint64_t root_index = 0;
+	uint64_t far_pointer_count = 0;
+
+	// Side length and log2 of it
+	uint32_t dimension = 0;
+	uint32_t depth = 0;
+
+	uint32_t is_dag = 0;
+
+	// Whatever the caller says the octree was built from, so a file left over from
+	// another map or another build of this one isn't mapped in as if it were current
+	uint64_t source_key = 0;
+};
+
+static_assert(sizeof(OctreeFileHeader) <= OCTREE_FILE_ALIGNMENT, "Octree file header has to fit in the padding");
+
+// Orders relayout() can put the sibling groups in
+enum class OctreeLayout {
+
+	// Level by level from the root, the top of the tree ends up packed together
+	BREADTH_FIRST,
+
+	// Recursively split into a top half and the subtrees hanging off of it, each laid out
+	// the same way. Any path down the tree crosses few blocks whatever the cache size
+	VAN_EMDE_BOAS
+};
+
+// A single voxel write for Octree::set_voxels
+struct VoxelEdit {
+
+	VoxelEdit() {};
+	VoxelEdit(sf::Vector3i position, bool solid) :
+		position(position), solid(solid) {};
+
+	sf::Vector3i position;
+	bool solid = false;
+};
+
+// Hashes a sibling group by value so identical groups can be found when building the DAG
+struct GroupHasher {
+	std::size_t operator()(const std::vector<uint64_t>& k) const {
+		std::size_t hash = k.size();
+		for (uint64_t v : k)
+			hash ^= std::hash<uint64_t>()(v) + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+		return hash;
+	}
+};
+
 class Octree {
 public:
 	Octree();
 	~Octree() {};
 
-	uint64_t *blob = new uint64_t[100000];
+	OctreePool pool;
 
 	uint64_t root_index = 0;
-	uint64_t stack_pos = 0x8000;
-	uint64_t global_pos = 0;
 
-	uint64_t copy_to_stack(std::vector<uint64_t> children);
+	// The side length of the volume the root descriptor covers
+	int oct_dimensions = OCT_DIM;
+
+	// Place a group of sibling descriptors on the stack, encoding their child pointers
+	// for wherever they landed. Returns the global index of the first sibling
+	uint64_t copy_to_stack(const PendingDescriptor *children, int count);
+	uint64_t copy_to_stack(std::vector<PendingDescriptor> children);
+
+	// Follow the child pointer of the descriptor stored at descriptor_index, through
+	// its far slot if it has one, and return the global index of its first child
+	uint64_t get_child_index(uint64_t descriptor, uint64_t descriptor_index);
+
+	// True if the descriptor has valid non-leaf children stored in the pool
+	static bool has_children(uint64_t descriptor) {
+		return ((descriptor >> 16) & ~(descriptor >> 24) & 0xFF) != 0;
+	}
+
+	// The number of children in the sibling group the descriptor points to
+	static int child_count(uint64_t descriptor) {
+		return count_bits((int32_t)((descriptor >> 16) & ~(descriptor >> 24) & 0xFF));
+	}
+
+	// Position of child idx within the sibling group, the number of stored children before it
+	static int child_offset(uint64_t descriptor, int idx) {
+		return count_bits((int32_t)((descriptor >> 16) & ~(descriptor >> 24) & ((1 << idx) - 1)));
+	}
 
 	// With a position and the head of the stack. Traverse down the voxel hierarchy to find
 	// the IDX and stack position of the highest resolution (maybe set resolution?) oct
 	bool get_voxel(sf::Vector3i position);
 
-	void print_block(int block_pos);
+	// Batched get_voxel, results[i] is 1 if positions[i] is solid. Points are walked down
+	// the tree OCT_BATCH_LANES at a time in lock-step. Every lane does the same work each
+	// level and lanes that already found their answer are masked off instead of branched
+	// around, and the loads of all the lanes overlap. Points outside the volume come back 0
+	void get_voxels(const sf::Vector3i *positions, uint8_t *results, size_t count);
+
+	// Cast a ray through the octree and return the first solid voxel it hits before max_t.
+	// Uses the oct_state parent and idx stacks to push down into valid octs, advance
+	// across siblings and pop back up, so empty octs are skipped at whatever scale
+	// they're stored at instead of one voxel at a time
+	OctreeHit cast_ray(sf::Vector3f origin, sf::Vector3f direction, float max_t = FLT_MAX);
+
+	// Set or clear a single voxel without rebuilding. Walks down to the voxel, then fixes
+	// up the masks on the way back to the root. Sibling groups are only moved when a
+	// child appears or disappears, the old run goes back to the pool to be reused.
+	// Children that end up all solid or all empty collapse into a leaf
+	void set_voxel(sf::Vector3i position, bool solid);
+
+	// Same as set_voxel for a whole batch. Edits are bucketed by child on the way down
+	// so every touched node is visited, and its group rewritten, once. When two edits
+	// hit the same voxel the later one wins.
+	//
+	// On a dag the groups an edit copies out of may still be shared, so they're left in
+	// the pool and the pool grows with every edit. Once those add up to DAG_REPLACED_LIMIT
+	// times the compressed size the dag is compressed again, which drops everything
+	// nothing points to anymore and goes back to the default layout
+	void set_voxels(std::vector<VoxelEdit> edits);
+
+	// Write the header and raw pages to path, tagged with source_key
+	bool save(std::string path, uint64_t source_key = 0);
+
+	// Map a file written by save() in place of the current pool, nothing gets parsed
+	// or copied. Returns false and leaves the octree empty if the file doesn't check out
+	// or was saved with another source_key
+	bool load(std::string path, uint64_t source_key = 0);
+
+	// Dump the raw descriptors of a single page
+	void print_block(int page);
+
+	// Number of children reached through a far slot instead of the 15 bit pointer
+	uint64_t far_pointer_count = 0;
+
+	// Global index of every far slot, they hold absolute indices which need
+	// rebasing when pages get moved between pools. Edits don't prune this, it's
+	// only meant for stitching freshly built subtrees
+	std::vector<uint64_t> far_slots;
+
+	// Move the pages of an octree built on its own onto the end of our pool,
+	// rebasing its far slots. Returns the offset to add to any global index that
+	// pointed into the subtree. Both pools must use the same page size
+	uint64_t stitch(Octree &subtree);
+
+	// Empty the pool and reset the bookkeeping, optionally changing the page size
+	void clear(uint64_t page_size = 0);
+
+	// Rebuild the pool as a DAG, bottom-up hashing every sibling group so identical
+	// subtrees are stored once and shared by every parent that points to them. The
+	// encoding doesn't change, so get_voxel works on the result as is.
+	// Returns the compression ratio, bytes used before over bytes used after
+	double compress_to_dag();
+
+	// Rewrite the pool with the sibling groups in a cache friendly order and re-encode the
+	// child pointers for where they land. Parents always come before their children, and
+	// since the pool stacks downward the groups get copied in reverse so each page reads
+	// in layout order. Released runs are dropped along the way. Works on dags too
+	void relayout(OctreeLayout layout);
+
+	// Set once the pool has been compressed, groups may have more than one parent
+	bool is_dag = false;
+	double dag_compression_ratio = 1.0;
+
+	// Bytes used right after the last compression, and by the groups edits have copied
+	// out of since
+	uint64_t dag_compressed_bytes = 0;
+	uint64_t dag_replaced_bytes = 0;
+
+	uint64_t bytes_used() const { return pool.bytes_used(); }
+	uint64_t bytes_reserved() const { return pool.bytes_reserved(); }
 
 private:
 
+	// Apply the edits, which all fall inside the node at node_position, and return the
+	// node's new descriptor. node carries the node's masks and the global index of its
+	// children. Edits are reordered as they get bucketed by child
+	PendingDescriptor edit_node(PendingDescriptor node, sf::Vector3i node_position, int size, VoxelEdit *edits, int count);
+
+	// Append the groups in the top height levels under group in van Emde Boas order
+	void layout_van_emde_boas(uint64_t group_index, int group_size, int height, std::vector<std::pair<uint64_t, int>> &order);
+
+	// Collect the child groups depth levels below group, left to right
+	void groups_at_depth(uint64_t group_index, int group_size, int depth, std::vector<std::pair<uint64_t, int>> &groups);
+
+	// Copy a group into the relayout target, children first if they aren't there yet
+	uint64_t relayout_group(Octree &target, uint64_t group_index, int group_size, std::unordered_map<uint64_t, uint64_t> &moved);
+
+	// Release a sibling group, and the far slots packed after it, back to the pool
+	void release_group(uint64_t group_index, int group_size);
+
+	// Copy the sibling group at group_index into the dag, reusing an identical group if
+	// one has already been copied. Returns the group's index in the dag's pool. copied
+	// remembers where each group went, so a shared group is only walked once
+	uint64_t dedupe_group(Octree &dag, uint64_t group_index, int count,
+		std::unordered_map<std::vector<uint64_t>, uint64_t, GroupHasher> &groups,
+		std::unordered_map<uint64_t, uint64_t> &copied);
+
 	// (X, Y, Z) mask for the idx
 	const uint8_t idx_set_x_mask = 0x1;
 	const uint8_t idx_set_y_mask = 0x2;
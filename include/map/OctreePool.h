@@ -0,0 +1,121 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <string>
+#include <ostream>
+
+// Paged arena that backs the octree's child descriptors.
+//
+// Memory is handed out in fixed size pages which are allocated on demand, so the
+// octree only reserves what it actually needs and can keep growing for large maps.
+// Each page is a stack that grows downward from the top of the page. An allocation
+// never straddles two pages, which is what lets the child descriptors keep their
+// 15 bit pointers relative to the page they live in.
+//
+// Slots are addressed with a global index: (page number * page size) + slot
+class OctreePool {
+public:
+
+	// Page size is in slots (uint64_t's), must be a power of two and no larger
+	// than what the 15 bit child pointer can address (0x8000)
+	OctreePool(uint64_t page_size = 0x8000);
+	~OctreePool();
+
+	OctreePool(const OctreePool&) = delete;
+	OctreePool& operator=(const OctreePool&) = delete;
+
+	// Reserve count contiguous slots on a single page and return the global index
+	// of the first one. Opens a new page when the current one can't fit the run
+	uint64_t allocate(uint64_t count);
+
+	// The page an allocation of count slots would land on
+	uint64_t next_page(uint64_t count) const;
+
+	// Hand a run of count slots back to the pool once nothing points to it anymore
+	void release(uint64_t index, uint64_t count);
+
+	// Check if there is a released run of exactly count slots and which page it's on
+	bool has_released(uint64_t count, uint64_t &page) const;
+
+	// Take the run has_released found, returns its global index
+	uint64_t allocate_released(uint64_t count);
+
+	// Release every page and reset back to an empty pool
+	void clear();
+
+	// Move every page of the other pool onto the end of this one without copying.
+	// The other pool is left empty. Returns how far the other pool's global indices
+	// shifted, near pointers are page relative so only far slots need fixing up
+	uint64_t adopt(OctreePool &other);
+
+	// Clear the pool and switch to a different page size. Mostly useful for
+	// forcing far pointers on small maps
+	void set_page_size(uint64_t page_size);
+
+	uint64_t& operator[](uint64_t index) {
+		return pages[index >> page_shift][index & page_mask];
+	}
+
+	// Write the raw pages back to back, the same layout as flatten()
+	void write_pages(std::ostream &stream) const;
+
+	// Clear the pool and map page_count pages straight out of the file at offset, which
+	// has to be a multiple of the OS page size. The mapping is copy on write so the pool
+	// can still be edited without touching the file. stack_pos and slots_used pick the
+	// allocator back up where it was when the pages were written
+	bool map_pages(const std::string &path, uint64_t offset, uint64_t page_count, uint64_t stack_pos, uint64_t slots_used);
+
+	// If every page sits back to back in memory, which is the case right after map_pages,
+	// the pointer to the first one. Otherwise nullptr and flatten() has to be used
+	const uint64_t* contiguous_pages() const;
+
+	// Copy every page back to back into out, so a global index can be used directly
+	// as an offset into it. This is the layout the octree gets uploaded to the GPU in
+	void flatten(std::vector<uint64_t> &out) const;
+
+	uint64_t get_page_size() const { return page_size; }
+	uint64_t get_page_shift() const { return page_shift; }
+	uint64_t get_stack_pos() const { return stack_pos; }
+	uint64_t get_page_count() const { return pages.size(); }
+	uint64_t* get_page(uint64_t page) { return pages.at(page); }
+
+	// Page number and the global index of the first slot of the page holding index
+	uint64_t page_of(uint64_t index) const { return index >> page_shift; }
+	uint64_t page_base(uint64_t index) const { return index & ~page_mask; }
+
+	// The slot position of a global index within its own page
+	uint64_t page_offset(uint64_t index) const { return index & page_mask; }
+
+	// Bytes handed out by allocate() vs bytes held by the pages
+	uint64_t bytes_used() const { return slots_used * sizeof(uint64_t); }
+	uint64_t bytes_reserved() const { return pages.size() * page_size * sizeof(uint64_t); }
+
+private:
+
+	void add_page();
+
+	std::vector<uint64_t*> pages;
+
+	uint64_t page_size;
+	uint64_t page_shift = 0;
+	uint64_t page_mask;
+
+	// Top of the stack in the current (last) page
+	uint64_t stack_pos = 0;
+
+	// Runs handed back by release(), indexed by their length
+	std::vector<std::vector<uint64_t>> released;
+
+	// The first mapped_page_count pages point into a file mapping instead of the heap.
+	// Handles are kept as void* so the platform headers stay out of here
+	void *mapping = nullptr;
+	uint64_t mapping_size = 0;
+	uint64_t mapped_page_count = 0;
+	void *file_handle = nullptr;
+	void *mapping_handle = nullptr;
+
+	void unmap();
+
+	uint64_t slots_used = 0;
+
+};
@@ -6,32 +6,134 @@
 #include <iostream>
 #include <functional>
 #include <cmath>
+#include <cstdint>
 
 #define _USE_MATH_DEFINES
 #include <math.h>
 
 #include <deque>
+#include <vector>
+#include <string>
+#include "map/DistanceField.h"
+#include "map/Occupancy.h"
+#include "map/OccupancyPyramid.h"
+#include "map/DirtyRegions.h"
+#include "map/VoxelLayout.h"
+
+class ThreadPool;
 
 class Old_Map {
 public:
 
-	Old_Map(sf::Vector3i dim);
+	// MORTON_LAYOUT needs a cube with a power of two side, anything else stays linear
+	Old_Map(sf::Vector3i dim, MAP_LAYOUTS layout = LINEAR_LAYOUT);
 	~Old_Map();
 
-	void generate_terrain();
+	// The same seed gives the same terrain on any machine and any thread_count,
+	// 0 threads meaning one per hardware thread
+	void generate_terrain(uint64_t seed = 0, unsigned int thread_count = 0);
 
 	sf::Vector3i getDimensions();
+
+	// In the map's layout, index it with voxel_index
 	char* get_voxel_data();
+	MAP_LAYOUTS get_layout() const { return layout; }
+
+	size_t voxel_index(sf::Vector3i position) const { return layout_index(layout, position, dimensions); }
+	char get_voxel(sf::Vector3i position) const { return voxel_data[voxel_index(position)]; }
+
+	// A copy laid out linearly, for everything that builds off of the dense array
+	std::vector<char> get_linear_voxel_data() const;
+
+	// Step the same camera rays and incoherent shadow rays through a linear and a Morton
+	// copy of the map and print the time per voxel step of each
+	void benchmark_layouts(int ray_count);
+
+	// For every DISTANCE_BLOCK^3 block, the Chebyshev distance in blocks to the nearest
+	// block with a voxel in it, capped at 255. 0 means the block itself isn't empty.
+	// Rays use it to leap through empty space. generate_terrain builds it, call this
+	// again if the voxel data changes
+	void generate_distance_field(unsigned int thread_count = 0);
+
+	uint8_t* get_distance_field();
+	sf::Vector3i get_distance_field_dimensions();
+
+	// The solid or not bitset, see OccupancyGrid. Built by generate_terrain too, the
+	// shadow rays and collision queries go through this instead of voxel_data
+	void generate_occupancy(unsigned int thread_count = 0);
+	const OccupancyGrid& get_occupancy();
+
+	// The mip chain over the occupancy bits for the hierarchical traversal, built and
+	// kept up to date along with them
+	const OccupancyPyramid& get_occupancy_pyramid();
+
+	bool is_solid(sf::Vector3i position);
+
+	// Whether the box [min, max] is clear
+	bool is_empty(sf::Vector3i min, sf::Vector3i max);
+
+	// Live edits. Keeps the occupancy, its pyramid and the distance field in step and
+	// records what changed, so the caster only has to re-upload those boxes
+	void edit_voxel(sf::Vector3i position, char value);
+
+	// Boxes of voxels edited since the last call, aligned to OCCUPANCY_BLOCK so the same
+	// box covers their occupancy words. Shifted down a level it covers their pyramid cells
+	std::vector<DirtyRegion> take_dirty_voxels();
+
+	// Boxes of the distance field the edits changed, in blocks
+	std::vector<DirtyRegion> take_dirty_distance_field();
+
+	// Carve and fill stroke_count random spheres, flushing the dirty boxes into a copy of
+	// the voxels, occupancy, pyramid and distance field every few strokes the way the
+	// caster uploads them. The copy has to match the map after, and the map has to match
+	// a rebuild from scratch, the distance field only ever being short of it. Edits the map
+	bool validate_edits(int stroke_count);
+
+	// Stream a MagicaVoxel .vox in with the min corner of its scene at position, clipped to
+	// the map. Voxels are the file's color indices. Each task reads a range of one model's
+	// records straight into the map, an instance overlapping an earlier one waits for it
+	// so the later one still wins. If nothing's been generated the map starts out empty.
+	// The distance field and occupancy get rebuilt and the box marked dirty
+	bool import_vox(std::string path, sf::Vector3i position = sf::Vector3i(0, 0, 0), unsigned int thread_count = 0);
+
+	// The same for a raw volume of a byte per voxel, x then y then z. A few z slices per task
+	bool import_raw(std::string path, sf::Vector3i volume_dimensions, sf::Vector3i position = sf::Vector3i(0, 0, 0), unsigned int thread_count = 0);
+
+	// Write a scene of overlapping, rotated and instanced models as a .vox and a raw volume
+	// into directory, import them into an empty map like this one and compare every voxel
+	// against placing them by hand
+	bool validate_import(std::string directory);
 
 protected:
 
 private:
 
-	double* height_map;
-	char *voxel_data;
+	double* height_map = nullptr;
+	char *voxel_data = nullptr;
 	sf::Vector3i dimensions;
 
+	std::vector<uint8_t> distance_field;
+	sf::Vector3i distance_field_dimensions;
+
+	OccupancyGrid occupancy;
+	OccupancyPyramid occupancy_pyramid;
+
+	DirtyRegions dirty_voxels = DirtyRegions(OCCUPANCY_BLOCK);
+	DirtyRegions dirty_distance_field;
+
+	// Allocate the voxels if they aren't yet and zero them
+	void clear_voxels(ThreadPool &workers);
+
+	// Rebuild what's derived from the voxels after an import of the box [min, max]
+	void finish_import(sf::Vector3i min, sf::Vector3i max, unsigned int thread_count);
+
+	// Generation only, everything is generated linear and laid out at the end
 	void set_voxel(sf::Vector3i position, int val);
+
+	// Move the linear voxels into the map's layout
+	void apply_layout(ThreadPool &workers);
+
+	MAP_LAYOUTS layout;
 	double sample(int x, int y);
 	void set_sample(int x, int y, double value);
 	void sample_square(int x, int y, int size, double value);
@@ -0,0 +1,62 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Most a palette can hold, with 8 bit indices
+#define PALETTE_SIZE 256
+
+// Voxels stored as indices into a palette of the materials that actually show up.
+//
+// Indices are packed 32 / bits to a word, so they never straddle two words. bits is 0, 1,
+// 2, 4 or 8, 0 being a run of one material with no indices at all (palette[0] is it). Most
+// chunks are air and a couple of materials, so this is 2 - 8x smaller than a char each.
+// Setting a voxel to a material that isn't in the palette yet widens the indices when
+// the palette outgrows them
+class PalettedVoxels {
+public:
+
+	// voxel_count voxels of air
+	PalettedVoxels(size_t voxel_count = 0);
+
+	// Pack a dense array, at the narrowest width its materials fit in
+	void load_dense(const char *voxels, size_t voxel_count);
+
+	// And back out into one
+	void decode(char *voxels) const;
+
+	char get(size_t index) const {
+
+		if (bits == 0)
+			return palette[0];
+
+		size_t bit = index * bits;
+
+		return palette[(words[bit / 32] >> (bit % 32)) & ((1u << bits) - 1)];
+	}
+
+	void set(size_t index, char value);
+
+	int get_bits() const { return bits; }
+	size_t get_voxel_count() const { return voxel_count; }
+
+	const std::vector<char>& get_palette() const { return palette; }
+	const std::vector<uint32_t>& get_words() const { return words; }
+
+	uint64_t bytes_used() const { return palette.size() + words.size() * sizeof(uint32_t); }
+
+private:
+
+	// Repack every index at new_bits
+	void widen(int new_bits);
+
+	// Narrowest width that can index palette_size entries
+	static int bits_for(size_t palette_size);
+
+	size_t voxel_count;
+	int bits = 0;
+
+	std::vector<char> palette;
+	std::vector<uint32_t> words;
+
+};
@@ -0,0 +1,84 @@
+#pragma once
+#include <SFML/System/Vector3.hpp>
+#include <functional>
+#include <string>
+#include <map>
+#include <vector>
+#include <cstdint>
+
+// Records read off of disk at a time per task
+#define VOX_RECORD_BATCH 16384
+
+// Records per import task, so a single big model still spreads over the workers
+#define VOX_TASK_RECORDS (1 << 18)
+
+// One voxel as it's stored in an XYZI chunk, z is up like the map's
+struct VoxRecord {
+	uint8_t x, y, z;
+	uint8_t color_index;
+};
+
+// A model placed in the scene. The scene graph can place the same model more than once.
+// A voxel at local p lands on rotation * (p - size / 2) + translation, rotation being
+// one of the 48 signed axis permutations
+struct VoxInstance {
+	int model = 0;
+	int rotation[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+	sf::Vector3i translation;
+
+	sf::Vector3i transform(sf::Vector3i local, sf::Vector3i size) const;
+
+	// The inclusive box the instance covers
+	void bounds(sf::Vector3i size, sf::Vector3i &min, sf::Vector3i &max) const;
+};
+
+// A MagicaVoxel .vox file. open() only walks the chunk headers, remembering where each
+// model's XYZI records start, and parses the scene graph. The records themselves are
+// read a batch at a time by read_records, so any number of tasks can each stream a
+// range of a model in on their own file handle and nothing holds the whole file
+class VoxFile {
+public:
+
+	bool open(std::string path);
+
+	const std::vector<VoxInstance>& get_instances() const { return instances; }
+
+	sf::Vector3i get_model_size(int model) const { return models[model].size; }
+	uint32_t get_voxel_count(int model) const { return models[model].voxel_count; }
+
+	// Min and max corner of every instance together
+	void bounds(sf::Vector3i &min, sf::Vector3i &max) const;
+
+	// RGBA per color index. Index 0 is empty, so the file's color i is palette[i + 1]
+	const uint32_t* get_palette() const { return palette; }
+
+	// Call sink for each batch of the records [first, first + count) of model
+	bool read_records(int model, uint32_t first, uint32_t count, std::function<void(const VoxRecord*, size_t)> sink) const;
+
+private:
+
+	struct VoxModel {
+		sf::Vector3i size;
+		uint32_t voxel_count = 0;
+
+		// File offset of the first record
+		uint64_t records_offset = 0;
+	};
+
+	struct SceneNode {
+		enum { TRANSFORM, GROUP, SHAPE } type = GROUP;
+		VoxInstance transform;
+		bool hidden = false;
+		std::vector<int> children;
+		std::vector<int> models;
+	};
+
+	// Walk the scene graph from node, adding an instance for every model of every shape
+	void place(const std::map<int, SceneNode> &nodes, int node, const VoxInstance &parent, int depth);
+
+	std::string path;
+	std::vector<VoxModel> models;
+	std::vector<VoxInstance> instances;
+	uint32_t palette[256];
+
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <SFML/System/Vector3.hpp>
+#include <cstdint>
+#include <cstddef>
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+// How a dense map lays out its voxels. The kernel finds it in map_offset.w
+enum MAP_LAYOUTS {
+
+	// x + dim.x * (y + dim.z * z)
+	LINEAR_LAYOUT = 0,
+
+	// ChunkManager's window, a palette and packed indices per chunk
+	PALETTED_LAYOUT = 1,
+
+	// The bits of x, y and z interleaved, zyxzyx... So every aligned 2^n cube is one
+	// contiguous run, and a step along any axis stays close in memory
+	MORTON_LAYOUT = 2
+};
+
+// Up to 10 bits a component, 1024^3
+inline uint32_t morton_encode(sf::Vector3i position) {
+
+#ifdef __BMI2__
+	return _pdep_u32(position.x, 0x09249249) | _pdep_u32(position.y, 0x12492492) | _pdep_u32(position.z, 0x24924924);
+#else
+	// Each byte spread out to every third bit
+	struct SpreadTable {
+		uint32_t entries[256];
+		SpreadTable() {
+			for (uint32_t i = 0; i < 256; i++) {
+				entries[i] = 0;
+				for (int bit = 0; bit < 8; bit++)
+					entries[i] |= ((i >> bit) & 1) << (bit * 3);
+			}
+		}
+	};
+
+	static const SpreadTable table;
+
+	auto spread = [](uint32_t v) {
+		return table.entries[v & 0xFF] | (table.entries[(v >> 8) & 0x3] << 24);
+	};
+
+	return spread(position.x) | (spread(position.y) << 1) | (spread(position.z) << 2);
+#endif
+}
+
+// The layout's index of position in a map of the given dimensions
+inline size_t layout_index(MAP_LAYOUTS layout, sf::Vector3i position, sf::Vector3i dimensions) {
+
+	if (layout == MORTON_LAYOUT)
+		return morton_encode(position);
+
+	return position.x + static_cast<size_t>(dimensions.x) * (position.y + static_cast<size_t>(dimensions.z) * position.z);
+}
@@ -6,9 +6,13 @@
 #include <string.h>
 #include "LightController.h"
 #include "map/Old_Map.h"
+#include "map/Octree.h"
+#include "map/BrickMap.h"
+#include "map/ChunkManager.h"
 #include "Camera.h"
 #include <GL/glew.h>
 #include <unordered_map>
+#include "raycaster/RayCaster.h"
 
 #ifdef linux
 #include <CL/cl.h>
@@ -99,7 +103,8 @@ struct raycaster_settings {
 
 struct PackedData;
 
-class Hardware_Caster
+// Runs the rays as OpenCL kernels, writing straight into the viewport texture over GL sharing
+class Hardware_Caster : public RayCaster
 {
 
 
@@ -155,42 +160,72 @@ public:
 
 	
 	// Queries hardware, creates the command queue and context, and compiles kernel
-	int init();
+	int init() override;
 
 	// Creates a texture to send to the GPU via height and width
 	// Creates a viewport vector array via vertical and horizontal fov
-	void create_viewport(int width, int height, float v_fov, float h_fov) ;
+	void create_viewport(int width, int height, float v_fov, float h_fov) override;
 	
 	// Light controllers own the copy of the PackedData array.
 	// We receive a pointer to the array and USE_HOST_POINTER to map the memory to the GPU
-	void assign_lights(std::vector<PackedData> *data) ;
+	void assign_lights(std::vector<PackedData> *data) override;
 
-	// We take a ptr to the map and create the map, and map_dimensions buffer for the GPU
-	void assign_map(Old_Map *map) ;
+	// We take a ptr to the map and create the map, map_dimensions and distance_field buffers for the GPU
+	void assign_map(Old_Map *map) override;
+
+	// Flatten the octree's pool and upload it along with the octree_settings buffer
+	// {root index, page shift, dimension}. Re-upload after the octree changes
+	void assign_octree(Octree *octree) override;
+
+	// Stream the dense kernel's map out of the chunk manager's window instead of an Old_Map.
+	// Creates window sized map, distance_field and map_offset buffers, empty until upload_chunks
+	void assign_chunk_manager(ChunkManager *chunk_manager) override;
+
+	// Write the chunks that moved into the window since the last call and the new ring offset.
+	// Call after ChunkManager::update
+	void upload_chunks() override;
+
+	// Write the boxes of the map, occupancy and distance field that Old_Map::edit_voxel
+	// changed since the last call. Call once a frame
+	void flush_map_edits() override;
+
+	// Bytes written to the device since the last call, for the per frame upload stats
+	uint64_t take_uploaded_bytes() override;
+
+	// Upload the brickmap's grid and brick pool along with the brickmap_settings buffer
+	// {grid x, grid y, grid z}. Re-upload after the brickmap changes
+	void assign_brickmap(BrickMap *brickmap) override;
+
+	// Switch the kernel compute() runs, the data for the mode has to be assigned first
+	void set_storage_mode(STORAGE_MODES mode) override;
+
+	void set_dense_traversal(DENSE_TRAVERSALS traversal) override;
 
 	// We take a ptr to the camera and create a camera direction and position buffer
-	void assign_camera(Camera *camera) ;
+	void assign_camera(Camera *camera) override;
 
-	// TODO: Hoist this to the base class
 	// Creates 3 buffers relating to the texture atlas: texture_atlas, atlas_dim, and tile_dim
 	// With these on the GPU we can texture any quad with an atlas tile
-	void create_texture_atlas(sf::Texture *t, sf::Vector2i tile_dim);
+	void create_texture_atlas(sf::Texture *t, sf::Vector2i tile_dim) override;
 	
 	// Check to make sure that the buffers have been initiated and set them as kernel args
-	void validate() ;
+	void validate() override;
 
 	// Aquires the GL objects, runs the kernel, releases back the GL objects
-	void compute() ;
+	void compute() override;
 
 	// Take the viewport sprite and draw it to the screen
-	void draw(sf::RenderWindow* window) ;
+	void draw(sf::RenderWindow* window) override;
+
+	// Rebuilds the viewport buffers and points the kernels at them
+	void resize_viewport(sf::Vector2i resolution) override;
 
 	bool load_config();
 	void save_config();
 	// ================================== DEBUG =======================================
 	
 	// Re compile the kernel and revalidate the args
-	int debug_quick_recompile();
+	int debug_quick_recompile() override;
 
 	// Modify the viewport matrix
 	void test_edit_viewport(int width, int height, float v_fov, float h_fov);
@@ -198,6 +233,9 @@ public:
 
 private:
 
+	// The dense kernel can run off of either an Old_Map or a chunk manager's window
+	bool has_dense_map() const { return map != nullptr || chunk_manager != nullptr; };
+
 	// Iterate the devices available and choose the best one
 	// Also checks for the sharing extension
 	int acquire_platform_and_device();
@@ -224,6 +262,22 @@ private:
 
 	// Create a buffer with user defined data flags
 	int create_buffer(std::string buffer_name, cl_uint size, void* data, cl_mem_flags flags);
+
+	// Overwrite size bytes of an existing buffer, offset bytes in
+	int write_buffer(std::string buffer_name, size_t size, const void* data, size_t offset = 0);
+
+	// Overwrite a box of an existing 3d buffer laid out x + dim.x * (y + dim.y * z) with
+	// clEnqueueWriteBufferRect. data is just the box, packed. In elements of element_size bytes
+	int write_buffer_region(std::string buffer_name, sf::Vector3i buffer_dimensions, sf::Vector3i position, sf::Vector3i region, size_t element_size, const void* data);
+
+	// The same but the box comes out of data at data_position, data being a whole data_dimensions volume
+	int write_buffer_region(std::string buffer_name, sf::Vector3i buffer_dimensions, sf::Vector3i position, sf::Vector3i region, size_t element_size, const void* data, sf::Vector3i data_dimensions, sf::Vector3i data_position);
+
+	// {levels, traversal, offset of each level} for the kernel, see OccupancyPyramid
+	void upload_mip_settings();
+
+	// Morton laid out maps don't have boxes, their OCCUPANCY_BLOCK aligned blocks go up as runs
+	void write_morton_region(const DirtyRegion &region);
 	
 	// Store a cl_mem object in the buffer map <string:name, cl_mem:buffer>
 	int store_buffer(cl_mem buffer, std::string buffer_name);
@@ -265,20 +319,15 @@ private:
 	std::map<std::string, cl_mem> buffer_map;
 	std::unordered_map<std::string, std::pair<sf::Sprite, std::unique_ptr<sf::Texture>>> image_map;
 
-	sf::Sprite viewport_sprite;
-	sf::Texture viewport_texture;
-
-	Old_Map * map = nullptr;
-	Camera *camera = nullptr;
-	//	std::vector<LightController::PackedData> *lights;
-	std::vector<PackedData> *lights;
-	int light_count = 0;
-	sf::Uint8 *viewport_image = nullptr;
-	sf::Vector4f *viewport_matrix = nullptr;
-	sf::Vector2i viewport_resolution;
+	ChunkManager *chunk_manager = nullptr;
+	Octree *octree = nullptr;
+	BrickMap *brickmap = nullptr;
 
 	int error = 0;
 
+	// Everything the buffer creates and writes copied up, until take_uploaded_bytes
+	uint64_t uploaded_bytes = 0;
+
 	std::vector<device> device_list;
 
 };
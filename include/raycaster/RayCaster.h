@@ -0,0 +1,120 @@
+#pragma once
+#include <SFML/Graphics.hpp>
+#include <vector>
+#include <cstdint>
+#include "Vector4.hpp"
+#include "map/Old_Map.h"
+#include "map/Octree.h"
+#include "map/BrickMap.h"
+#include "map/ChunkManager.h"
+#include "Camera.h"
+
+struct PackedData;
+
+// What every caster looks like to the rest of the program, whether the rays run in an
+// OpenCL kernel or on the CPU. The lens, the viewport image and the things the rays
+// read off of are kept here, each caster gets them to wherever its rays are
+class RayCaster {
+public:
+
+	// Which map representation the rays walk through
+	enum STORAGE_MODES {
+		DENSE = 0,
+		OCTREE = 1,
+		BRICKMAP = 2
+	};
+
+	// How the dense traversal gets through empty space. Chunks only have the distance field
+	enum DENSE_TRAVERSALS {
+		DISTANCE_FIELD_TRAVERSAL = 0,
+		MIP_TRAVERSAL = 1
+	};
+
+	RayCaster();
+	virtual ~RayCaster();
+
+	// 1 if the caster is ready for data
+	virtual int init() = 0;
+
+	// The viewport image and the ray for each of its pixels, the "lens" of the camera
+	virtual void create_viewport(int width, int height, float v_fov, float h_fov) = 0;
+
+	// Light controllers own the copy of the PackedData array, we only keep the pointer
+	virtual void assign_lights(std::vector<PackedData> *data) = 0;
+
+	virtual void assign_map(Old_Map *map) = 0;
+	virtual void assign_camera(Camera *camera) = 0;
+
+	// Every quad gets textured off of one tile of the atlas
+	virtual void create_texture_atlas(sf::Texture *t, sf::Vector2i tile_dim) = 0;
+
+	// Check that everything the rays need is there
+	virtual void validate() = 0;
+
+	// Render a frame into the viewport image
+	virtual void compute() = 0;
+
+	// Take the viewport sprite and draw it to the screen, stretched over the whole window
+	virtual void draw(sf::RenderWindow* window) = 0;
+
+	// Render at another resolution through the same lens, draw stretches it back out
+	virtual void resize_viewport(sf::Vector2i resolution);
+	sf::Vector2i get_viewport_resolution() const { return viewport_resolution; };
+
+	// The rest is for casters with other map representations or a copy of the map somewhere
+	// else. A caster that doesn't have one ignores it and stays on the dense map
+
+	virtual void assign_octree(Octree *octree) {};
+	virtual void assign_brickmap(BrickMap *brickmap) {};
+	virtual void assign_chunk_manager(ChunkManager *chunk_manager) {};
+	virtual void upload_chunks() {};
+
+	// Send up whatever Old_Map::edit_voxel changed, once a frame
+	virtual void flush_map_edits() {};
+
+	// Bytes sent to wherever the rays run since the last call
+	virtual uint64_t take_uploaded_bytes() { return 0; };
+
+	virtual void set_storage_mode(STORAGE_MODES mode) { storage_mode = mode; };
+	STORAGE_MODES get_storage_mode() const { return storage_mode; };
+
+	virtual void set_dense_traversal(DENSE_TRAVERSALS traversal) { dense_traversal = traversal; };
+	DENSE_TRAVERSALS get_dense_traversal() const { return dense_traversal; };
+
+	// Rebuild whatever the rays run from, 0 when it's done
+	virtual int debug_quick_recompile() { return 0; };
+
+protected:
+
+	// Fill viewport_matrix with a normalized ray per pixel, x + width * y
+	void create_viewport_matrix(int width, int height, float v_fov, float h_fov);
+
+	// And viewport_image with RGBA 255, 255, 255, 100
+	void create_viewport_image(int width, int height);
+
+	// Scale the sprite so the viewport covers the window. The texture is filtered, so
+	// below the window's resolution it's a bilinear upscale for free on the draw
+	void fit_viewport_sprite(sf::RenderWindow* window);
+
+	sf::Sprite viewport_sprite;
+	sf::Texture viewport_texture;
+
+	Old_Map * map = nullptr;
+	Camera *camera = nullptr;
+	STORAGE_MODES storage_mode = DENSE;
+	DENSE_TRAVERSALS dense_traversal = DISTANCE_FIELD_TRAVERSAL;
+
+	std::vector<PackedData> *lights = nullptr;
+	int light_count = 0;
+
+	sf::Uint8 *viewport_image = nullptr;
+	sf::Vector4f *viewport_matrix = nullptr;
+	sf::Vector2i viewport_resolution;
+
+	// Radians between neighbouring pixels' rays, x across and y down
+	sf::Vector2f viewport_increment;
+
+	// Degrees the viewport covers, v_fov and h_fov as create_viewport got them
+	sf::Vector2f viewport_fov;
+
+};
@@ -0,0 +1,80 @@
+#pragma once
+#include <SFML/System/Vector2.hpp>
+
+// The render scale moves in steps of this, so it isn't rebuilding the viewport over noise
+#define RESOLUTION_SCALE_STEP 0.05f
+
+// Both sides of the render resolution are a multiple of this
+#define RESOLUTION_ALIGNMENT 8
+
+// Aim this far under the budget so a slightly heavier frame doesn't go over
+#define RESOLUTION_HEADROOM 0.85f
+
+// Weight of the newest frame in the average render time
+#define RESOLUTION_SMOOTHING 0.25f
+
+// Frames thrown out after a resize, the first ones at a new size aren't representative
+#define RESOLUTION_SETTLE_FRAMES 2
+
+// Scaling back up waits for this many frames in a row under RESOLUTION_RAISE_BELOW of the
+// budget, and then only goes up by RESOLUTION_RAISE_MAX at a time
+#define RESOLUTION_RAISE_FRAMES 30
+#define RESOLUTION_RAISE_BELOW 0.7f
+#define RESOLUTION_RAISE_MAX 0.1f
+
+// Frames of render times kept for the Performance window
+#define RESOLUTION_HISTORY 200
+
+// Picks the resolution the caster renders at so compute() fits in a frame time budget,
+// a fraction of the output resolution between min and max scale. Ray cost goes with the
+// pixel count, so the scale moves with the square root of how far off the budget it is.
+// It drops as soon as the average is over the budget and climbs back slowly, a blurrier
+// frame is better than a late one
+class ResolutionScaler {
+public:
+
+	ResolutionScaler(sf::Vector2i output_resolution, float budget_ms = 8.3f, float min_scale = 0.25f, float max_scale = 1.0f);
+
+	// Tell it how long the last compute() took. True if the render resolution changed
+	// and the caster should be resized to get_render_resolution()
+	bool frame(double render_ms);
+
+	sf::Vector2i get_render_resolution() const;
+	sf::Vector2i get_output_resolution() const { return output_resolution; };
+	float get_scale() const { return scale; };
+	double get_average_ms() const { return average_ms; };
+
+	// Turned off it goes back to max scale on the next frame
+	void set_enabled(bool enabled);
+	bool get_enabled() const { return enabled; };
+
+	void set_budget(float budget_ms) { this->budget_ms = budget_ms; };
+	float get_budget() const { return budget_ms; };
+
+	// The scale and render times, and the budget and scale bounds to play with
+	void draw();
+
+private:
+
+	sf::Vector2i output_resolution;
+
+	float budget_ms;
+	float min_scale;
+	float max_scale;
+	float scale;
+
+	// What the caster was last told to render at
+	sf::Vector2i render_resolution;
+
+	bool enabled = true;
+
+	double last_ms = 0;
+	double average_ms = 0;
+	int samples = 0;
+	int settle = 0;
+	int under_budget = 0;
+
+	float render_ms_array[RESOLUTION_HISTORY]{0};
+	int arr_pos = 0;
+
+};
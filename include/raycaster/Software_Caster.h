@@ -0,0 +1,209 @@
+#pragma once
+#include <SFML/Graphics.hpp>
+#include <vector>
+#include "raycaster/RayCaster.h"
+#include "ThreadPool.h"
+
+// Side of the square of pixels a task renders
+#define TILE_SIZE 16
+
+// Woo steps before a camera ray gives up, and a shadow ray
+#define MAX_RAY_STEPS 700
+#define MAX_SHADOW_STEPS 300
+
+// Primary rays go out in packets of a 4x2 block of pixels, 8 lanes of AVX2
+#define PACKET_WIDTH 4
+#define PACKET_HEIGHT 2
+#define PACKET_RAYS (PACKET_WIDTH * PACKET_HEIGHT)
+
+// Once fewer lanes than this are still stepping, they finish as scalar rays
+#define PACKET_MIN_LANES 3
+
+// With reprojection on, a pixel is traced fresh at least once in this many frames
+#define REPROJECTION_REFRESH 8
+
+// Neighbouring hits further apart than this, in voxels, are an edge where things can come
+// out from behind each other. Pixels reprojected off of one get traced
+#define REPROJECTION_EDGE_DEPTH 2.0f
+
+// Cells in front of a reprojected hit that have to be empty for it to still be the hit
+#define REPROJECTION_CLEARANCE 4
+
+// The dense raycaster kernel on the CPU, for machines without an OpenCL device that can
+// share with GL. Same lens, same Woo stepping and leaps, same atlas sampling, lighting
+// and shadow rays, so a frame comes out looking like the kernel's.
+//
+// The viewport is cut into TILE_SIZE^2 tiles which are spread over a ThreadPool, workers
+// that finish their tiles steal from the others. The frame stays in viewport_image, the
+// texture is only made when it's drawn so it can run without a window.
+//
+// Built with AVX2 (__AVX2__, see CPU_CASTER_AVX2 in CMakeLists) the camera rays of a tile
+// are traced PACKET_RAYS at a time, lanes masked off as they hit or leave the map.
+// Otherwise, or on the mip traversal, a packet is just its rays one after another.
+//
+// With reprojection on, every pixel remembers the voxel it hit and how far away it was.
+// The next frame follows each new ray out to that depth, looks up which pixel of the last
+// frame saw that spot and reuses its voxel if the new ray really goes through it. Only the
+// pixels that miss, land on an edge or are due a refresh get traced. The shadow is reused
+// too while the light stays put. Edits to the map throw the history out.
+//
+// It's a heuristic, not exact. Only the REPROJECTION_CLEARANCE cells in front of a reused
+// voxel are checked, so something further along the ray that should have hidden it shows
+// through until the pixel's refresh. The shadow is kept per voxel face, so a shadow edge
+// across a face snaps to the face until then too. Off unless asked for
+class Software_Caster : public RayCaster {
+public:
+
+	// A thread count of 0 is one per hardware thread
+	Software_Caster(unsigned int thread_count = 0);
+	virtual ~Software_Caster();
+
+	int init() override;
+
+	void create_viewport(int width, int height, float v_fov, float h_fov) override;
+	void assign_lights(std::vector<PackedData> *data) override;
+	void assign_map(Old_Map *map) override;
+	void assign_camera(Camera *camera) override;
+
+	// Keeps a copy of the atlas' pixels to sample from
+	void create_texture_atlas(sf::Texture *t, sf::Vector2i tile_dim) override;
+
+	// The same straight from an image, a texture needs a GL context to load into
+	void create_texture_atlas(const sf::Image &atlas, sf::Vector2i tile_dim);
+
+	void validate() override;
+	void compute() override;
+	void draw(sf::RenderWindow* window) override;
+
+	// Only the dense map is walked on the CPU
+	void set_storage_mode(STORAGE_MODES mode) override;
+
+	// Edits make the last frame's hits stale
+	void flush_map_edits() override;
+
+	// RGBA, viewport_resolution.x * viewport_resolution.y of it, as of the last compute()
+	const sf::Uint8* get_viewport_image() const { return viewport_image; };
+
+	// Trace camera rays in packets or one at a time
+	void set_packet_rays(bool enabled) { packet_rays = enabled; };
+	bool get_packet_rays() const { return packet_rays; };
+
+	// Trace every camera ray of the current view frames times, one at a time and then in
+	// packets, on this thread. Prints the rays per second of each and whether they agree
+	void benchmark_packets(int frames);
+
+	// Reuse the last frame's hits where they're still good
+	void set_reprojection(bool enabled);
+	bool get_reprojection() const { return reprojection; };
+
+	// Camera rays actually traced by the last compute()
+	int get_traced_rays() const { return traced_rays; };
+
+private:
+
+	// Everything a frame's rays read that doesn't change during the frame
+	struct FrameState {
+		sf::Vector3f camera_position;
+		float pitch_sin, pitch_cos;
+		float yaw_sin, yaw_cos;
+
+		//  0  1  2  3  4  5  6  7   8   9
+		// {r, g, b, i, x, y, z, x', y', z'}
+		float light[10];
+
+		// Whether the history can be reprojected, and whether its shadows still hold
+		bool reproject = false;
+		bool light_moved = true;
+
+		int frame_number = 0;
+	};
+
+	// Where a camera ray ended up, in the kernel's terms. face_mask is -1 on the axis it
+	// came in through and voxel_step is -1 on the axes the ray heads positive along
+	struct RayHit {
+
+		enum { HIT, PAST_MAX, PAST_MIN, OUT_OF_STEPS } result;
+
+		sf::Vector3i voxel;
+		sf::Vector3i face_mask;
+		sf::Vector3i voxel_step;
+		sf::Vector3f intersection_t;
+		sf::Vector3f delta_t;
+		int voxel_data = 0;
+		int steps = 0;
+
+		// -1 until shade casts the shadow ray
+		int shadowed = -1;
+	};
+
+	// What a pixel saw last frame. depth is along the ray to where it entered the voxel,
+	// 0 when it didn't hit anything. face is the axis + 1 of the face it came in through,
+	// negative when the ray went down that axis
+	struct PixelHistory {
+		sf::Vector3i voxel;
+		float depth = 0;
+		int8_t face = 0;
+		int8_t shadowed = 0;
+	};
+
+	FrameState frame_state() const;
+
+	// Returns how many of its rays had to be traced
+	int render_tile(int tile, const FrameState &frame);
+
+	// The lens ray of the pixel swung around to where the camera is pointing
+	sf::Vector3f ray_direction(sf::Vector2i pixel, const FrameState &frame) const;
+
+	RayHit trace(sf::Vector3f ray_pos, sf::Vector3f ray_dir) const;
+
+	// The Woo loop of trace, carrying on from wherever hit left off
+	void march(RayHit &hit, int &mip_level) const;
+
+	// trace for PACKET_RAYS rays out of ray_pos at once, the same hits come out
+	void trace_packet(sf::Vector3f ray_pos, const sf::Vector3f *ray_dir, RayHit *hits) const;
+
+	// The color the kernel would write for the ray. Casts the shadow ray if the hit doesn't
+	// know whether it's in shadow yet
+	sf::Vector4f shade(RayHit &hit, sf::Vector3f ray_dir, const FrameState &frame) const;
+
+	// Find the hit of the ray out of pixel in the last frame's history. False if it has to be traced
+	bool reproject(sf::Vector2i pixel, sf::Vector3f ray_dir, const FrameState &frame, RayHit &hit) const;
+
+	// The pixel of the last frame whose ray went closest to position, false if it's off screen
+	bool project(sf::Vector3f position, const FrameState &frame, sf::Vector2i &pixel) const;
+
+	// The hit of a ray out of ray_pos if it goes through voxel and the last few cells before
+	// it are empty, worked out instead of stepped
+	bool intersect_voxel(sf::Vector3f ray_pos, sf::Vector3f ray_dir, sf::Vector3i voxel, RayHit &hit) const;
+
+	PixelHistory record(const RayHit &hit) const;
+
+	// Whether anything is between ray_pos and the light
+	bool cast_light_intersection_ray(sf::Vector3f ray_dir, sf::Vector3f ray_pos, const FrameState &frame) const;
+
+	// Skip the empty space around voxel with whichever leap dense_traversal says
+	void empty_space_leap(int &mip_level, sf::Vector3i &voxel, sf::Vector3f &intersection_t, sf::Vector3f delta_t, sf::Vector3i voxel_step) const;
+
+	sf::Vector4f sample_atlas(sf::Vector2f tile_face_position) const;
+
+	ThreadPool workers;
+
+	sf::Image texture_atlas;
+	sf::Vector2i atlas_dim;
+	sf::Vector2i tile_dim;
+
+	bool valid = false;
+	bool packet_rays = true;
+
+	bool reprojection = false;
+	bool history_valid = false;
+	FrameState history_frame;
+
+	// Last frame's and this frame's, swapped after each compute
+	std::vector<PixelHistory> history;
+	std::vector<PixelHistory> next_history;
+
+	int frame_number = 0;
+	int traced_rays = 0;
+
+};
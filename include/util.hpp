@@ -50,6 +50,28 @@ private:
 
 };
 
+// Counter based RNG for the terrain. Every random number is a hash of the seed, a stream
+// for the part of the generator asking, and a counter within it, instead of the next
+// value off of a shared generator. So it doesn't matter which thread gets to a sample
+// first, or how many there are. It's splitmix64's finalizer chained over the three,
+// plain integer math so it comes out the same on every machine and standard library
+inline uint64_t terrain_hash(uint64_t seed, uint64_t stream, uint64_t counter) {
+
+	auto mix = [](uint64_t z) {
+		z += 0x9E3779B97F4A7C15ull;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	};
+
+	return mix(mix(mix(seed) ^ stream) ^ counter);
+}
+
+// Uniform in [-1, 1), built from the top 53 bits so it's exact
+inline double terrain_random(uint64_t seed, uint64_t stream, uint64_t counter) {
+	return (terrain_hash(seed, stream, counter) >> 11) * (2.0 / 9007199254740992.0) - 1.0;
+}
+
 struct oct_state {
 
 	int parent_stack_position = 0;
@@ -65,12 +65,292 @@ int rand(int* seed) // 1 <= *seed < m
 
 
 
+// ====================================== Map addressing ===================================
+// =========================================================================================
+
+// The map can be a ring buffer of chunks (see ChunkManager). Rays work in window space,
+// map_offset.xyz is where window space (0, 0, 0) lives in the buffer. For Old_Map it's just 0.
+// map_offset.w is how the voxels are laid out, one of the MAP_LAYOUTS
+#define LINEAR_LAYOUT 0
+#define PALETTED_LAYOUT 1
+#define MORTON_LAYOUT 2
+
+int3 map_wrap(int3 voxel, global int3* map_dim, global int4* map_offset) {
+
+	int3 position = voxel + (*map_offset).xyz;
+	position -= select((int3)(0), *map_dim, position >= *map_dim);
+
+	return position;
+}
+
+// Every third bit, 10 bits in
+uint morton_spread(uint v) {
+
+	v &= 0x3FF;
+	v = (v | (v << 16)) & 0x030000FF;
+	v = (v | (v << 8)) & 0x0300F00F;
+	v = (v | (v << 4)) & 0x030C30C3;
+	v = (v | (v << 2)) & 0x09249249;
+
+	return v;
+}
+
+int map_index(int3 voxel, global int3* map_dim, global int4* map_offset) {
+
+	int3 position = map_wrap(voxel, map_dim, map_offset);
+
+	// Neighbouring rays and a ray's next few steps stay in the same cache lines
+	if ((*map_offset).w == MORTON_LAYOUT)
+		return morton_spread(position.x) | (morton_spread(position.y) << 1) | (morton_spread(position.z) << 2);
+
+	return position.x + (*map_dim).x * (position.y + (*map_dim).z * (position.z));
+}
+
+// Streamed chunks come up paletted (see PalettedVoxels). Each slot of the ring buffer has
+// PALETTE_SIZE bytes of palette, its index width in chunk_bits and room for CHUNK_DIM^3
+// 8 bit indices in chunk_words. A width of 0 is a chunk of palette[0] alone
+#define CHUNK_DIM 64
+#define PALETTE_SIZE 256
+#define CHUNK_WORDS (CHUNK_DIM * CHUNK_DIM * CHUNK_DIM / 4)
+
+char map_voxel(
+	int3 voxel,
+	global char* map,
+	global int3* map_dim,
+	global int4* map_offset,
+	global uint* chunk_words,
+	global uchar* chunk_palettes,
+	global int* chunk_bits
+){
+
+	if ((*map_offset).w != PALETTED_LAYOUT)
+		return map[map_index(voxel, map_dim, map_offset)];
+
+	int3 position = map_wrap(voxel, map_dim, map_offset);
+	int3 local = position & (CHUNK_DIM - 1);
+
+	int3 slot_position = position / CHUNK_DIM;
+	int slots = (*map_dim).x / CHUNK_DIM;
+	int slot = slot_position.x + slots * (slot_position.y + slots * slot_position.z);
+
+	int bits = chunk_bits[slot];
+	int entry = 0;
+
+	if (bits != 0) {
+
+		// Widths are powers of two, an index never straddles two words
+		int bit = (local.x + CHUNK_DIM * (local.y + CHUNK_DIM * local.z)) * bits;
+		uint word = chunk_words[slot * CHUNK_WORDS + bit / 32];
+
+		entry = (word >> (bit & 31)) & ((1u << bits) - 1);
+	}
+
+	return chunk_palettes[slot * PALETTE_SIZE + entry];
+}
+
+// occupancy is a bit per voxel, solid or not (see OccupancyGrid). A ulong per 4^3 block
+// in block order, bit x + 4 * (y + 4 * z) within the block
+#define OCCUPANCY_BLOCK 4
+
+bool map_solid(int3 voxel, global ulong* occupancy, global int3* map_dim, global int4* map_offset) {
+
+	int3 position = map_wrap(voxel, map_dim, map_offset);
+	int3 block = position / OCCUPANCY_BLOCK;
+	int3 bit = position & (OCCUPANCY_BLOCK - 1);
+
+	int3 block_dim = *map_dim / OCCUPANCY_BLOCK;
+
+	ulong word = occupancy[block.x + block_dim.x * (block.y + block_dim.y * block.z)];
+
+	return (word >> (bit.x + OCCUPANCY_BLOCK * (bit.y + OCCUPANCY_BLOCK * bit.z))) & 1;
+}
+
+
+// ================================ Distance field leaping =================================
+// =========================================================================================
+
+// distance_field holds one byte per DISTANCE_BLOCK^3 block of the map, the Chebyshev
+// distance in blocks to the nearest block with anything in it. 0 is a block that isn't empty
+#define DISTANCE_BLOCK 4
+
+// Take every Woo step that stays inside of the empty box [box_min, box_max] in one go.
+// Each axis gets the crossings it would have made before the first one that leaves the
+// box. The crossing t's are added up one at a time like the Woo loop does, a multiply
+// rounds differently and can land the ray a voxel off, so voxel and intersection_t end
+// up exactly where stepping a voxel at a time would have. It's still only adds, none of
+// the map reads. voxel_step is the Woo loop's, which comes out of vector compares and so
+// is -1 on the axes the ray is heading positive along
+void empty_box_leap(
+	int3 box_min,
+	int3 box_max,
+	int3* voxel,
+	float3* intersection_t,
+	float3 delta_t,
+	int3 voxel_step
+){
+
+	int v[3] = { (*voxel).x, (*voxel).y, (*voxel).z };
+	float it[3] = { (*intersection_t).x, (*intersection_t).y, (*intersection_t).z };
+	float dt[3] = { delta_t.x, delta_t.y, delta_t.z };
+	int st[3] = { -voxel_step.x, -voxel_step.y, -voxel_step.z };
+	int low[3] = { box_min.x, box_min.y, box_min.z };
+	int high[3] = { box_max.x, box_max.y, box_max.z };
+
+	int limit[3];
+	float exit_t = FLT_MAX;
+
+	for (int a = 0; a < 3; a++) {
+
+		if (st[a] == 0)
+			continue;
+
+		// Crossings until the last voxel of the box on the side the ray is heading, the
+		// one after that leaves it
+		int reach = st[a] > 0 ? high[a] : low[a];
+		limit[a] = abs(reach - v[a]);
+
+		float axis_exit = it[a];
+		for (int i = 0; i < limit[a]; i++)
+			axis_exit += dt[a];
+
+		exit_t = fmin(exit_t, axis_exit);
+	}
+
+	for (int a = 0; a < 3; a++) {
+
+		if (st[a] == 0)
+			continue;
+
+		for (int i = 0; i < limit[a] && it[a] < exit_t; i++) {
+			v[a] += st[a];
+			it[a] += dt[a];
+		}
+	}
+
+	*voxel = (int3)(v[0], v[1], v[2]);
+	*intersection_t = (float3)(it[0], it[1], it[2]);
+}
+
+// From an empty block, every voxel in the cube of blocks distance - 1 around it is empty
+void distance_leap(
+	global uchar* distance_field,
+	global int3* map_dim,
+	global int4* map_offset,
+	int3* voxel,
+	float3* intersection_t,
+	float3 delta_t,
+	int3 voxel_step
+){
+
+	int3 block_dim = (*map_dim + DISTANCE_BLOCK - 1) / DISTANCE_BLOCK;
+
+	// The ring offset is a whole number of chunks, so blocks line up the same in window space
+	int3 wrapped = map_wrap(*voxel, map_dim, map_offset) / DISTANCE_BLOCK;
+	int distance = distance_field[wrapped.x + block_dim.x * (wrapped.y + block_dim.y * wrapped.z)];
+
+	if (distance == 0)
+		return;
+
+	int3 block = *voxel / DISTANCE_BLOCK;
+	int3 box_min = (block - distance + 1) * DISTANCE_BLOCK;
+	int3 box_max = (block + distance) * DISTANCE_BLOCK - 1;
+
+	empty_box_leap(box_min, box_max, voxel, intersection_t, delta_t, voxel_step);
+}
+
+
+// ================================ Occupancy mip leaping ==================================
+// =========================================================================================
+
+// occupancy_mips is OccupancyPyramid's flags, a byte per cell that's set if anything in its
+// 2^level cube is solid. mip_settings is {levels, traversal, offset of level 1, 2, ...}
+// with the offsets in cells. traversal picks which leap the dense kernels use
+#define DISTANCE_FIELD_TRAVERSAL 0
+#define MIP_TRAVERSAL 1
+#define MIP_OFFSETS 1
+
+bool mip_occupied(global uchar* occupancy_mips, global int* mip_settings, global int3* map_dim, int level, int3 voxel) {
+
+	int3 cell = voxel >> level;
+	int3 level_dim = *map_dim >> level;
+
+	return occupancy_mips[mip_settings[MIP_OFFSETS + level] + cell.x + level_dim.x * (cell.y + level_dim.y * cell.z)] != 0;
+}
+
+// Hierarchical DDA as a leap. Starting from the level the last leap used, go down while
+// the cell around voxel has something in it and then up while the cell above is empty
+// too, and take the whole of the coarsest empty cell in one go. voxel itself is empty
+void mip_leap(
+	global uchar* occupancy_mips,
+	global int* mip_settings,
+	global int3* map_dim,
+	int* level,
+	int3* voxel,
+	float3* intersection_t,
+	float3 delta_t,
+	int3 voxel_step
+){
+
+	int levels = mip_settings[0];
+
+	if (levels == 0)
+		return;
+
+	int l = clamp(*level, 1, levels);
+
+	while (l >= 1 && mip_occupied(occupancy_mips, mip_settings, map_dim, l, *voxel))
+		l--;
+
+	// Not even its 2^3 cell is empty, back to voxel steps
+	if (l == 0) {
+		*level = 1;
+		return;
+	}
+
+	while (l < levels && !mip_occupied(occupancy_mips, mip_settings, map_dim, l + 1, *voxel))
+		l++;
+
+	*level = l;
+
+	int3 box_min = (*voxel >> l) << l;
+	int3 box_max = box_min + (1 << l) - 1;
+
+	empty_box_leap(box_min, box_max, voxel, intersection_t, delta_t, voxel_step);
+}
+
+// Whichever leap mip_settings asks for, called from an empty voxel
+void empty_space_leap(
+	global uchar* distance_field,
+	global uchar* occupancy_mips,
+	global int* mip_settings,
+	global int3* map_dim,
+	global int4* map_offset,
+	int* mip_level,
+	int3* voxel,
+	float3* intersection_t,
+	float3 delta_t,
+	int3 voxel_step
+){
+
+	if (mip_settings[1] == MIP_TRAVERSAL)
+		mip_leap(occupancy_mips, mip_settings, map_dim, mip_level, voxel, intersection_t, delta_t, voxel_step);
+	else
+		distance_leap(distance_field, map_dim, map_offset, voxel, intersection_t, delta_t, voxel_step);
+}
+
+
 // =================================== Boolean ray intersection ============================
 // =========================================================================================
 
+// Only ever asks whether something is in the way, so it reads the occupancy bits
+// instead of the map. An eighth of the memory traffic for the same answer
 bool cast_light_intersection_ray(
-	global char* map,
+	global ulong* occupancy,
 	global int3* map_dim,
+	global uchar* distance_field,
+	global int4* map_offset,
+	global uchar* occupancy_mips,
+	global int* mip_settings,
 	 float3 ray_dir,
 	 float3 ray_pos,
 	global float* lights,
@@ -107,6 +387,7 @@ bool cast_light_intersection_ray(
 	int3 face_mask = { 0, 0, 0 };
 
 	int length_cutoff = 0;
+	int mip_level = 1;
 
 	// Andrew Woo's raycasting algo
 	do {
@@ -122,14 +403,14 @@ bool cast_light_intersection_ray(
 		}
 
 		// If we hit a voxel
-		int voxel_data = map[voxel.x + (*map_dim).x * (voxel.y + (*map_dim).z * (voxel.z))];
-
-		if (voxel_data != 0)
+		if (map_solid(voxel, occupancy, map_dim, map_offset))
 			return true;
 
 		if (++length_cutoff > 300)
 			return false;
 
+		empty_space_leap(distance_field, occupancy_mips, mip_settings, map_dim, map_offset, &mip_level, &voxel, &intersection_t, delta_t, voxel_step);
+
 	//} while (any(isless(intersection_t, (float3)(distance_to_light - 1))));
 	} while (intersection_t.x < distance_to_light - 1 ||
 		     intersection_t.y < distance_to_light - 1 ||
@@ -139,13 +420,486 @@ bool cast_light_intersection_ray(
 }
 
 
-// ====================================== Raycaster entry point =====================================
-// ==================================================================================================
+// ================================== Sparse voxel octree traversal ===========================
+// =========================================================================================
+
+// The octree pool gets flattened into one buffer on upload so a global index is just an
+// offset into octree_descriptors. octree_settings holds {root index, page shift, dimension}
+
+// Deepest the stacks go, a 2^24 volume. Keep it small, it's private memory per ray
+#define OCT_STACK_DEPTH 24
+
+// Cap on the nodes a single ray can visit before we give up on it
+#define OCT_MAX_STEPS 2048
+
+// Child pointers are relative to the start of the page the descriptor is on. If the
+// far bit is set the pointer lands on a far slot holding the real global index instead
+uint octree_child_index(global ulong* descriptors, ulong descriptor, uint descriptor_index, uint page_mask) {
+
+	uint index = (descriptor_index & ~page_mask) + (uint)(descriptor & 0x7FFF);
+
+	if (descriptor & 0x8000)
+		index = (uint)descriptors[index];
+
+	return index;
+}
+
+// Only the valid non-leaf children are stored, count how many come before idx
+int octree_child_offset(ulong descriptor, int idx) {
+	return popcount((uint)((descriptor >> 16) & ~(descriptor >> 24) & ((1 << idx) - 1)));
+}
+
+// t of the min and max planes of a node on each axis
+void octree_planes(const int* position, int size, const float* o, const float* inv, float* t0, float* t1) {
+
+	for (int a = 0; a < 3; a++) {
+		t0[a] = (position[a] - o[a]) * inv[a];
+		t1[a] = (position[a] + size - o[a]) * inv[a];
+	}
+}
+
+// The child of the node at position that the ray is in at time t
+int octree_first_child(const int* position, int size, const float* o, const float* inv, float t) {
+
+	int idx = 0;
+	int half = size / 2;
+
+	for (int a = 0; a < 3; a++) {
+		if (t >= (position[a] + half - o[a]) * inv[a])
+			idx |= 1 << a;
+	}
+
+	return idx;
+}
+
+// Same traversal as Octree::cast_ray on the CPU. The ray is mirrored so it travels
+// positive on every axis, then we push into valid octs, advance across siblings and
+// pop back up, skipping empty octs at whatever scale they're stored at.
+// Returns true on a hit before max_t and fills in where
+bool cast_octree_ray(
+	global ulong* descriptors,
+	global uint* settings,
+	float3 ray_pos,
+	float3 ray_dir,
+	float max_t,
+	float* hit_t,
+	int3* hit_voxel,
+	int3* face_mask,
+	int* steps
+){
+
+	uint page_mask = (1u << settings[1]) - 1;
+	int dimension = (int)settings[2];
+
+	float o[3] = { ray_pos.x, ray_pos.y, ray_pos.z };
+	float d[3] = { ray_dir.x, ray_dir.y, ray_dir.z };
+	float inv[3];
+	int octant_mask = 0;
+
+	for (int a = 0; a < 3; a++) {
+
+		if (d[a] < 0.0f) {
+			o[a] = dimension - o[a];
+			d[a] = -d[a];
+			octant_mask |= 1 << a;
+		}
+
+		// Axis aligned rays never cross the planes of that axis
+		inv[a] = d[a] > 1e-7f ? 1.0f / d[a] : 1e30f;
+	}
+
+	float t0[3], t1[3];
+	int node_position[3] = { 0, 0, 0 };
+	int size = dimension;
+
+	// Clip the ray against the root
+	octree_planes(node_position, size, o, inv, t0, t1);
+	float t_enter = fmax(fmax(t0[0], t0[1]), fmax(t0[2], 0.0f));
+	float t_exit = fmin(fmin(t1[0], t1[1]), t1[2]);
+
+	*steps = 0;
+
+	if (t_enter >= t_exit || t_enter > max_t)
+		return false;
+
+	uint parent_stack[OCT_STACK_DEPTH];
+	uchar idx_stack[OCT_STACK_DEPTH];
+	int scale = 0;
+
+	uint node_index = settings[0];
+	ulong descriptor = descriptors[node_index];
+	int idx = octree_first_child(node_position, size, o, inv, t_enter);
+
+	while (++(*steps) < OCT_MAX_STEPS) {
+
+		int half = size / 2;
+		int child_position[3] = {
+			node_position[0] + ((idx & 1) ? half : 0),
+			node_position[1] + ((idx & 2) ? half : 0),
+			node_position[2] + ((idx & 4) ? half : 0)
+		};
+
+		octree_planes(child_position, half, o, inv, t0, t1);
+		float child_enter = fmax(fmax(t0[0], t0[1]), fmax(t0[2], 0.0f));
+		float child_exit = fmin(fmin(t1[0], t1[1]), t1[2]);
+
+		if (child_enter > max_t)
+			return false;
+
+		int real_idx = idx ^ octant_mask;
+		bool valid = (descriptor >> (16 + real_idx)) & 1;
+		bool leaf = (descriptor >> (24 + real_idx)) & 1;
+
+		// Rays that clip an edge can get a child with an empty interval, step over it
+		if (valid && child_enter <= child_exit) {
+
+			if (leaf) {
+
+				*hit_t = child_enter;
+
+				// Face we came in through is the axis whose plane we crossed last
+				int axis = 0;
+				if (t0[1] > t0[axis]) axis = 1;
+				if (t0[2] > t0[axis]) axis = 2;
+
+				(*face_mask).x = axis == 0 ? -1 : 0;
+				(*face_mask).y = axis == 1 ? -1 : 0;
+				(*face_mask).z = axis == 2 ? -1 : 0;
+
+				// Un-mirror the leaf's bounds and find the voxel in it that the ray entered
+				float hit_point[3] = {
+					ray_pos.x + ray_dir.x * child_enter,
+					ray_pos.y + ray_dir.y * child_enter,
+					ray_pos.z + ray_dir.z * child_enter
+				};
+
+				int voxel[3];
+				for (int a = 0; a < 3; a++) {
+
+					int low = (octant_mask & (1 << a)) ? dimension - (child_position[a] + half) : child_position[a];
+					voxel[a] = min(max((int)floor(hit_point[a]), low), low + half - 1);
+				}
+
+				(*hit_voxel).x = voxel[0];
+				(*hit_voxel).y = voxel[1];
+				(*hit_voxel).z = voxel[2];
+
+				return true;
+			}
+
+			// PUSH
+			parent_stack[scale] = node_index;
+			idx_stack[scale] = (uchar)idx;
+			scale++;
+
+			node_index = octree_child_index(descriptors, descriptor, node_index, page_mask) + octree_child_offset(descriptor, real_idx);
+			descriptor = descriptors[node_index];
+
+			node_position[0] = child_position[0];
+			node_position[1] = child_position[1];
+			node_position[2] = child_position[2];
+			size = half;
+
+			idx = octree_first_child(node_position, size, o, inv, child_enter);
+			continue;
+		}
+
+		// ADVANCE across the plane we exit through first, POP while that takes us out of the parent
+		while (true) {
+
+			int axis = 0;
+			if (t1[1] < t1[axis]) axis = 1;
+			if (t1[2] < t1[axis]) axis = 2;
+
+			if (!(idx & (1 << axis))) {
+				idx |= 1 << axis;
+				break;
+			}
+
+			// Left the root
+			if (scale == 0)
+				return false;
+
+			scale--;
+			idx = idx_stack[scale];
+			node_index = parent_stack[scale];
+			descriptor = descriptors[node_index];
+
+			node_position[0] -= (idx & 1) ? size : 0;
+			node_position[1] -= (idx & 2) ? size : 0;
+			node_position[2] -= (idx & 4) ? size : 0;
+			size *= 2;
+
+			int popped_position[3] = {
+				node_position[0] + ((idx & 1) ? size / 2 : 0),
+				node_position[1] + ((idx & 2) ? size / 2 : 0),
+				node_position[2] + ((idx & 4) ? size / 2 : 0)
+			};
+
+			octree_planes(popped_position, size / 2, o, inv, t0, t1);
+		}
+	}
+
+	return false;
+}
+
+
+// ===================================== Brickmap traversal ===================================
+// =========================================================================================
+
+// brickmap_grid has one entry per 8^3 cell. 0 is empty, BRICK_SOLID | material is a
+// uniformly solid cell, anything else is 1 + the index of the cell's brick in
+// brickmap_bricks. brickmap_settings holds the grid dimensions
+
+#define BRICK_DIM 8
+#define BRICK_VOXELS 512
+#define BRICK_SOLID 0x80000000u
+
+// Cap on the cells plus voxels a single ray can visit
+#define BRICK_MAX_STEPS 4096
+
+// The axis whose boundary the ray crosses next
+int brick_next_axis(const float* next) {
+	if (next[0] < next[1])
+		return next[0] < next[2] ? 0 : 2;
+	return next[1] < next[2] ? 1 : 2;
+}
+
+// Two level DDA. The outer one walks the cells of the grid, skipping an empty cell in a
+// single step. When it lands on a cell with a brick, the inner one walks the brick's voxels
+// until it hits something or walks out the side the outer one continues from.
+// Both levels compute their boundary t's from the same plane so they always agree on where
+// the ray leaves a brick. Returns true on a hit before max_t and fills in where and what
+bool cast_brickmap_ray(
+	global uint* grid,
+	global char* bricks,
+	global uint* settings,
+	float3 ray_pos,
+	float3 ray_dir,
+	float max_t,
+	float* hit_t,
+	int3* hit_voxel,
+	int3* face_mask,
+	int* voxel_data,
+	int* steps
+){
+
+	int grid_dim[3] = { (int)settings[0], (int)settings[1], (int)settings[2] };
+
+	float o[3] = { ray_pos.x, ray_pos.y, ray_pos.z };
+	float d[3] = { ray_dir.x, ray_dir.y, ray_dir.z };
+	float inv[3];
+	int step[3];
+
+	*steps = 0;
+
+	// Clip the ray against the map, rays starting outside of it jump straight to the edge
+	float t = 0.0f;
+	float t_exit = FLT_MAX;
+	int face = -1;
+
+	for (int a = 0; a < 3; a++) {
+
+		step[a] = (d[a] > 0) - (d[a] < 0);
+		inv[a] = step[a] != 0 ? 1.0f / d[a] : FLT_MAX;
+
+		int size = grid_dim[a] * BRICK_DIM;
+
+		if (step[a] == 0) {
+			if (o[a] < 0 || o[a] >= size)
+				return false;
+			continue;
+		}
+
+		float t_near = ((step[a] > 0 ? 0 : size) - o[a]) * inv[a];
+		float t_far = ((step[a] > 0 ? size : 0) - o[a]) * inv[a];
+
+		if (t_near > t) {
+			t = t_near;
+			face = a;
+		}
+		t_exit = fmin(t_exit, t_far);
+	}
+
+	if (t >= t_exit || t > max_t)
+		return false;
+
+	// The cell we start in, clamped since the entry point can land right on the far edge
+	int cell[3];
+	float cell_next[3];
+
+	for (int a = 0; a < 3; a++) {
+		cell[a] = clamp((int)floor((o[a] + d[a] * t) / BRICK_DIM), 0, grid_dim[a] - 1);
+		cell_next[a] = step[a] != 0 ? ((cell[a] + (step[a] > 0)) * BRICK_DIM - o[a]) * inv[a] : FLT_MAX;
+	}
+
+	while (*steps < BRICK_MAX_STEPS) {
+
+		(*steps)++;
+
+		uint entry = grid[cell[0] + grid_dim[0] * (cell[1] + grid_dim[1] * cell[2])];
+
+		if (entry != 0) {
+
+			int voxel[3];
+			for (int a = 0; a < 3; a++)
+				voxel[a] = clamp((int)floor(o[a] + d[a] * t), cell[a] * BRICK_DIM, cell[a] * BRICK_DIM + BRICK_DIM - 1);
+
+			if (entry & BRICK_SOLID) {
+				*hit_t = t;
+				*hit_voxel = (int3)(voxel[0], voxel[1], voxel[2]);
+				*face_mask = (int3)(face == 0, face == 1, face == 2) * -1;
+				*voxel_data = (int)(entry & 0xFF);
+				return true;
+			}
+
+			global char* brick = bricks + (entry - 1) * BRICK_VOXELS;
+
+			float voxel_next[3];
+			for (int a = 0; a < 3; a++)
+				voxel_next[a] = step[a] != 0 ? ((voxel[a] + (step[a] > 0)) - o[a]) * inv[a] : FLT_MAX;
+
+			float voxel_t = t;
+			int voxel_face = face;
+
+			while (*steps < BRICK_MAX_STEPS) {
+
+				(*steps)++;
+
+				char value = brick[
+					(voxel[0] - cell[0] * BRICK_DIM) + BRICK_DIM * (
+					(voxel[1] - cell[1] * BRICK_DIM) + BRICK_DIM *
+					(voxel[2] - cell[2] * BRICK_DIM))
+				];
+
+				if (value != 0) {
+					*hit_t = voxel_t;
+					*hit_voxel = (int3)(voxel[0], voxel[1], voxel[2]);
+					*face_mask = (int3)(voxel_face == 0, voxel_face == 1, voxel_face == 2) * -1;
+					*voxel_data = value;
+					return true;
+				}
+
+				int axis = brick_next_axis(voxel_next);
+				voxel_t = voxel_next[axis];
+				voxel[axis] += step[axis];
+
+				if (voxel_t > max_t)
+					return false;
+
+				// Walked out of the brick, the outer DDA takes it from here
+				if (voxel[axis] < cell[axis] * BRICK_DIM || voxel[axis] >= cell[axis] * BRICK_DIM + BRICK_DIM)
+					break;
+
+				voxel_next[axis] = ((voxel[axis] + (step[axis] > 0)) - o[axis]) * inv[axis];
+				voxel_face = axis;
+			}
+		}
+
+		// Step across to the next cell, the whole brick in one go
+		int axis = brick_next_axis(cell_next);
+		t = cell_next[axis];
+		cell[axis] += step[axis];
+		face = axis;
+
+		if (cell[axis] < 0 || cell[axis] >= grid_dim[axis] || t > max_t)
+			return false;
+
+		cell_next[axis] = ((cell[axis] + (step[axis] > 0)) * BRICK_DIM - o[axis]) * inv[axis];
+	}
+
+	return false;
+}
+
+
+// ====================================== Shared shading ===========================================
+// =================================================================================================
 
 constant float4 fog_color = { 0.73f, 0.81f, 0.89f, 0.8f };
 constant float4 overshoot_color = { 0.25f, 0.48f, 0.52f, 0.8f };
 constant float4 overshoot_color_2 = { 0.25f, 0.1f, 0.52f, 0.8f };
 
+// Get the pixel's ray from the view matrix and swing it around to where the camera is pointing
+float3 get_ray_direction(int2 pixel, global int2* resolution, global float3* projection_matrix, global float2* cam_dir) {
+
+	float3 ray_dir = projection_matrix[pixel.x + (*resolution).x * pixel.y];
+
+	// Pitch
+	ray_dir = (float3)(
+		ray_dir.z * sin((*cam_dir).x) + ray_dir.x * cos((*cam_dir).x),
+		ray_dir.y,
+		ray_dir.z * cos((*cam_dir).x) - ray_dir.x * sin((*cam_dir).x)
+		);
+
+	// Yaw
+	ray_dir = (float3)(
+		ray_dir.x * cos((*cam_dir).y) - ray_dir.y * sin((*cam_dir).y),
+		ray_dir.x * sin((*cam_dir).y) + ray_dir.y * cos((*cam_dir).y),
+		ray_dir.z
+		);
+
+	return ray_dir;
+}
+
+// Either use the face position to retrieve a texture sample, or just a plain color for the voxel color
+float4 get_voxel_color(
+	int voxel_data,
+	float2 tile_face_position,
+	__read_only image2d_t texture_atlas,
+	global int2 *atlas_dim,
+	global int2 *tile_dim
+){
+
+	float4 voxel_color = (float4)(0.0f, 0.0f, 0.0f, 0.001f);
+
+	voxel_color = select((float4)voxel_color,
+						 (float4)(0.0f, 0.239f, 0.419f, 0.0f),
+						 (int4)(voxel_data == 6));
+
+	voxel_color = select((float4)read_imagef(
+							 texture_atlas,
+							 convert_int2(tile_face_position * convert_float2(*atlas_dim / *tile_dim)) +
+							 convert_int2((float2)(0, 0) * convert_float2(*atlas_dim / *tile_dim))
+						 ),
+						 (float4)(0.0f, 0.239f, 0.419f, 0.0f),
+						 (int4)(voxel_data == 5));
+
+	voxel_color.w = 0.0f;
+
+	return voxel_color;
+}
+
+// Light the voxel at hit_position, shadowed is whether the ray to the light was blocked
+float4 light_voxel(
+	float4 voxel_color,
+	bool shadowed,
+	float3 hit_position,
+	global float* lights,
+	global float3* cam_pos,
+	int3 face_mask,
+	int3 voxel_step
+){
+
+	// If the light ray intersected an object on the way to the light point
+	if (shadowed)
+		return white_light(voxel_color, (float3)(1.0f, 1.0f, 1.0f), face_mask);
+
+	//  0  1  2  3  4  5  6  7   8   9
+	// {r, g, b, i, x, y, z, x', y', z'}
+
+	return view_light(
+		voxel_color,
+		hit_position - (float3)(lights[4], lights[5], lights[6]),
+		(float4)(lights[0], lights[1], lights[2], lights[3]),
+		hit_position - (*cam_pos),
+		face_mask * voxel_step
+	);
+}
+
+
+// ====================================== Raycaster entry point =====================================
+// ==================================================================================================
+
 __kernel void raycaster(
 	global char* map,
 	global int3* map_dim,
@@ -159,7 +913,15 @@ __kernel void raycaster(
 	global int* seed_memory,
 	__read_only image2d_t texture_atlas,
 	global int2 *atlas_dim,
-	global int2 *tile_dim
+	global int2 *tile_dim,
+	global uchar* distance_field,
+	global int4* map_offset,
+	global ulong* occupancy,
+	global uint* chunk_words,
+	global uchar* chunk_palettes,
+	global int* chunk_bits,
+	global uchar* occupancy_mips,
+	global int* mip_settings
 ){
 
 
@@ -175,27 +937,13 @@ __kernel void raycaster(
 	//int2 pixel = { global_id % (*resolution).x, global_id / (*resolution).x };
 	int2 pixel = (int2)(get_global_id(0), get_global_id(1));
 
-    float3 ray_dir = projection_matrix[pixel.x + (*resolution).x * pixel.y];
+    float3 ray_dir = get_ray_direction(pixel, resolution, projection_matrix, cam_dir);
 
 	//if (pixel.x == 960 && pixel.y == 540) {
 	//	write_imagef(image, pixel, (float4)(0.00, 1.00, 0.00, 1.00));
 	//	return;
 	//}
 
-	// Pitch
-	ray_dir = (float3)(
-		ray_dir.z * sin((*cam_dir).x) + ray_dir.x * cos((*cam_dir).x),
-		ray_dir.y,
-		ray_dir.z * cos((*cam_dir).x) - ray_dir.x * sin((*cam_dir).x)
-		);
-
-	// Yaw
-    ray_dir = (float3)(
-            ray_dir.x * cos((*cam_dir).y) - ray_dir.y * sin((*cam_dir).y),
-            ray_dir.x * sin((*cam_dir).y) + ray_dir.y * cos((*cam_dir).y),
-            ray_dir.z
-    );
-
 
 	// Setup the voxel step based on what direction the ray is pointing
     int3 voxel_step = {1, 1, 1};
@@ -221,6 +969,7 @@ __kernel void raycaster(
 	int dist = 0;
 	int3 face_mask = { 0, 0, 0 };
 	int voxel_data = 0;
+	int mip_level = 1;
 	// Andrew Woo's raycasting algo
     do {
 
@@ -239,7 +988,7 @@ __kernel void raycaster(
 		}
 
         // If we hit a voxel
-        voxel_data = map[voxel.x + (*map_dim).x * (voxel.y + (*map_dim).z * (voxel.z))];
+        voxel_data = map_voxel(voxel, map, map_dim, map_offset, chunk_words, chunk_palettes, chunk_bits);
 
 		// Debug, add the light position
 		// if (all(voxel == convert_int3((float3)(lights[4], lights[5], lights[6]-3))))
@@ -247,8 +996,6 @@ __kernel void raycaster(
 
 		if (voxel_data != 0) {
 
-			float4 voxel_color = (float4)(0.0f, 0.0f, 0.0f, 0.001f);
-
 			// Determine where on the 2d plane the ray intersected
 			float3 face_position = (float3)(0);
 			float2 tile_face_position = (float2)(0);
@@ -332,59 +1079,205 @@ __kernel void raycaster(
 			// 	continue;
 			// }
 
-			// Now either use the face position to retrieve a texture sample, or
-			// just a plain color for the voxel color
-			voxel_color = select((float4)voxel_color,
-								 (float4)(0.0f, 0.239f, 0.419f, 0.0f),
-								 (int4)(voxel_data == 6));
-
-			voxel_color = select((float4)read_imagef(
-									 texture_atlas,
-									 convert_int2(tile_face_position * convert_float2(*atlas_dim / *tile_dim)) +
-									 convert_int2((float2)(0, 0) * convert_float2(*atlas_dim / *tile_dim))
-								 ),
-								 (float4)(0.0f, 0.239f, 0.419f, 0.0f),
-								 (int4)(voxel_data == 5));
-
-		 	voxel_color.w = 0.0f;
+			float4 voxel_color = get_voxel_color(voxel_data, tile_face_position, texture_atlas, atlas_dim, tile_dim);
 
-			if (cast_light_intersection_ray(
-				map,
+			bool shadowed = cast_light_intersection_ray(
+				occupancy,
 				map_dim,
+				distance_field,
+				map_offset,
+				occupancy_mips,
+				mip_settings,
 				normalize((float3)(lights[4], lights[5], lights[6]) - (convert_float3(voxel) + face_position)),
 				(convert_float3(voxel) + face_position),
 				lights,
 				light_count
-			)) {
-
-				// If the light ray intersected an object on the way to the light point
-				write_imagef(image, pixel, white_light(voxel_color, (float3)(1.0f, 1.0f, 1.0f), face_mask));
-				return;
-			}
-
-			//  0  1  2  3  4  5  6  7   8   9
-			// {r, g, b, i, x, y, z, x', y', z'}
+			);
 
 			write_imagef(
 				image,
 				pixel,
-				view_light(
-					voxel_color,
-					(convert_float3(voxel) + face_position) - (float3)(lights[4], lights[5], lights[6]),
-					(float4)(lights[0], lights[1], lights[2], lights[3]),
-					(convert_float3(voxel) + face_position) - (*cam_pos),
-					face_mask * voxel_step
-					)
-				);
+				light_voxel(voxel_color, shadowed, convert_float3(voxel) + face_position, lights, cam_pos, face_mask, voxel_step)
+			);
 
 			return;
 
 
 		}
 
+		// Skip over the empty blocks ahead, the whole leap counts as one step
+		empty_space_leap(distance_field, occupancy_mips, mip_settings, map_dim, map_offset, &mip_level, &voxel, &intersection_t, delta_t, voxel_step);
+
     } while (++dist < 700.0f);
 
 
 	write_imagef(image, pixel, white_light(mix(fog_color, (float4)(0.40, 0.00, 0.40, 0.2), 1.0 - max(dist / 700.0f, (float)0)), (float3)(lights[7], lights[8], lights[9]), face_mask));
     return;
 }
+
+
+
+// ================================== Octree raycaster entry point ==================================
+// ==================================================================================================
+
+// Same arguments as the dense raycaster from 2 to 12, only the map buffers are swapped out
+// for the octree so the caster can switch between them without re-setting the rest
+__kernel void raycaster_octree(
+	global ulong* octree_descriptors,
+	global uint* octree_settings,
+	global int2* resolution,
+	global float3* projection_matrix,
+	global float2* cam_dir,
+	global float3* cam_pos,
+	global float* lights,
+	global int* light_count,
+	__write_only image2d_t image,
+	global int* seed_memory,
+	__read_only image2d_t texture_atlas,
+	global int2 *atlas_dim,
+	global int2 *tile_dim
+){
+
+	int2 pixel = (int2)(get_global_id(0), get_global_id(1));
+
+	float3 ray_dir = get_ray_direction(pixel, resolution, projection_matrix, cam_dir);
+
+	float hit_t = 0;
+	int3 voxel = { 0, 0, 0 };
+	int3 face_mask = { 0, 0, 0 };
+	int steps = 0;
+
+	if (!cast_octree_ray(octree_descriptors, octree_settings, *cam_pos, ray_dir, FLT_MAX, &hit_t, &voxel, &face_mask, &steps)) {
+
+		// Missed everything, fade the fog out the more of the octree we had to walk through
+		write_imagef(image, pixel, white_light(mix(fog_color, overshoot_color, 1.0 - max(steps / (float)OCT_MAX_STEPS, (float)0)), (float3)(lights[7], lights[8], lights[9]), face_mask));
+		return;
+	}
+
+	int3 voxel_step = { 1, 1, 1 };
+	voxel_step *= (ray_dir > 0) - (ray_dir < 0);
+
+	// Where on the voxel we hit, pushed just outside of the face we came through so the
+	// shadow ray doesn't start inside of the voxel
+	float3 face_position = clamp((*cam_pos) + ray_dir * hit_t - convert_float3(voxel), 0.0f, 1.0f);
+	float2 tile_face_position = (float2)(0);
+
+	if (face_mask.x == -1) {
+		face_position.x = ray_dir.x > 0 ? -0.0001f : 1.0001f;
+		tile_face_position = face_position.yz;
+	}
+	else if (face_mask.y == -1) {
+		face_position.y = ray_dir.y > 0 ? -0.0001f : 1.0001f;
+		tile_face_position = face_position.xz;
+	}
+	else {
+		face_position.z = ray_dir.z > 0 ? -0.0001f : 1.0001f;
+		tile_face_position = face_position.xy;
+	}
+
+	// The octree only knows solid or not, so everything gets the textured material
+	float4 voxel_color = get_voxel_color(1, tile_face_position, texture_atlas, atlas_dim, tile_dim);
+
+	float3 hit_position = convert_float3(voxel) + face_position;
+	float3 light_position = (float3)(lights[4], lights[5], lights[6]);
+
+	float shadow_t = 0;
+	int3 shadow_voxel = { 0, 0, 0 };
+	int3 shadow_face = { 0, 0, 0 };
+	int shadow_steps = 0;
+
+	bool shadowed = cast_octree_ray(
+		octree_descriptors,
+		octree_settings,
+		hit_position,
+		normalize(light_position - hit_position),
+		DistanceBetweenPoints(hit_position, light_position) - 1,
+		&shadow_t, &shadow_voxel, &shadow_face, &shadow_steps
+	);
+
+	write_imagef(image, pixel, light_voxel(voxel_color, shadowed, hit_position, lights, cam_pos, face_mask, voxel_step));
+}
+
+
+
+// ================================= Brickmap raycaster entry point =================================
+// ==================================================================================================
+
+// Same arguments as the dense raycaster from 2 to 12, the grid and bricks take the place of
+// the map buffers and the grid dimensions are tacked on the end at 13
+__kernel void raycaster_brickmap(
+	global uint* brickmap_grid,
+	global char* brickmap_bricks,
+	global int2* resolution,
+	global float3* projection_matrix,
+	global float2* cam_dir,
+	global float3* cam_pos,
+	global float* lights,
+	global int* light_count,
+	__write_only image2d_t image,
+	global int* seed_memory,
+	__read_only image2d_t texture_atlas,
+	global int2 *atlas_dim,
+	global int2 *tile_dim,
+	global uint* brickmap_settings
+){
+
+	int2 pixel = (int2)(get_global_id(0), get_global_id(1));
+
+	float3 ray_dir = get_ray_direction(pixel, resolution, projection_matrix, cam_dir);
+
+	float hit_t = 0;
+	int3 voxel = { 0, 0, 0 };
+	int3 face_mask = { 0, 0, 0 };
+	int voxel_data = 0;
+	int steps = 0;
+
+	if (!cast_brickmap_ray(brickmap_grid, brickmap_bricks, brickmap_settings, *cam_pos, ray_dir, FLT_MAX, &hit_t, &voxel, &face_mask, &voxel_data, &steps)) {
+		write_imagef(image, pixel, white_light(mix(fog_color, overshoot_color, 1.0 - max(steps / (float)BRICK_MAX_STEPS, (float)0)), (float3)(lights[7], lights[8], lights[9]), face_mask));
+		return;
+	}
+
+	int3 voxel_step = { 1, 1, 1 };
+	voxel_step *= (ray_dir > 0) - (ray_dir < 0);
+
+	// Same as the octree, push the hit just outside of the face for the shadow ray
+	float3 face_position = clamp((*cam_pos) + ray_dir * hit_t - convert_float3(voxel), 0.0f, 1.0f);
+	float2 tile_face_position = (float2)(0);
+
+	if (face_mask.x == -1) {
+		face_position.x = ray_dir.x > 0 ? -0.0001f : 1.0001f;
+		tile_face_position = face_position.yz;
+	}
+	else if (face_mask.y == -1) {
+		face_position.y = ray_dir.y > 0 ? -0.0001f : 1.0001f;
+		tile_face_position = face_position.xz;
+	}
+	else {
+		face_position.z = ray_dir.z > 0 ? -0.0001f : 1.0001f;
+		tile_face_position = face_position.xy;
+	}
+
+	// Unlike the octree the bricks keep the material, so we get the dense kernel's colors
+	float4 voxel_color = get_voxel_color(voxel_data, tile_face_position, texture_atlas, atlas_dim, tile_dim);
+
+	float3 hit_position = convert_float3(voxel) + face_position;
+	float3 light_position = (float3)(lights[4], lights[5], lights[6]);
+
+	float shadow_t = 0;
+	int3 shadow_voxel = { 0, 0, 0 };
+	int3 shadow_face = { 0, 0, 0 };
+	int shadow_data = 0;
+	int shadow_steps = 0;
+
+	bool shadowed = cast_brickmap_ray(
+		brickmap_grid,
+		brickmap_bricks,
+		brickmap_settings,
+		hit_position,
+		normalize(light_position - hit_position),
+		DistanceBetweenPoints(hit_position, light_position) - 1,
+		&shadow_t, &shadow_voxel, &shadow_face, &shadow_data, &shadow_steps
+	);
+
+	write_imagef(image, pixel, light_voxel(voxel_color, shadowed, hit_position, lights, cam_pos, face_mask, voxel_step));
+}
@@ -0,0 +1,171 @@
+#include "ThreadPool.h"
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+
+ThreadPool::ThreadPool(unsigned int thread_count) {
+
+	if (thread_count == 0)
+		thread_count = std::thread::hardware_concurrency();
+
+	// hardware_concurrency is allowed to return 0 when it can't tell
+	if (thread_count == 0)
+		thread_count = 1;
+
+	for (unsigned int i = 0; i < thread_count; i++)
+		workers.emplace_back(&ThreadPool::worker_loop, this);
+}
+
+ThreadPool::~ThreadPool() {
+
+	{
+		std::unique_lock<std::mutex> lock(queue_mutex);
+		stopping = true;
+	}
+
+	queue_condition.notify_all();
+
+	for (auto &worker : workers)
+		worker.join();
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+
+	{
+		std::unique_lock<std::mutex> lock(queue_mutex);
+		tasks.push(std::move(task));
+	}
+
+	queue_condition.notify_one();
+}
+
+void ThreadPool::parallel_for(int count, std::function<void(int)> function) {
+
+	if (count <= 0)
+		return;
+
+	// Every worker starts on its own contiguous run of indices, so neighbouring
+	// indices (rows, tiles) stay on one thread. One that runs out steals the back
+	// half of whichever run has the most left, which balances out uneven work
+	// without all of them fighting over one counter
+	struct StealRange {
+		std::mutex mutex;
+		int next = 0;
+		int end = 0;
+	};
+
+	int worker_tasks = static_cast<int>(std::min<size_t>(workers.size(), count));
+	int remaining_workers = worker_tasks;
+
+	std::vector<StealRange> ranges(worker_tasks);
+
+	for (int i = 0; i < worker_tasks; i++) {
+		ranges[i].next = static_cast<int>(static_cast<int64_t>(count) * i / worker_tasks);
+		ranges[i].end = static_cast<int>(static_cast<int64_t>(count) * (i + 1) / worker_tasks);
+	}
+
+	// Move half of the fullest other run over to thief, false once they're all empty
+	auto steal = [&](int thief) {
+
+		while (true) {
+
+			int victim = -1;
+			int most = 0;
+
+			for (int i = 0; i < worker_tasks; i++) {
+
+				if (i == thief)
+					continue;
+
+				std::unique_lock<std::mutex> lock(ranges[i].mutex);
+				if (ranges[i].end - ranges[i].next > most) {
+					most = ranges[i].end - ranges[i].next;
+					victim = i;
+				}
+			}
+
+			if (victim < 0)
+				return false;
+
+			int first, last;
+
+			{
+				std::unique_lock<std::mutex> lock(ranges[victim].mutex);
+
+				// Someone else got to it first, look again
+				int left = ranges[victim].end - ranges[victim].next;
+				if (left <= 0)
+					continue;
+
+				last = ranges[victim].end;
+				first = last - (left + 1) / 2;
+				ranges[victim].end = first;
+			}
+
+			std::unique_lock<std::mutex> lock(ranges[thief].mutex);
+			ranges[thief].next = first;
+			ranges[thief].end = last;
+
+			return true;
+		}
+	};
+
+	std::mutex done_mutex;
+	std::condition_variable done_condition;
+
+	for (int i = 0; i < worker_tasks; i++) {
+
+		enqueue([&, i]() {
+
+			while (true) {
+
+				int index = -1;
+
+				{
+					std::unique_lock<std::mutex> lock(ranges[i].mutex);
+					if (ranges[i].next < ranges[i].end)
+						index = ranges[i].next++;
+				}
+
+				if (index >= 0)
+					function(index);
+				else if (!steal(i))
+					break;
+			}
+
+			std::unique_lock<std::mutex> lock(done_mutex);
+			if (--remaining_workers == 0)
+				done_condition.notify_one();
+		});
+	}
+
+	std::unique_lock<std::mutex> lock(done_mutex);
+	done_condition.wait(lock, [&]() { return remaining_workers == 0; });
+}
+
+size_t ThreadPool::get_queue_depth() {
+	std::unique_lock<std::mutex> lock(queue_mutex);
+	return tasks.size();
+}
+
+void ThreadPool::worker_loop() {
+
+	while (true) {
+
+		std::function<void()> task;
+
+		{
+			std::unique_lock<std::mutex> lock(queue_mutex);
+			queue_condition.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+			// Drain whatever is left on the queue before shutting down
+			if (stopping && tasks.empty())
+				return;
+
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+
+		task();
+	}
+}
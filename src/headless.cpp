@@ -0,0 +1,385 @@
+// Renders a camera path through a map on the CPU caster without a window, a GL context
+// or anything on stdin, writing out the frames and how long each took. For benchmarking
+// and checking renders on machines without a display
+//
+//	Headless [--map terrain | file.vox | file.raw] [--raw-size x y z] [--size x y z]
+//		[--seed n] [--layout linear | morton] [--camera path.txt] [--frames n]
+//		[--resolution w h] [--threads n] [--traversal distance | mip] [--scalar]
+//		[--reproject] [--atlas image] [--output directory] [--raw] [--no-images]
+//		[--benchmark-octree]
+//
+// Terrain needs --size to be a power of two cube, 8 or more.
+// The camera path is a keyframe a line, "x y z pitch yaw", the camera moving linearly from
+// one to the next over the frames. Without one it sits where the windowed build starts.
+// Frames go to output as frame_0000.png, or frame_0000.rgba with --raw, and the times to
+// output/timings.csv, along with how many camera rays had to be traced. --benchmark-octree
+// first times the octree build over the map for 1 thread up to one per hardware thread
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include <SFML/Graphics.hpp>
+#include "map/Old_Map.h"
+#include "map/Map.h"
+#include "raycaster/Software_Caster.h"
+#include "Camera.h"
+#include "LightController.h"
+#include "LightHandle.h"
+
+namespace {
+
+	struct Keyframe {
+		sf::Vector3f position;
+		sf::Vector2f direction;
+	};
+
+	struct Options {
+		std::string map = "terrain";
+		sf::Vector3i raw_size = sf::Vector3i(0, 0, 0);
+		sf::Vector3i size = sf::Vector3i(256, 256, 256);
+		uint64_t seed = 1;
+		MAP_LAYOUTS layout = LINEAR_LAYOUT;
+		std::string camera_path;
+		int frames = 60;
+		sf::Vector2i resolution = sf::Vector2i(1536, 1024);
+		unsigned int threads = 0;
+		RayCaster::DENSE_TRAVERSALS traversal = RayCaster::DISTANCE_FIELD_TRAVERSAL;
+		bool packet_rays = true;
+		bool reprojection = false;
+		std::string atlas = "../assets/textures/minecraft_tiles.png";
+		std::string output = ".";
+		bool raw_frames = false;
+		bool write_frames = true;
+		bool benchmark_octree = false;
+	};
+
+	bool ends_with(const std::string &value, const std::string &suffix) {
+		return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	bool parse_options(int argc, char *argv[], Options &options) {
+
+		for (int i = 1; i < argc; i++) {
+
+			std::string option = argv[i];
+
+			// How many values are left after the option
+			auto has = [&](int count) {
+				if (i + count < argc)
+					return true;
+				std::cout << option << " needs " << count << " value" << (count > 1 ? "s" : "") << std::endl;
+				return false;
+			};
+
+			if (option == "--map" && has(1)) {
+				options.map = argv[++i];
+			}
+			else if (option == "--raw-size" && has(3)) {
+				options.raw_size.x = atoi(argv[++i]);
+				options.raw_size.y = atoi(argv[++i]);
+				options.raw_size.z = atoi(argv[++i]);
+			}
+			else if (option == "--size" && has(3)) {
+				options.size.x = atoi(argv[++i]);
+				options.size.y = atoi(argv[++i]);
+				options.size.z = atoi(argv[++i]);
+			}
+			else if (option == "--seed" && has(1)) {
+				options.seed = strtoull(argv[++i], nullptr, 10);
+			}
+			else if (option == "--layout" && has(1)) {
+
+				std::string layout = argv[++i];
+
+				if (layout == "linear")
+					options.layout = LINEAR_LAYOUT;
+				else if (layout == "morton")
+					options.layout = MORTON_LAYOUT;
+				else {
+					std::cout << "The layout is linear or morton, not " << layout << std::endl;
+					return false;
+				}
+			}
+			else if (option == "--camera" && has(1)) {
+				options.camera_path = argv[++i];
+			}
+			else if (option == "--frames" && has(1)) {
+				options.frames = atoi(argv[++i]);
+			}
+			else if (option == "--resolution" && has(2)) {
+				options.resolution.x = atoi(argv[++i]);
+				options.resolution.y = atoi(argv[++i]);
+			}
+			else if (option == "--threads" && has(1)) {
+				options.threads = static_cast<unsigned int>(atoi(argv[++i]));
+			}
+			else if (option == "--traversal" && has(1)) {
+
+				std::string traversal = argv[++i];
+
+				if (traversal == "distance")
+					options.traversal = RayCaster::DISTANCE_FIELD_TRAVERSAL;
+				else if (traversal == "mip")
+					options.traversal = RayCaster::MIP_TRAVERSAL;
+				else {
+					std::cout << "The traversal is distance or mip, not " << traversal << std::endl;
+					return false;
+				}
+			}
+			else if (option == "--scalar") {
+				options.packet_rays = false;
+			}
+			else if (option == "--reproject") {
+				options.reprojection = true;
+			}
+			else if (option == "--atlas" && has(1)) {
+				options.atlas = argv[++i];
+			}
+			else if (option == "--output" && has(1)) {
+				options.output = argv[++i];
+			}
+			else if (option == "--raw") {
+				options.raw_frames = true;
+			}
+			else if (option == "--no-images") {
+				options.write_frames = false;
+			}
+			else if (option == "--benchmark-octree") {
+				options.benchmark_octree = true;
+			}
+			else {
+				std::cout << "Don't know what to do with " << option << std::endl;
+				return false;
+			}
+		}
+
+		if (options.frames < 1 || options.resolution.x < 1 || options.resolution.y < 1 ||
+			options.size.x < 1 || options.size.y < 1 || options.size.z < 1) {
+			std::cout << "Frames, resolution and size have to be positive" << std::endl;
+			return false;
+		}
+
+		// The diamond square wraps its samples with a mask, and the hand placed parts of it
+		// need a few layers
+		sf::Vector3i size = options.size;
+
+		if (options.map == "terrain" && (size.x != size.y || size.x != size.z || (size.x & (size.x - 1)) != 0 || size.x < 8)) {
+			std::cout << "Terrain needs a size that's a power of two cube, 8 or more" << std::endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	bool load_camera_path(std::string path, std::vector<Keyframe> &keyframes) {
+
+		std::ifstream input_file(path);
+
+		if (!input_file.is_open()) {
+			std::cout << "Couldn't open the camera path " << path << std::endl;
+			return false;
+		}
+
+		std::string line;
+		while (std::getline(input_file, line)) {
+
+			std::istringstream values(line);
+			Keyframe keyframe;
+
+			if (values >> keyframe.position.x >> keyframe.position.y >> keyframe.position.z >> keyframe.direction.x >> keyframe.direction.y)
+				keyframes.push_back(keyframe);
+		}
+
+		if (keyframes.empty()) {
+			std::cout << path << " has no keyframes in it" << std::endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	// Where the camera is at frame of frames, walking the keyframes at an even pace
+	Keyframe camera_at(const std::vector<Keyframe> &keyframes, int frame, int frames) {
+
+		if (keyframes.size() == 1 || frames == 1)
+			return keyframes.front();
+
+		float along = static_cast<float>(frame) / (frames - 1) * (keyframes.size() - 1);
+		size_t from = std::min(static_cast<size_t>(along), keyframes.size() - 2);
+		float t = along - from;
+
+		const Keyframe &a = keyframes[from];
+		const Keyframe &b = keyframes[from + 1];
+
+		Keyframe between;
+		between.position = a.position + (b.position - a.position) * t;
+		between.direction = a.direction + (b.direction - a.direction) * t;
+		return between;
+	}
+
+	bool write_frame(const Options &options, int frame, const sf::Uint8 *pixels) {
+
+		std::ostringstream name;
+		name << options.output << "/frame_" << std::setw(4) << std::setfill('0') << frame << (options.raw_frames ? ".rgba" : ".png");
+
+		if (options.raw_frames) {
+
+			std::ofstream output_file(name.str(), std::ios::binary | std::ios::out);
+			output_file.write(reinterpret_cast<const char*>(pixels), static_cast<std::streamsize>(options.resolution.x) * options.resolution.y * 4);
+
+			if (output_file.good())
+				return true;
+		}
+		else {
+
+			sf::Image image;
+			image.create(options.resolution.x, options.resolution.y, pixels);
+
+			if (image.saveToFile(name.str()))
+				return true;
+		}
+
+		std::cout << "Couldn't write " << name.str() << std::endl;
+		return false;
+	}
+}
+
+int main(int argc, char *argv[]) {
+
+	Options options;
+
+	if (!parse_options(argc, argv, options))
+		return 1;
+
+	std::vector<Keyframe> keyframes;
+
+	if (options.camera_path.empty())
+		keyframes.push_back({ sf::Vector3f(50, 50, 50), sf::Vector2f(1.5f, 0.0f) });
+	else if (!load_camera_path(options.camera_path, keyframes))
+		return 1;
+
+	std::shared_ptr<Software_Caster> raycaster(new Software_Caster(options.threads));
+	raycaster->init();
+
+	// An empty map takes the import, otherwise it's the same terrain as the windowed build
+	Old_Map* map = new Old_Map(options.size, options.layout);
+	auto map_start = std::chrono::steady_clock::now();
+
+	bool map_loaded = true;
+
+	if (options.map == "terrain") {
+		map->generate_terrain(options.seed, options.threads);
+	}
+	else if (ends_with(options.map, ".vox")) {
+		map_loaded = map->import_vox(options.map, sf::Vector3i(0, 0, 0), options.threads);
+	}
+	else if (ends_with(options.map, ".raw")) {
+
+		if (options.raw_size.x < 1 || options.raw_size.y < 1 || options.raw_size.z < 1) {
+			std::cout << "A raw volume needs --raw-size" << std::endl;
+			return 1;
+		}
+
+		map_loaded = map->import_raw(options.map, options.raw_size, sf::Vector3i(0, 0, 0), options.threads);
+	}
+	else {
+		std::cout << "The map is terrain, a .vox or a .raw" << std::endl;
+		return 1;
+	}
+
+	if (!map_loaded)
+		return 1;
+
+	std::cout << "Map ready in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - map_start).count() << " ms" << std::endl;
+
+	if (options.benchmark_octree) {
+
+		sf::Vector3i size = options.size;
+
+		if (size.x != size.y || size.x != size.z || (size.x & (size.x - 1)) != 0) {
+			std::cout << "The octree needs a map that's a power of two cube" << std::endl;
+			return 1;
+		}
+
+		std::vector<char> linear_voxels = map->get_linear_voxel_data();
+		Map octree_map(size.x, linear_voxels.data());
+		octree_map.generate_octree();
+		octree_map.benchmark_octree_build();
+	}
+
+	raycaster->assign_map(map);
+
+	Camera *camera = new Camera();
+	camera->set_position(keyframes.front().position);
+	camera->set_camera(keyframes.front().direction);
+	raycaster->assign_camera(camera);
+
+	raycaster->create_viewport(options.resolution.x, options.resolution.y, 0.625f * 90.0f, 90.0f);
+
+	// The light from the windowed build
+	LightController light_controller(raycaster);
+	LightPrototype prototype(
+		sf::Vector3f(100.0f, 100.0f, 75.0f),
+		sf::Vector3f(-1.0f, -1.0f, -1.5f),
+		sf::Vector4f(0.2f, 0.9f, 0.0f, 1.0f)
+	);
+
+	std::shared_ptr<LightHandle> handle(light_controller.create_light(prototype));
+
+	// Without the atlas every face samples as black, the lighting still shows
+	sf::Image atlas;
+	if (!atlas.loadFromFile(options.atlas)) {
+		std::cout << "Couldn't load the atlas " << options.atlas << ", faces will be untextured" << std::endl;
+		sf::Uint8 black[4] = { 0, 0, 0, 255 };
+		atlas.create(1, 1, black);
+	}
+
+	raycaster->create_texture_atlas(atlas, sf::Vector2i(16, 16));
+
+	raycaster->set_dense_traversal(options.traversal);
+	raycaster->set_packet_rays(options.packet_rays);
+	raycaster->set_reprojection(options.reprojection);
+	raycaster->validate();
+
+	std::ofstream timings(options.output + "/timings.csv");
+
+	if (!timings.is_open()) {
+		std::cout << "Couldn't write to " << options.output << std::endl;
+		return 1;
+	}
+
+	timings << "frame,render_ms,traced_rays,x,y,z,pitch,yaw" << std::endl;
+
+	double total_milliseconds = 0;
+
+	for (int frame = 0; frame < options.frames; frame++) {
+
+		Keyframe at = camera_at(keyframes, frame, options.frames);
+		camera->set_position(at.position);
+		camera->set_camera(at.direction);
+
+		auto start = std::chrono::steady_clock::now();
+		raycaster->compute();
+		double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		total_milliseconds += milliseconds;
+
+		timings << frame << "," << milliseconds << "," << raycaster->get_traced_rays() << ","
+			<< at.position.x << "," << at.position.y << "," << at.position.z << ","
+			<< at.direction.x << "," << at.direction.y << std::endl;
+
+		if (options.write_frames && !write_frame(options, frame, raycaster->get_viewport_image()))
+			return 1;
+	}
+
+	std::cout << options.frames << " frames at " << options.resolution.x << "x" << options.resolution.y
+		<< ", " << total_milliseconds / options.frames << " ms a frame" << std::endl;
+
+	delete camera;
+	delete map;
+
+	return 0;
+}
@@ -30,6 +30,8 @@
 #include <SFML/Network.hpp>
 #include "map/Old_Map.h"
 #include "raycaster/Hardware_Caster.h"
+#include "raycaster/Software_Caster.h"
+#include "raycaster/ResolutionScaler.h"
 #include "Vector4.hpp"
 #include "Camera.h"
 #include "Input.h"
@@ -39,6 +41,7 @@
 #include "imgui/imgui-SFML.h"
 #include "imgui/imgui.h"
 #include "map/Map.h"
+#include "map/ChunkManager.h"
 
 const int WINDOW_X = 1536;
 const int WINDOW_Y = 1024;
@@ -48,6 +51,13 @@ const int MAP_X = 256;
 const int MAP_Y = 256;
 const int MAP_Z = 256;
 
+// Same seed, same world, on whatever machine and however many threads build it
+const uint64_t MAP_SEED = 1;
+
+// LINEAR_LAYOUT or MORTON_LAYOUT. Old_Map::benchmark_layouts times the two on the same rays,
+// and without BMI2 for the encode Morton hasn't come out ahead
+const MAP_LAYOUTS MAP_LAYOUT = LINEAR_LAYOUT;
+
 float elap_time(){
 	static std::chrono::time_point<std::chrono::system_clock> start;
 	static bool started = false;
@@ -74,7 +84,7 @@ sf::Texture window_texture;
 // - Diffuse fog hard cut off
 // - Infinite light distance, no inverse square
 // - Inconsistent lighting constants. GUI manipulation
-// - Far pointers, attachment lookup and aux buffer, contour lookup & masking
+// - Attachment lookup and aux buffer, contour lookup & masking
 
 
 int main() {
@@ -95,6 +105,14 @@ int main() {
 	_map.generate_octree();
 	_map.a.print_block(0);
 	_map.test_map();
+
+	// The dense map's live edits against a rebuild, on a small one of its own
+	Old_Map test_old_map(sf::Vector3i(64, 64, 64), MAP_LAYOUT);
+	test_old_map.generate_terrain(MAP_SEED);
+	test_old_map.validate_edits(40);
+
+	// Its scratch files go in the working directory, the build directory, and are removed after
+	test_old_map.validate_import("./");
 	//std::cin.get();
 	//return 0;
 	// =============================
@@ -109,20 +127,62 @@ int main() {
 	window.resetGLStates();
 
 	// Start up the raycaster
-	std::shared_ptr<Hardware_Caster> raycaster(new Hardware_Caster());
+	std::shared_ptr<RayCaster> raycaster(new Hardware_Caster());
 	
+	// No OpenCL device that can share with GL, cast on the CPU instead
 	if (raycaster->init() != 1) {
-		abort();
+		raycaster.reset(new Software_Caster());
+
+		if (raycaster->init() != 1) {
+			abort();
+		}
 	}
 
 
 	// Create and generate the old 3d array style map
-	Old_Map* map = new Old_Map(sf::Vector3i(MAP_X, MAP_Y, MAP_Z));
-	map->generate_terrain();
+	Old_Map* map = new Old_Map(sf::Vector3i(MAP_X, MAP_Y, MAP_Z), MAP_LAYOUT);
+	map->generate_terrain(MAP_SEED);
+
+	// The octree and brickmap build off of a linear array whatever the layout
+	std::vector<char> linear_voxels = map->get_linear_voxel_data();
 
 	// Send the data to the GPU
 	raycaster->assign_map(map);
 
+	// Build an octree out of the same terrain so the two kernels can be compared.
+	// Warm starts just map the last one back in. It's cached in the working directory,
+	// the build directory, tagged with the voxels it came from so a different map gets
+	// a new one built
+	Map octree_map(MAP_X, linear_voxels.data());
+	uint64_t octree_key = octree_map.voxel_key();
+
+	sf::Clock octree_timer;
+	if (octree_map.a.load("octree.svo", octree_key)) {
+		std::cout << "Octree loaded in " << octree_timer.restart().asMilliseconds() << " ms" << std::endl;
+	}
+	else {
+		octree_map.generate_octree();
+		octree_map.a.save("octree.svo", octree_key);
+		std::cout << "Octree generated in " << octree_timer.restart().asMilliseconds() << " ms" << std::endl;
+	}
+
+	raycaster->assign_octree(&octree_map.a);
+
+	// And a brickmap, empty and solid cells cost a grid entry instead of 512 bytes
+	sf::Clock brickmap_timer;
+	BrickMap brickmap(map->getDimensions());
+	brickmap.load_dense(linear_voxels.data(), map->getDimensions());
+	std::cout << "Brickmap built in " << brickmap_timer.restart().asMilliseconds() << " ms, "
+		<< brickmap.bricks_used() << " bricks, " << brickmap.bytes_used() << " bytes" << std::endl;
+
+	raycaster->assign_brickmap(&brickmap);
+
+	// An endless world streamed in chunks around the camera, swapped in for Old_Map
+	// under the dense kernel from the Chunks window. 4^3 chunks on the device, 256 MB on the host
+	ChunkManager chunk_manager(4, 256ull * 1024 * 1024, [](sf::Vector3i chunk_position, char *voxels) {
+		ChunkManager::generate_terrain_chunk(MAP_SEED, chunk_position, voxels);
+	});
+
 	// Create a new camera with (starting position, direction)
 	Camera *camera = new Camera(
 		sf::Vector3f(50, 50, 50),
@@ -180,13 +240,25 @@ int main() {
 	sf::Clock sf_delta_clock;
 	fps_counter fps;
 
+	// Trades render resolution for frame time, the viewport is stretched back over the window
+	ResolutionScaler resolution_scaler(sf::Vector2i(WINDOW_X, WINDOW_Y));
+
 	float light_color[4] = { 0, 0, 0, 0 };
 	float light_pos[4] = { 100, 100, 30 };
 	char screenshot_buf[128]{0};
 
 	bool paused = false;
+	int storage_mode = RayCaster::DENSE;
+	int dense_traversal = RayCaster::DISTANCE_FIELD_TRAVERSAL;
+	bool streaming = false;
 	float camera_speed = 1.0;
 
+	// Sphere brush for live edits, centered brush_distance out in front of the camera
+	int brush_radius = 4;
+	int brush_material = 5;
+	float brush_distance = 20;
+	uint64_t frame_upload_bytes = 0;
+
 	while (window.isOpen()) {
 
 		input_handler.consume_sf_events(&window);
@@ -216,16 +288,43 @@ int main() {
 			camera->update(delta_time);
 			handle->update(delta_time);
 
-			// Run the raycast
+			if (streaming) {
+				chunk_manager.update(camera);
+				raycaster->upload_chunks();
+			}
+			else {
+				raycaster->flush_map_edits();
+			}
+
+			// Run the raycast, at whatever resolution the last frames' times asked for
+			raycaster->resize_viewport(resolution_scaler.get_render_resolution());
+
+			auto render_start = std::chrono::steady_clock::now();
 			raycaster->compute();
+			resolution_scaler.frame(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - render_start).count());
 			
 		}
 
+		frame_upload_bytes = raycaster->take_uploaded_bytes();
+
 		raycaster->draw(&window);
 
 		// Give the frame counter the frame time and draw the average frame time
 		fps.frame(delta_time);
 		fps.draw();
+		resolution_scaler.draw();
+
+		// The CPU caster's reuse between frames, it can be slightly off so it starts out off
+		if (Software_Caster *software_caster = dynamic_cast<Software_Caster*>(raycaster.get())) {
+
+			ImGui::Begin("Performance");
+
+			bool reproject = software_caster->get_reprojection();
+			if (ImGui::Checkbox("Reproject", &reproject))
+				software_caster->set_reprojection(reproject);
+
+			ImGui::End();
+		}
 
 		ImGuiWindowFlags window_flags = ImGuiWindowFlags_MenuBar;
 		bool window_show = true;
@@ -286,6 +385,78 @@ int main() {
 			paused = !paused;
 		}
 
+		bool storage_changed = ImGui::RadioButton("Dense", &storage_mode, RayCaster::DENSE);
+		storage_changed |= ImGui::RadioButton("Octree", &storage_mode, RayCaster::OCTREE);
+		storage_changed |= ImGui::RadioButton("Brickmap", &storage_mode, RayCaster::BRICKMAP);
+
+		if (storage_changed) {
+			raycaster->set_storage_mode(static_cast<RayCaster::STORAGE_MODES>(storage_mode));
+
+			// The CPU caster stays on the dense map
+			storage_mode = raycaster->get_storage_mode();
+		}
+
+		// How the dense kernel skips empty space
+		bool traversal_changed = ImGui::RadioButton("Distance field", &dense_traversal, RayCaster::DISTANCE_FIELD_TRAVERSAL);
+		traversal_changed |= ImGui::RadioButton("Mip pyramid", &dense_traversal, RayCaster::MIP_TRAVERSAL);
+
+		if (traversal_changed) {
+			raycaster->set_dense_traversal(static_cast<RayCaster::DENSE_TRAVERSALS>(dense_traversal));
+		}
+
+		ImGui::End();
+
+		ImGui::Begin("Chunks");
+
+		if (ImGui::Checkbox("Stream chunks", &streaming)) {
+			if (streaming)
+				raycaster->assign_chunk_manager(&chunk_manager);
+			else
+				raycaster->assign_map(map);
+			raycaster->validate();
+		}
+
+		ChunkStats chunk_stats = chunk_manager.get_stats();
+		sf::Vector3i window_origin = chunk_manager.get_window_origin();
+
+		ImGui::Text("Window origin : %d %d %d", window_origin.x, window_origin.y, window_origin.z);
+		ImGui::Text("Generate queue : %zu, generating : %zu", chunk_stats.generate_queue_depth, chunk_stats.generating);
+		ImGui::Text("Upload queue : %zu, uploaded : %llu", chunk_stats.upload_queue_depth, (unsigned long long)chunk_stats.uploaded_chunks);
+		ImGui::Text("Resident : %zu chunks, %.1f MB", chunk_stats.resident_chunks, chunk_stats.resident_bytes / (1024.0 * 1024.0));
+		ImGui::Text("Voxels uploaded : %.1f MB paletted, %.1f MB dense",
+			chunk_stats.uploaded_voxel_bytes / (1024.0 * 1024.0), chunk_stats.uploaded_dense_bytes / (1024.0 * 1024.0));
+		ImGui::Text("Evicted : %llu", (unsigned long long)chunk_stats.evicted_chunks);
+		ImGui::Text("Generate : %.2f ms avg, %.2f ms max", chunk_stats.generate_ms_average, chunk_stats.generate_ms_max);
+		ImGui::Text("Latency : %.2f ms avg, %.2f ms max", chunk_stats.latency_ms_average, chunk_stats.latency_ms_max);
+
+		ImGui::End();
+
+		ImGui::Begin("Edits");
+
+		ImGui::SliderInt("Radius", &brush_radius, 1, 32);
+		ImGui::SliderInt("Material", &brush_material, 1, 6);
+		ImGui::SliderFloat("Distance", &brush_distance, 0, 100);
+
+		bool place = ImGui::Button("Place");
+		ImGui::SameLine();
+		bool carve = ImGui::Button("Carve");
+
+		if ((place || carve) && !streaming) {
+
+			sf::Vector3f center = camera->get_position() + SphereToCart(camera->get_direction()) * brush_distance;
+
+			for (int z = -brush_radius; z <= brush_radius; z++) {
+				for (int y = -brush_radius; y <= brush_radius; y++) {
+					for (int x = -brush_radius; x <= brush_radius; x++) {
+						if (x * x + y * y + z * z <= brush_radius * brush_radius)
+							map->edit_voxel(sf::Vector3i(center) + sf::Vector3i(x, y, z), place ? brush_material : 0);
+					}
+				}
+			}
+		}
+
+		ImGui::Text("Uploaded this frame : %llu bytes", (unsigned long long)frame_upload_bytes);
+
 		ImGui::End();
 
 		ImGui::Begin("Lights");
@@ -0,0 +1,141 @@
+#include "map/BrickMap.h"
+#include <cstring>
+
+BrickMap::BrickMap(sf::Vector3i dimensions) {
+
+	grid_dimensions = sf::Vector3i(
+		(dimensions.x + BRICK_DIM - 1) / BRICK_DIM,
+		(dimensions.y + BRICK_DIM - 1) / BRICK_DIM,
+		(dimensions.z + BRICK_DIM - 1) / BRICK_DIM
+	);
+
+	this->dimensions = grid_dimensions * BRICK_DIM;
+
+	grid.assign((size_t)grid_dimensions.x * grid_dimensions.y * grid_dimensions.z, BRICK_EMPTY);
+}
+
+void BrickMap::load_dense(const char *voxel_data, sf::Vector3i dimensions) {
+
+	char brick[BRICK_VOXELS];
+
+	for (int cz = 0; cz < grid_dimensions.z; cz++) {
+		for (int cy = 0; cy < grid_dimensions.y; cy++) {
+			for (int cx = 0; cx < grid_dimensions.x; cx++) {
+
+				sf::Vector3i origin(cx * BRICK_DIM, cy * BRICK_DIM, cz * BRICK_DIM);
+
+				// Gather the cell into a scratch brick first so uniform cells never touch the pool
+				bool uniform = true;
+
+				for (int z = 0; z < BRICK_DIM; z++) {
+					for (int y = 0; y < BRICK_DIM; y++) {
+						for (int x = 0; x < BRICK_DIM; x++) {
+
+							sf::Vector3i p = origin + sf::Vector3i(x, y, z);
+
+							char value = 0;
+							if (p.x < dimensions.x && p.y < dimensions.y && p.z < dimensions.z)
+								value = voxel_data[p.x + dimensions.x * (p.y + dimensions.y * p.z)];
+
+							int i = x + BRICK_DIM * (y + BRICK_DIM * z);
+							brick[i] = value;
+							uniform = uniform && value == brick[0];
+						}
+					}
+				}
+
+				uint32_t &entry = cell(origin);
+
+				if (uniform) {
+					entry = brick[0] == 0 ? BRICK_EMPTY : BRICK_SOLID | (uint8_t)brick[0];
+				}
+				else {
+					entry = allocate_brick(0);
+					memcpy(&bricks[(size_t)(entry - 1) * BRICK_VOXELS], brick, BRICK_VOXELS);
+				}
+			}
+		}
+	}
+}
+
+char BrickMap::get_voxel(sf::Vector3i position) const {
+
+	if (position.x < 0 || position.x >= dimensions.x ||
+		position.y < 0 || position.y >= dimensions.y ||
+		position.z < 0 || position.z >= dimensions.z)
+		return 0;
+
+	uint32_t entry = cell(position);
+
+	if (entry == BRICK_EMPTY)
+		return 0;
+
+	if (entry & BRICK_SOLID)
+		return static_cast<char>(entry & 0xFF);
+
+	return bricks[(size_t)(entry - 1) * BRICK_VOXELS + brick_offset(position)];
+}
+
+void BrickMap::set_voxel(sf::Vector3i position, char value) {
+
+	if (position.x < 0 || position.x >= dimensions.x ||
+		position.y < 0 || position.y >= dimensions.y ||
+		position.z < 0 || position.z >= dimensions.z)
+		return;
+
+	uint32_t &entry = cell(position);
+
+	// Uniform cells only need a brick if the voxel actually changes
+	if (entry == BRICK_EMPTY || (entry & BRICK_SOLID)) {
+
+		char current = entry == BRICK_EMPTY ? 0 : static_cast<char>(entry & 0xFF);
+		if (current == value)
+			return;
+
+		entry = allocate_brick(current);
+	}
+
+	bricks[(size_t)(entry - 1) * BRICK_VOXELS + brick_offset(position)] = value;
+
+	entry = collapse_brick(entry);
+}
+
+uint32_t& BrickMap::cell(sf::Vector3i position) {
+	return grid[(position.x / BRICK_DIM) + grid_dimensions.x * ((position.y / BRICK_DIM) + grid_dimensions.y * (position.z / BRICK_DIM))];
+}
+
+uint32_t BrickMap::cell(sf::Vector3i position) const {
+	return grid[(position.x / BRICK_DIM) + grid_dimensions.x * ((position.y / BRICK_DIM) + grid_dimensions.y * (position.z / BRICK_DIM))];
+}
+
+uint32_t BrickMap::allocate_brick(char value) {
+
+	uint32_t index;
+
+	if (!free_bricks.empty()) {
+		index = free_bricks.back();
+		free_bricks.pop_back();
+	}
+	else {
+		index = static_cast<uint32_t>(bricks.size() / BRICK_VOXELS);
+		bricks.resize(bricks.size() + BRICK_VOXELS);
+	}
+
+	memset(&bricks[(size_t)index * BRICK_VOXELS], value, BRICK_VOXELS);
+
+	return index + 1;
+}
+
+uint32_t BrickMap::collapse_brick(uint32_t entry) {
+
+	const char *brick = &bricks[(size_t)(entry - 1) * BRICK_VOXELS];
+
+	for (int i = 1; i < BRICK_VOXELS; i++) {
+		if (brick[i] != brick[0])
+			return entry;
+	}
+
+	free_bricks.push_back(entry - 1);
+
+	return brick[0] == 0 ? BRICK_EMPTY : BRICK_SOLID | (uint8_t)brick[0];
+}
@@ -0,0 +1,353 @@
+#include "map/ChunkManager.h"
+#include "Camera.h"
+#include <algorithm>
+#include <cmath>
+
+// Modulo that stays positive for the negative half of the world
+static int positive_mod(int a, int n) {
+	return ((a % n) + n) % n;
+}
+
+static int floor_div(int a, int n) {
+	return (a - positive_mod(a, n)) / n;
+}
+
+ChunkManager::ChunkManager(int window_chunks, uint64_t memory_budget, Generator generator, unsigned int thread_count) :
+	window_chunks(window_chunks),
+	memory_budget(memory_budget),
+	generator(generator),
+	window_origin(0, 0, 0),
+	slot_contents(window_chunks * window_chunks * window_chunks),
+	slot_filled(window_chunks * window_chunks * window_chunks, false),
+	workers(thread_count) {
+}
+
+ChunkManager::~ChunkManager() {
+}
+
+void ChunkManager::update(Camera *camera) {
+
+	frame++;
+
+	auto now = std::chrono::steady_clock::now();
+	sf::Vector3i center(window_chunks / 2, window_chunks / 2, window_chunks / 2);
+
+	// Floating origin. Once the camera leaves the middle chunk of the window, move the
+	// window under it by whole chunks and bring the camera back by the same amount
+	sf::Vector3f position = camera->get_position();
+	sf::Vector3i local_chunk(
+		static_cast<int>(std::floor(position.x / CHUNK_DIM)),
+		static_cast<int>(std::floor(position.y / CHUNK_DIM)),
+		static_cast<int>(std::floor(position.z / CHUNK_DIM))
+	);
+
+	sf::Vector3i shift = local_chunk - center;
+
+	if (shift != sf::Vector3i(0, 0, 0)) {
+		window_origin += shift * CHUNK_DIM;
+		camera->set_position(position - sf::Vector3f(shift * CHUNK_DIM));
+	}
+
+	sf::Vector3i window_chunk(
+		floor_div(window_origin.x, CHUNK_DIM),
+		floor_div(window_origin.y, CHUNK_DIM),
+		floor_div(window_origin.z, CHUNK_DIM)
+	);
+
+	sf::Vector3i camera_chunk = window_chunk + center;
+
+	// Take in whatever the workers finished since last frame
+	{
+		std::unique_lock<std::mutex> lock(finished_mutex);
+
+		for (auto &done : finished) {
+
+			sf::Vector3i chunk_position = done.first->position;
+
+			double latency = std::chrono::duration<double, std::milli>(now - requested_at[chunk_position]).count();
+
+			generated_chunks++;
+			generate_ms_total += done.second;
+			latency_ms_total += latency;
+			stats.generate_ms_max = std::max(stats.generate_ms_max, done.second);
+			stats.latency_ms_max = std::max(stats.latency_ms_max, latency);
+
+			chunks[chunk_position] = done.first;
+			resident_bytes += chunk_bytes(*done.first);
+			in_flight.erase(chunk_position);
+			requested_at.erase(chunk_position);
+		}
+
+		finished.clear();
+	}
+
+	// Walk the window and a chunk of margin around it. Everything in there is kept
+	// alive and asked for if it isn't here, and the window's slots get brought up to date
+	for (int z = -1; z <= window_chunks; z++) {
+		for (int y = -1; y <= window_chunks; y++) {
+			for (int x = -1; x <= window_chunks; x++) {
+
+				sf::Vector3i chunk_position = window_chunk + sf::Vector3i(x, y, z);
+
+				auto chunk = chunks.find(chunk_position);
+
+				if (chunk != chunks.end()) {
+					chunk->second->last_used_frame = frame;
+				}
+				else if (requested_at.count(chunk_position) == 0) {
+					requests.push_back(chunk_position);
+					requested_at[chunk_position] = now;
+				}
+
+				bool in_window =
+					x >= 0 && x < window_chunks &&
+					y >= 0 && y < window_chunks &&
+					z >= 0 && z < window_chunks;
+
+				if (!in_window)
+					continue;
+
+				sf::Vector3i slot_position(
+					positive_mod(chunk_position.x, window_chunks),
+					positive_mod(chunk_position.y, window_chunks),
+					positive_mod(chunk_position.z, window_chunks)
+				);
+
+				int slot = slot_position.x + window_chunks * (slot_position.y + window_chunks * slot_position.z);
+
+				if (chunk != chunks.end()) {
+					if (!slot_filled[slot] || slot_contents[slot] != chunk_position) {
+						uploads.push_back({ slot_position * CHUNK_DIM, chunk->second });
+						slot_contents[slot] = chunk_position;
+						slot_filled[slot] = true;
+					}
+				}
+				// Don't leave the chunk that moved out on screen while the new one generates
+				else if (slot_filled[slot]) {
+					uploads.push_back({ slot_position * CHUNK_DIM, nullptr });
+					slot_filled[slot] = false;
+				}
+			}
+		}
+	}
+
+	dispatch_requests(camera_chunk);
+
+	evict(camera_chunk);
+}
+
+uint64_t ChunkManager::chunk_bytes(const Chunk &chunk) {
+
+	// The packed voxels, a byte of distance per 4^3 block and a bit of occupancy per voxel
+	return chunk.voxels.bytes_used() + CHUNK_VOXELS / (DISTANCE_BLOCK * DISTANCE_BLOCK * DISTANCE_BLOCK) + CHUNK_VOXELS / 8;
+}
+
+std::vector<ChunkUpload> ChunkManager::take_uploads() {
+
+	stats.uploaded_chunks += uploads.size();
+
+	for (auto &upload : uploads) {
+		if (upload.chunk) {
+			stats.uploaded_voxel_bytes += upload.chunk->voxels.bytes_used();
+			stats.uploaded_dense_bytes += CHUNK_VOXELS;
+		}
+	}
+
+	std::vector<ChunkUpload> taken;
+	taken.swap(uploads);
+
+	return taken;
+}
+
+void ChunkManager::invalidate_slots() {
+
+	std::fill(slot_filled.begin(), slot_filled.end(), false);
+
+	// Anything still waiting was for the buffers that are gone
+	uploads.clear();
+}
+
+sf::Vector3i ChunkManager::get_window_dimensions() const {
+	return sf::Vector3i(window_chunks, window_chunks, window_chunks) * CHUNK_DIM;
+}
+
+sf::Vector3i ChunkManager::get_ring_offset() const {
+
+	int size = window_chunks * CHUNK_DIM;
+
+	return sf::Vector3i(
+		positive_mod(window_origin.x, size),
+		positive_mod(window_origin.y, size),
+		positive_mod(window_origin.z, size)
+	);
+}
+
+ChunkStats ChunkManager::get_stats() {
+
+	stats.generate_queue_depth = requests.size();
+	stats.generating = in_flight.size();
+	stats.upload_queue_depth = uploads.size();
+	stats.resident_chunks = chunks.size();
+	stats.resident_bytes = resident_bytes;
+
+	if (generated_chunks > 0) {
+		stats.generate_ms_average = generate_ms_total / generated_chunks;
+		stats.latency_ms_average = latency_ms_total / generated_chunks;
+	}
+
+	return stats;
+}
+
+void ChunkManager::generate_terrain_chunk(uint64_t seed, sf::Vector3i chunk_position, char *voxels) {
+
+	const int octaves = 4;
+	const int sea_level = 24;
+
+	sf::Vector3i origin = chunk_position * CHUNK_DIM;
+
+	for (int y = 0; y < CHUNK_DIM; y++) {
+		for (int x = 0; x < CHUNK_DIM; x++) {
+
+			int world_x = origin.x + x;
+			int world_y = origin.y + y;
+
+			// Value noise, a random height on a lattice blended smoothly between. Each
+			// octave halves the lattice spacing and the amplitude
+			double height = 32.0;
+
+			for (int octave = 0; octave < octaves; octave++) {
+
+				int spacing = 128 >> octave;
+				double amplitude = 32.0 / (1 << octave);
+
+				int cell_x = floor_div(world_x, spacing);
+				int cell_y = floor_div(world_y, spacing);
+
+				double fx = static_cast<double>(world_x - cell_x * spacing) / spacing;
+				double fy = static_cast<double>(world_y - cell_y * spacing) / spacing;
+
+				fx = fx * fx * (3 - 2 * fx);
+				fy = fy * fy * (3 - 2 * fy);
+
+				auto lattice = [&](int lx, int ly) {
+					uint64_t counter = static_cast<uint32_t>(lx) | (static_cast<uint64_t>(static_cast<uint32_t>(ly)) << 32);
+					return terrain_random(seed, octave, counter);
+				};
+
+				double top = lattice(cell_x, cell_y) * (1 - fx) + lattice(cell_x + 1, cell_y) * fx;
+				double bottom = lattice(cell_x, cell_y + 1) * (1 - fx) + lattice(cell_x + 1, cell_y + 1) * fx;
+
+				height += (top * (1 - fy) + bottom * fy) * amplitude;
+			}
+
+			for (int z = 0; z < CHUNK_DIM; z++) {
+
+				int world_z = origin.z + z;
+				char voxel = 0;
+
+				if (world_z <= height)
+					voxel = 5;
+				else if (world_z < sea_level)
+					voxel = 6;
+
+				voxels[x + CHUNK_DIM * (y + CHUNK_DIM * z)] = voxel;
+			}
+		}
+	}
+}
+
+void ChunkManager::generate_chunk(sf::Vector3i position) {
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>();
+	chunk->position = position;
+
+	// The dense voxels only live long enough to build everything else from
+	std::vector<char> voxels(CHUNK_VOXELS);
+	generator(position, voxels.data());
+
+	chunk->voxels.load_dense(voxels.data(), CHUNK_VOXELS);
+
+	// Bounded, the neighbouring slots on the device can hold anything
+	sf::Vector3i field_dimensions;
+	generate_distance_field(voxels.data(), sf::Vector3i(CHUNK_DIM, CHUNK_DIM, CHUNK_DIM), chunk->distance_field, field_dimensions, true);
+	chunk->occupancy.generate(voxels.data(), sf::Vector3i(CHUNK_DIM, CHUNK_DIM, CHUNK_DIM));
+
+	double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	std::unique_lock<std::mutex> lock(finished_mutex);
+	finished.push_back(std::make_pair(chunk, elapsed));
+}
+
+void ChunkManager::dispatch_requests(sf::Vector3i camera_chunk) {
+
+	sf::Vector3i window_chunk = camera_chunk - sf::Vector3i(window_chunks / 2, window_chunks / 2, window_chunks / 2);
+
+	auto distance = [camera_chunk](sf::Vector3i c) {
+		sf::Vector3i d = c - camera_chunk;
+		return d.x * d.x + d.y * d.y + d.z * d.z;
+	};
+
+	// Drop what the camera has since moved away from, it can be asked for again later
+	requests.erase(std::remove_if(requests.begin(), requests.end(), [&](sf::Vector3i c) {
+
+		sf::Vector3i local = c - window_chunk;
+		bool wanted =
+			local.x >= -1 && local.x <= window_chunks &&
+			local.y >= -1 && local.y <= window_chunks &&
+			local.z >= -1 && local.z <= window_chunks;
+
+		if (!wanted)
+			requested_at.erase(c);
+
+		return !wanted;
+
+	}), requests.end());
+
+	// Furthest first so the closest come off of the back
+	std::sort(requests.begin(), requests.end(), [&](sf::Vector3i a, sf::Vector3i b) {
+		return distance(a) > distance(b);
+	});
+
+	while (!requests.empty() && in_flight.size() < workers.get_thread_count()) {
+
+		sf::Vector3i chunk_position = requests.back();
+		requests.pop_back();
+
+		in_flight.insert(chunk_position);
+		workers.enqueue([this, chunk_position]() { generate_chunk(chunk_position); });
+	}
+}
+
+void ChunkManager::evict(sf::Vector3i camera_chunk) {
+
+	while (resident_bytes > memory_budget) {
+
+		// Furthest chunk that wasn't in the window or its margin this frame
+		auto furthest = chunks.end();
+		int furthest_distance = -1;
+
+		for (auto chunk = chunks.begin(); chunk != chunks.end(); ++chunk) {
+
+			if (chunk->second->last_used_frame == frame)
+				continue;
+
+			sf::Vector3i d = chunk->first - camera_chunk;
+			int distance = d.x * d.x + d.y * d.y + d.z * d.z;
+
+			if (distance > furthest_distance) {
+				furthest = chunk;
+				furthest_distance = distance;
+			}
+		}
+
+		// The window alone is over the budget, nothing we can do about it
+		if (furthest == chunks.end())
+			break;
+
+		resident_bytes -= chunk_bytes(*furthest->second);
+		chunks.erase(furthest);
+		stats.evicted_chunks++;
+	}
+}
@@ -0,0 +1,73 @@
+#include "map/DirtyRegions.h"
+#include <algorithm>
+
+DirtyRegions::DirtyRegions(int granularity, size_t max_regions) :
+	granularity(granularity),
+	max_regions(max_regions) {
+}
+
+void DirtyRegions::add(sf::Vector3i min, sf::Vector3i max) {
+
+	// Edits are never negative, so plain division rounds down
+	DirtyRegion region;
+	region.min = sf::Vector3i(min.x / granularity, min.y / granularity, min.z / granularity) * granularity;
+	region.max = sf::Vector3i(max.x / granularity + 1, max.y / granularity + 1, max.z / granularity + 1) * granularity - sf::Vector3i(1, 1, 1);
+
+	// Keep merging until nothing is close enough, a merge can bring it in range of another
+	bool merging = true;
+
+	while (merging) {
+
+		merging = false;
+
+		for (size_t i = 0; i < regions.size(); i++) {
+
+			DirtyRegion combined = merged(regions[i], region);
+
+			if (combined.volume() <= 2 * (regions[i].volume() + region.volume())) {
+				region = combined;
+				regions.erase(regions.begin() + i);
+				merging = true;
+				break;
+			}
+		}
+	}
+
+	if (regions.size() < max_regions) {
+		regions.push_back(region);
+		return;
+	}
+
+	// Full, fold it into whichever box it grows the least
+	size_t best = 0;
+	uint64_t best_growth = UINT64_MAX;
+
+	for (size_t i = 0; i < regions.size(); i++) {
+
+		uint64_t growth = merged(regions[i], region).volume() - regions[i].volume();
+
+		if (growth < best_growth) {
+			best = i;
+			best_growth = growth;
+		}
+	}
+
+	regions[best] = merged(regions[best], region);
+}
+
+std::vector<DirtyRegion> DirtyRegions::take() {
+
+	std::vector<DirtyRegion> taken;
+	taken.swap(regions);
+
+	return taken;
+}
+
+DirtyRegion DirtyRegions::merged(const DirtyRegion &a, const DirtyRegion &b) {
+
+	DirtyRegion region;
+	region.min = sf::Vector3i(std::min(a.min.x, b.min.x), std::min(a.min.y, b.min.y), std::min(a.min.z, b.min.z));
+	region.max = sf::Vector3i(std::max(a.max.x, b.max.x), std::max(a.max.y, b.max.y), std::max(a.max.z, b.max.z));
+
+	return region;
+}
@@ -0,0 +1,189 @@
+#include "map/DistanceField.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <functional>
+
+// One line of the separable Chebyshev transform. Each entry becomes the smallest
+// max(distance along the line, entry) over the line, stride apart in the field
+static void distance_transform_line(uint8_t *line, int count, int stride, uint8_t *scratch) {
+
+	for (int i = 0; i < count; i++)
+		scratch[i] = line[i * stride];
+
+	for (int i = 0; i < count; i++) {
+
+		int best = scratch[i];
+
+		// Nothing further out than best can beat it
+		for (int r = 1; r < best; r++) {
+
+			if (i - r >= 0)
+				best = std::min(best, std::max(r, static_cast<int>(scratch[i - r])));
+			if (i + r < count)
+				best = std::min(best, std::max(r, static_cast<int>(scratch[i + r])));
+		}
+
+		line[i * stride] = static_cast<uint8_t>(best);
+	}
+}
+
+void generate_distance_field(
+	const char *voxel_data,
+	sf::Vector3i dimensions,
+	std::vector<uint8_t> &field,
+	sf::Vector3i &field_dimensions,
+	bool bounded,
+	ThreadPool *workers
+) {
+
+	// Chunks build theirs on a worker already, so they just run the passes inline
+	auto parallel_for = [workers](int count, std::function<void(int)> function) {
+		if (workers != nullptr) {
+			workers->parallel_for(count, function);
+		}
+		else {
+			for (int i = 0; i < count; i++)
+				function(i);
+		}
+	};
+
+	sf::Vector3i blocks(
+		(dimensions.x + DISTANCE_BLOCK - 1) / DISTANCE_BLOCK,
+		(dimensions.y + DISTANCE_BLOCK - 1) / DISTANCE_BLOCK,
+		(dimensions.z + DISTANCE_BLOCK - 1) / DISTANCE_BLOCK
+	);
+
+	field_dimensions = blocks;
+	field.assign(static_cast<size_t>(blocks.x) * blocks.y * blocks.z, 255);
+
+	// Seed with the occupied blocks, a z slice of blocks per task
+	parallel_for(blocks.z, [&](int bz) {
+		for (int by = 0; by < blocks.y; by++) {
+			for (int bx = 0; bx < blocks.x; bx++) {
+
+				bool occupied = false;
+
+				for (int z = bz * DISTANCE_BLOCK; z < std::min((bz + 1) * DISTANCE_BLOCK, dimensions.z) && !occupied; z++) {
+					for (int y = by * DISTANCE_BLOCK; y < std::min((by + 1) * DISTANCE_BLOCK, dimensions.y) && !occupied; y++) {
+						for (int x = bx * DISTANCE_BLOCK; x < std::min((bx + 1) * DISTANCE_BLOCK, dimensions.x); x++) {
+							if (voxel_data[x + dimensions.x * (y + dimensions.y * z)] != 0) {
+								occupied = true;
+								break;
+							}
+						}
+					}
+				}
+
+				if (occupied)
+					field[bx + blocks.x * (by + blocks.y * bz)] = 0;
+			}
+		}
+	});
+
+	// Chebyshev distance is separable, the distance along x, then the max of that and y
+	// over each xy plane, then z over the volume. Every line in a pass is independent
+	uint8_t *data = field.data();
+	int longest = std::max(blocks.x, std::max(blocks.y, blocks.z));
+
+	parallel_for(blocks.z, [&](int z) {
+		std::vector<uint8_t> scratch(longest);
+		for (int y = 0; y < blocks.y; y++)
+			distance_transform_line(data + blocks.x * (y + blocks.y * z), blocks.x, 1, scratch.data());
+	});
+
+	parallel_for(blocks.z, [&](int z) {
+		std::vector<uint8_t> scratch(longest);
+		for (int x = 0; x < blocks.x; x++)
+			distance_transform_line(data + x + blocks.x * blocks.y * z, blocks.y, blocks.x, scratch.data());
+	});
+
+	parallel_for(blocks.y, [&](int y) {
+		std::vector<uint8_t> scratch(longest);
+		for (int x = 0; x < blocks.x; x++)
+			distance_transform_line(data + x + blocks.x * y, blocks.z, blocks.x * blocks.y, scratch.data());
+	});
+
+	if (!bounded)
+		return;
+
+	// A block n blocks in from the nearest edge can only leap n blocks out from itself
+	parallel_for(blocks.z, [&](int z) {
+		for (int y = 0; y < blocks.y; y++) {
+			for (int x = 0; x < blocks.x; x++) {
+
+				int edge = std::min(
+					std::min(std::min(x, blocks.x - 1 - x), std::min(y, blocks.y - 1 - y)),
+					std::min(z, blocks.z - 1 - z)
+				);
+
+				uint8_t &distance = data[x + blocks.x * (y + blocks.y * z)];
+				distance = static_cast<uint8_t>(std::min<int>(distance, edge + 1));
+			}
+		}
+	});
+}
+
+bool mark_distance_field_occupied(
+	std::vector<uint8_t> &field,
+	sf::Vector3i field_dimensions,
+	sf::Vector3i block,
+	sf::Vector3i &changed_min,
+	sf::Vector3i &changed_max
+) {
+
+	auto entry = [&](sf::Vector3i b) -> uint8_t& {
+		return field[b.x + field_dimensions.x * (b.y + field_dimensions.y * b.z)];
+	};
+
+	if (entry(block) == 0)
+		return false;
+
+	entry(block) = 0;
+	changed_min = block;
+	changed_max = block;
+
+	for (int r = 1; r < 255; r++) {
+
+		bool changed = false;
+
+		for (int dz = -r; dz <= r; dz++) {
+			for (int dy = -r; dy <= r; dy++) {
+
+				// Inside of the shell only its two x faces, on its y and z faces the whole row
+				bool full_row = dz == -r || dz == r || dy == -r || dy == r;
+
+				for (int dx = -r; dx <= r; dx += full_row ? 1 : 2 * r) {
+
+					sf::Vector3i b = block + sf::Vector3i(dx, dy, dz);
+
+					if (b.x < 0 || b.y < 0 || b.z < 0 ||
+						b.x >= field_dimensions.x || b.y >= field_dimensions.y || b.z >= field_dimensions.z)
+						continue;
+
+					uint8_t &distance = entry(b);
+
+					if (distance > r) {
+						distance = static_cast<uint8_t>(r);
+						changed = true;
+					}
+				}
+			}
+		}
+
+		if (!changed)
+			break;
+
+		sf::Vector3i reach(r, r, r);
+		changed_min = block - reach;
+		changed_max = block + reach;
+	}
+
+	changed_min = sf::Vector3i(std::max(changed_min.x, 0), std::max(changed_min.y, 0), std::max(changed_min.z, 0));
+	changed_max = sf::Vector3i(
+		std::min(changed_max.x, field_dimensions.x - 1),
+		std::min(changed_max.y, field_dimensions.y - 1),
+		std::min(changed_max.z, field_dimensions.z - 1)
+	);
+
+	return true;
+}
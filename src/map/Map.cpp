@@ -1,7 +1,7 @@
 #include "map/Map.h"
 
 
-Map::Map(uint32_t dimensions) {
+Map::Map(uint32_t dimensions) : dimension(dimensions) {
 
 	srand(time(nullptr));
 
@@ -11,16 +11,25 @@ Map::Map(uint32_t dimensions) {
 		if (rand() % 25 < 2)
 			voxel_data[i] = 1;
 		else
-			voxel_data[i] = 1;
+			voxel_data[i] = 0;
 	}
 }
 
-uint64_t Map::generate_children(sf::Vector3i pos, int voxel_scale) {
+Map::Map(uint32_t dimensions, const char *voxel_data) : dimension(dimensions) {
+
+	uint64_t voxel_count = (uint64_t)dimensions * dimensions * dimensions;
+
+	this->voxel_data = new char[voxel_count];
+	memcpy(this->voxel_data, voxel_data, voxel_count);
+}
+
+PendingDescriptor Map::generate_children(sf::Vector3i pos, int voxel_scale, Octree *octree) {
 
 
 	// The 8 subvoxel coords starting from the 1th direction, the direction of the origin of the 3d grid
 	// XY, Z++, XY
-	std::vector<sf::Vector3i> v = { 
+	// This runs once per node so keep it on the stack, no heap allocations in here
+	const sf::Vector3i v[8] = { 
 		sf::Vector3i(pos.x      , pos.y      , pos.z),
 		sf::Vector3i(pos.x + voxel_scale, pos.y      , pos.z),
 		sf::Vector3i(pos.x      , pos.y + voxel_scale, pos.z),
@@ -41,8 +50,8 @@ uint64_t Map::generate_children(sf::Vector3i pos, int voxel_scale) {
 
 		// Setting the individual valid mask bits
 		// These don't bound check, should they?
-		for (int i = 0; i < v.size(); i++) {
-			if (getVoxel(v.at(i)))
+		for (int i = 0; i < 8; i++) {
+			if (getVoxel(v[i]))
 				SetBit(i + 16, &child_descriptor);
 		}
 
@@ -51,27 +60,32 @@ uint64_t Map::generate_children(sf::Vector3i pos, int voxel_scale) {
 
 		// This is where contours 
 		// The CP will be left blank, contours will be added maybe
-		return child_descriptor;
+		return PendingDescriptor(child_descriptor, 0);
 
 	}
 
+	// Generate down the recursion, returning the descriptor of the current node
+	PendingDescriptor children[8];
+	for (int i = 0; i < 8; i++) {
+
+		// Get the child descriptor from the i'th to 8th subvoxel
+		children[i] = generate_children(v[i], voxel_scale / 2, octree);
+	}
+
+	return combine_children(children, octree);
+}
+
+PendingDescriptor Map::combine_children(const PendingDescriptor *children, Octree *octree) {
+
 	// Init a blank child descriptor for this node
 	uint64_t child_descriptor = 0;
-	
-	std::vector<uint64_t> descriptor_array;
-
-	// Generate down the recursion, returning the descriptor of the current node
-	for (int i = 0; i < v.size(); i++) {
 
-		uint64_t child = 0;
+	PendingDescriptor descriptor_array[8];
+	int descriptor_count = 0;
 
-		// Get the child descriptor from the i'th to 8th subvoxel
-		child = generate_children(v.at(i), voxel_scale / 2);
+	for (int i = 0; i < 8; i++) {
 
-		// =========== Debug ===========
-		PrettyPrintUINT64(child, &output_stream);
-		output_stream << "    " << voxel_scale << "    " << counter++ << std::endl;
-		// =============================
+		uint64_t child = children[i].descriptor;
 
 		// If the child is a leaf (contiguous) of non-valid values
 		if (IsLeaf(child) && !CheckLeafSign(child)) {
@@ -84,43 +98,246 @@ uint64_t Map::generate_children(sf::Vector3i pos, int voxel_scale) {
 
 			// Set the valid mask, and add it to the descriptor array
 			SetBit(i + 16, &child_descriptor);
-			descriptor_array.push_back(child);
+			descriptor_array[descriptor_count++] = children[i];
 		}
 	}
 
 	// Any free space between the child descriptors must be added here in order to 
 	// interlace them and allow the memory handler to work correctly.
 
-	// Copy the children to the stack and set the child_descriptors pointer to the correct value
-	child_descriptor |= a.copy_to_stack(descriptor_array);
+	// Copy the children to the stack. The child pointer gets encoded once
+	// our parent places this descriptor and we know which page it's on
+	uint64_t child_index = 0;
+	if (descriptor_count > 0)
+		child_index = octree->copy_to_stack(descriptor_array, descriptor_count);
 
 	// Free space may also be allocated here as well
 	
 	// Return the node up the stack
-	return child_descriptor;
+	return PendingDescriptor(child_descriptor, child_index);
 }
 
-void Map::generate_octree() {
+PendingDescriptor Map::generate_top_levels(sf::Vector3i pos, int voxel_scale, int level, int split_level, const std::vector<PendingDescriptor> &subtrees) {
 
-	// Launch the recursive generator at (0,0,0) as the first point
-	// and the octree dimension as the initial block size
-	uint64_t root_node = generate_children(sf::Vector3i(0, 0, 0), OCT_DIM/2);
-	uint64_t tmp = 0;
+	// Once we're down to the split level the subtree has already been built by a worker
+	if (level == split_level) {
+
+		int cell = dimension >> split_level;
+		int cells = 1 << split_level;
+
+		return subtrees.at(pos.x / cell + cells * (pos.y / cell + cells * (pos.z / cell)));
+	}
+
+	const sf::Vector3i v[8] = {
+		sf::Vector3i(pos.x      , pos.y      , pos.z),
+		sf::Vector3i(pos.x + voxel_scale, pos.y      , pos.z),
+		sf::Vector3i(pos.x      , pos.y + voxel_scale, pos.z),
+		sf::Vector3i(pos.x + voxel_scale, pos.y + voxel_scale, pos.z),
+		sf::Vector3i(pos.x      , pos.y      , pos.z + voxel_scale),
+		sf::Vector3i(pos.x + voxel_scale, pos.y      , pos.z + voxel_scale),
+		sf::Vector3i(pos.x      , pos.y + voxel_scale, pos.z + voxel_scale),
+		sf::Vector3i(pos.x + voxel_scale, pos.y + voxel_scale, pos.z + voxel_scale)
+	};
+
+	PendingDescriptor children[8];
+	for (int i = 0; i < 8; i++) {
+
+		children[i] = generate_top_levels(v[i], voxel_scale / 2, level + 1, split_level, subtrees);
+
+		// =========== Debug ===========
+		PrettyPrintUINT64(children[i].descriptor, &output_stream);
+		output_stream << "    " << voxel_scale << "    " << counter++ << std::endl;
+		// =============================
+	}
+
+	return combine_children(children, &a);
+}
+
+void Map::generate_octree(uint64_t page_size, unsigned int thread_count) {
+
+	// Start from an empty pool so the octree can be regenerated
+	a.clear(page_size);
+	a.oct_dimensions = dimension;
+
+	output_stream.str("");
+	counter = 0;
+
+	ThreadPool workers(thread_count);
+	thread_count = workers.get_thread_count();
+
+	// Split the top levels into 8^split_level subtrees, enough of them that the
+	// workers can balance out uneven subtrees. Each subtree has to be at least 2^3
+	int split_level = 0;
+	while ((1 << (3 * split_level)) < 4 * static_cast<int>(thread_count) && (dimension >> (split_level + 1)) >= 2)
+		split_level++;
+
+	int cell = dimension >> split_level;
+	int cells = 1 << split_level;
+	int subtree_count = cells * cells * cells;
+
+	std::vector<PendingDescriptor> subtrees(subtree_count);
+	std::vector<int> subtree_arena(subtree_count);
+
+	// Every worker builds into its own octree so there is no locking on the pool
+	std::vector<std::unique_ptr<Octree>> arenas;
+	for (unsigned int i = 0; i < thread_count; i++) {
+		arenas.emplace_back(new Octree());
+		arenas.back()->clear(page_size);
+	}
+
+	std::atomic<int> next_subtree(0);
+
+	workers.parallel_for(thread_count, [&](int arena) {
+
+		int i;
+		while ((i = next_subtree++) < subtree_count) {
+
+			sf::Vector3i pos(
+				(i % cells) * cell,
+				((i / cells) % cells) * cell,
+				(i / (cells * cells)) * cell
+			);
+
+			subtrees[i] = generate_children(pos, cell / 2, arenas[arena].get());
+			subtree_arena[i] = arena;
+		}
+	});
+
+	// Stitch the arenas onto the shared pool. Moving the pages shifts the global
+	// indices of everything in an arena, so rebase the subtree roots that pointed into it
+	for (int arena = 0; arena < static_cast<int>(thread_count); arena++) {
+
+		uint64_t offset = a.stitch(*arenas[arena]);
+
+		for (int i = 0; i < subtree_count; i++) {
+			if (subtree_arena[i] == arena && Octree::has_children(subtrees[i].descriptor))
+				subtrees[i].child_index += offset;
+		}
+	}
+
+	// And then finish the levels above the split on this thread
+	PendingDescriptor root_node = generate_top_levels(sf::Vector3i(0, 0, 0), dimension / 2, 0, split_level, subtrees);
 
 	// ========= DEBUG ==============
-	PrettyPrintUINT64(root_node, &output_stream);
-	output_stream << "    " << OCT_DIM << "    " << counter++ << std::endl;
+	PrettyPrintUINT64(root_node.descriptor, &output_stream);
+	output_stream << "    " << dimension << "    " << counter++ << std::endl;
 	// ==============================
 
-	a.root_index = a.copy_to_stack(std::vector<uint64_t>{root_node});
+	a.root_index = a.copy_to_stack(&root_node, 1);
+
+	std::cout << "Octree generated : " << a.bytes_used() << " bytes used, ";
+	std::cout << a.bytes_reserved() << " bytes reserved over " << a.pool.get_page_count() << " pages" << std::endl;
+
+	if (a.far_pointer_count > 0)
+		std::cout << a.far_pointer_count << " children are reached through far pointers" << std::endl;
 
 	// Dump the debug log
 	DumpLog(&output_stream, "raw_output.txt");
 
 }
 
+void Map::benchmark_octree_build() {
+
+	std::cout << "Octree build time vs thread count (" << dimension << "^3)" << std::endl;
+
+	unsigned int max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+	uint64_t page_size = a.pool.get_page_size();
+
+	// Powers of two, plus the actual core count if it isn't one
+	std::vector<unsigned int> thread_counts;
+	for (unsigned int threads = 1; threads < max_threads; threads *= 2)
+		thread_counts.push_back(threads);
+	thread_counts.push_back(max_threads);
+
+	sf::Clock timer;
+
+	for (unsigned int threads : thread_counts) {
+
+		timer.restart();
+		generate_octree(page_size, threads);
+
+		std::cout << "    " << threads << " threads : " << timer.restart().asMicroseconds() << " microseconds" << std::endl;
+	}
+}
+
 void Map::setVoxel(sf::Vector3i world_position, int val) {
 
+	int side = static_cast<int>(dimension);
+
+	if (world_position.x < 0 || world_position.x >= side ||
+		world_position.y < 0 || world_position.y >= side ||
+		world_position.z < 0 || world_position.z >= side)
+		return;
+
+	voxel_data[world_position.x + dimension * (world_position.y + dimension * world_position.z)] = val;
+	a.set_voxel(world_position, val != 0);
+}
+
+void Map::setVoxels(const std::vector<VoxelEdit> &edits) {
+
+	int side = static_cast<int>(dimension);
+
+	for (const VoxelEdit &edit : edits) {
+
+		sf::Vector3i pos = edit.position;
+		if (pos.x < 0 || pos.x >= side || pos.y < 0 || pos.y >= side || pos.z < 0 || pos.z >= side)
+			continue;
+
+		voxel_data[pos.x + dimension * (pos.y + dimension * pos.z)] = edit.solid ? 1 : 0;
+	}
+
+	a.set_voxels(edits);
+}
+
+bool Map::validate_edits(int edit_count) {
+
+	std::mt19937 rng(4242);
+	std::uniform_int_distribution<int> coord(0, dimension - 1);
+
+	sf::Clock timer;
+
+	// Single edits, a mix of sets and clears so groups get both allocated and released
+	uint64_t single_bytes_before = a.bytes_used();
+
+	timer.restart();
+	for (int i = 0; i < edit_count; i++)
+		setVoxel(sf::Vector3i(coord(rng), coord(rng), coord(rng)), i % 2);
+
+	std::cout << "Single edits : " << timer.restart().asMicroseconds() / std::max(edit_count, 1) << " microseconds per edit, ";
+	std::cout << single_bytes_before << " -> " << a.bytes_used() << " bytes" << std::endl;
+
+	bool valid = validate_octree();
+
+	// Carve out a solid block and then clear it again, that should collapse and un-collapse whole subtrees
+	std::vector<VoxelEdit> edits;
+	int block = std::max<int>(dimension / 4, 1);
+
+	for (int x = 0; x < block; x++) {
+		for (int y = 0; y < block; y++) {
+			for (int z = 0; z < block; z++)
+				edits.push_back(VoxelEdit(sf::Vector3i(x, y, z), true));
+		}
+	}
+
+	// And some scattered ones on top, including repeats of the block
+	for (int i = 0; i < edit_count; i++)
+		edits.push_back(VoxelEdit(sf::Vector3i(coord(rng), coord(rng), coord(rng)), (i % 3) == 0));
+
+	uint64_t bytes_before = a.bytes_used();
+
+	timer.restart();
+	setVoxels(edits);
+	std::cout << "Batched edits : " << edits.size() << " in " << timer.restart().asMicroseconds() << " microseconds, ";
+	std::cout << bytes_before << " -> " << a.bytes_used() << " bytes" << std::endl;
+
+	valid = validate_octree() && valid;
+
+	for (VoxelEdit &edit : edits)
+		edit.solid = false;
+
+	setVoxels(edits);
+
+	return validate_octree() && valid;
 }
 
 bool Map::getVoxelFromOctree(sf::Vector3i position)
@@ -130,20 +347,20 @@ bool Map::getVoxelFromOctree(sf::Vector3i position)
 
 bool Map::getVoxel(sf::Vector3i pos){
 
-	if (voxel_data[pos.x + OCT_DIM * (pos.y + OCT_DIM * pos.z)]) {
+	if (voxel_data[pos.x + dimension * (pos.y + dimension * pos.z)]) {
 		return true;
 	} else {
 		return false;
 	}
 }
 
-void Map::test_map() {
+bool Map::validate_octree() {
 
-	std::cout << "Validating map..." << std::endl;
+	int mismatches = 0;
 
-	for (int x = 0; x < OCT_DIM; x++) {
-		for (int y = 0; y < OCT_DIM; y++) {
-			for (int z = 0; z < OCT_DIM; z++) {
+	for (int x = 0; x < static_cast<int>(dimension); x++) {
+		for (int y = 0; y < static_cast<int>(dimension); y++) {
+			for (int z = 0; z < static_cast<int>(dimension); z++) {
 
 				sf::Vector3i pos(x, y, z);
 
@@ -152,45 +369,585 @@ void Map::test_map() {
 
 				if (arr1 != arr2) {
 					std::cout << "X: " << pos.x << "Y: " << pos.y << "Z: " << pos.z << std::endl;
+					mismatches++;
 				}
 
 			}
 		}
 	}
 
-	std::cout << "Done" << std::endl;
+	return mismatches == 0;
+}
+
+OctreeHit Map::cast_ray_reference(sf::Vector3f origin, sf::Vector3f direction) {
+
+	OctreeHit result;
+
+	float o[3] = { origin.x, origin.y, origin.z };
+	float d[3] = { direction.x, direction.y, direction.z };
+	float t_enter = 0.0f;
+	float t_exit = FLT_MAX;
+
+	// Clip the ray to the volume first so we can start stepping from inside it
+	for (int a = 0; a < 3; a++) {
+
+		if (fabs(d[a]) < 1e-7f) {
+			if (o[a] < 0 || o[a] >= dimension)
+				return result;
+			continue;
+		}
+
+		float t0 = (0 - o[a]) / d[a];
+		float t1 = (dimension - o[a]) / d[a];
+		t_enter = std::max(t_enter, std::min(t0, t1));
+		t_exit = std::min(t_exit, std::max(t0, t1));
+	}
+
+	if (t_enter >= t_exit)
+		return result;
+
+	// Andrew Woo's raycasting algo, one voxel at a time
+	int voxel[3], step[3];
+	float intersection_t[3], delta_t[3];
+	int face_axis = -1;
+
+	for (int a = 0; a < 3; a++) {
+
+		float p = o[a] + d[a] * t_enter;
+		voxel[a] = std::min(std::max(static_cast<int>(floor(p)), 0), static_cast<int>(dimension) - 1);
+		step[a] = (d[a] > 0) - (d[a] < 0);
+
+		if (step[a] == 0) {
+			intersection_t[a] = FLT_MAX;
+			delta_t[a] = FLT_MAX;
+		} else {
+			delta_t[a] = fabs(1.0f / d[a]);
+			intersection_t[a] = ((voxel[a] + (step[a] > 0 ? 1 : 0)) - o[a]) / d[a];
+		}
+
+		// Whichever axis we clipped on last is the face we came in through
+		if (t_enter > 0 && step[a] != 0 && fabs(t_enter - ((step[a] > 0 ? 0.0f : dimension) - o[a]) / d[a]) < 1e-5f)
+			face_axis = a;
+	}
+
+	float t = t_enter;
+
+	while (true) {
+
+		result.steps++;
+
+		if (voxel_data[voxel[0] + dimension * (voxel[1] + dimension * voxel[2])]) {
+
+			result.hit = true;
+			result.t = t;
+			result.voxel = sf::Vector3i(voxel[0], voxel[1], voxel[2]);
+
+			int face[3] = { 0, 0, 0 };
+			if (face_axis >= 0)
+				face[face_axis] = -step[face_axis];
+			result.face = sf::Vector3i(face[0], face[1], face[2]);
+
+			return result;
+		}
+
+		int axis = 0;
+		if (intersection_t[1] < intersection_t[axis]) axis = 1;
+		if (intersection_t[2] < intersection_t[axis]) axis = 2;
+
+		t = intersection_t[axis];
+		voxel[axis] += step[axis];
+		intersection_t[axis] += delta_t[axis];
+		face_axis = axis;
+
+		if (voxel[axis] < 0 || voxel[axis] >= static_cast<int>(dimension))
+			return result;
+	}
+}
+
+bool Map::validate_ray_casts(int ray_count) {
+
+	std::mt19937 rng(1337);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+	int mismatches = 0;
+	int octree_steps = 0;
+	int reference_steps = 0;
+
+	for (int i = 0; i < ray_count; i++) {
+
+		// Half the rays start inside the volume, the other half from outside of it
+		float spread = (i % 2) ? dimension * 0.5f : dimension * 1.5f;
+		sf::Vector3f origin(
+			dimension * 0.5f + unit(rng) * spread,
+			dimension * 0.5f + unit(rng) * spread,
+			dimension * 0.5f + unit(rng) * spread
+		);
+
+		// Aim somewhere inside the volume so most of them actually cross it
+		sf::Vector3f target(
+			(unit(rng) + 1.0f) * 0.5f * dimension,
+			(unit(rng) + 1.0f) * 0.5f * dimension,
+			(unit(rng) + 1.0f) * 0.5f * dimension
+		);
+
+		sf::Vector3f direction = target - origin;
+		float length = sqrt(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+		if (length < 1e-3f)
+			continue;
+		direction /= length;
+
+		OctreeHit octree_hit = a.cast_ray(origin, direction);
+		OctreeHit reference_hit = cast_ray_reference(origin, direction);
+
+		octree_steps += octree_hit.steps;
+		reference_steps += reference_hit.steps;
+
+		// The voxel can legitimately differ when the ray goes exactly through an edge,
+		// so only the distance has to agree
+		if (octree_hit.hit != reference_hit.hit ||
+			(octree_hit.hit && fabs(octree_hit.t - reference_hit.t) > 1e-3f)) {
+
+			std::cout << "Ray " << i << " : octree " << octree_hit.hit << " t " << octree_hit.t;
+			std::cout << ", reference " << reference_hit.hit << " t " << reference_hit.t << std::endl;
+			mismatches++;
+		}
+	}
+
+	std::cout << "Ray casts : " << octree_steps << " octree steps vs " << reference_steps << " voxel steps" << std::endl;
+
+	return mismatches == 0;
+}
+
+uint64_t Map::voxel_key() const {
+
+	uint64_t key = 0xCBF29CE484222325ull;
+
+	auto mix = [&](uint8_t byte) {
+		key ^= byte;
+		key *= 0x100000001B3ull;
+	};
+
+	for (int i = 0; i < 4; i++)
+		mix(static_cast<uint8_t>(dimension >> (8 * i)));
+
+	uint64_t voxel_count = (uint64_t)dimension * dimension * dimension;
+
+	for (uint64_t i = 0; i < voxel_count; i++)
+		mix(static_cast<uint8_t>(voxel_data[i]));
+
+	return key;
+}
+
+bool Map::validate_save_load(std::string path) {
 
 	sf::Clock timer;
-	
+
+	uint64_t key = voxel_key();
+
 	timer.restart();
+	if (!a.save(path, key))
+		return false;
 
-	for (int x = 0; x < OCT_DIM; x++) {
-		for (int y = 0; y < OCT_DIM; y++) {
-			for (int z = 0; z < OCT_DIM; z++) {
+	std::cout << "Octree save : " << timer.restart().asMicroseconds() << " microseconds" << std::endl;
 
-				sf::Vector3i pos(x, y, z);
+	if (!a.load(path, key))
+		return false;
 
-				bool arr1 = getVoxel(pos);
+	std::cout << "Octree load : " << timer.restart().asMicroseconds() << " microseconds" << std::endl;
+
+	bool valid = validate_octree();
+
+	// Edits on the mapped pages go to private copies, the file has to stay as it was
+	setVoxel(sf::Vector3i(0, 0, 0), !getVoxel(sf::Vector3i(0, 0, 0)));
+	valid = validate_octree() && valid;
+
+	Octree reloaded;
+	reloaded.load(path, key);
+	valid = (reloaded.get_voxel(sf::Vector3i(0, 0, 0)) != a.get_voxel(sf::Vector3i(0, 0, 0))) && valid;
+
+	// And it's turned down for any other map
+	Octree stale;
+	valid = !stale.load(path, key + 1) && valid;
+
+	setVoxel(sf::Vector3i(0, 0, 0), !getVoxel(sf::Vector3i(0, 0, 0)));
+
+	std::remove(path.c_str());
+
+	return valid;
+}
+
+bool Map::validate_brickmap(int edit_count) {
+
+	sf::Vector3i dimensions(dimension, dimension, dimension);
+	uint64_t voxel_count = (uint64_t)dimension * dimension * dimension;
+
+	sf::Clock timer;
+
+	BrickMap brickmap(dimensions);
+	brickmap.load_dense(voxel_data, dimensions);
+
+	std::cout << "Brickmap build : " << timer.restart().asMicroseconds() << " microseconds, "
+		<< brickmap.bricks_used() << " bricks, " << brickmap.bytes_used() << " bytes vs "
+		<< voxel_count << " dense" << std::endl;
+
+	bool valid = true;
+
+	for (uint64_t i = 0; i < voxel_count; i++) {
+		sf::Vector3i position(i % dimension, (i / dimension) % dimension, i / ((uint64_t)dimension * dimension));
+		valid = valid && brickmap.get_voxel(position) == voxel_data[i];
+	}
+
+	// Edits against a copy of the voxel data, clearing and filling whole bricks now and
+	// then so cells get collapsed and their bricks reused
+	std::vector<char> expected(voxel_data, voxel_data + voxel_count);
+	std::mt19937 rng(1);
+
+	for (int i = 0; i < edit_count; i++) {
+
+		sf::Vector3i origin(rng() % dimension, rng() % dimension, rng() % dimension);
+		char value = static_cast<char>(rng() % 2);
+		int size = i % 4 == 0 ? BRICK_DIM : 1;
+
+		origin = i % 4 == 0 ? origin / BRICK_DIM * BRICK_DIM : origin;
+
+		for (int z = origin.z; z < std::min(origin.z + size, (int)dimension); z++) {
+			for (int y = origin.y; y < std::min(origin.y + size, (int)dimension); y++) {
+				for (int x = origin.x; x < std::min(origin.x + size, (int)dimension); x++) {
+					brickmap.set_voxel(sf::Vector3i(x, y, z), value);
+					expected[x + dimension * (y + dimension * z)] = value;
+				}
 			}
 		}
 	}
 
-	std::cout << "Array linear xyz access : ";
-	std::cout << timer.restart().asMicroseconds() << " microseconds" << std::endl;
+	for (uint64_t i = 0; i < voxel_count; i++) {
+		sf::Vector3i position(i % dimension, (i / dimension) % dimension, i / ((uint64_t)dimension * dimension));
+		valid = valid && brickmap.get_voxel(position) == expected[i];
+	}
 
-	for (int x = 0; x < OCT_DIM; x++) {
-		for (int y = 0; y < OCT_DIM; y++) {
-			for (int z = 0; z < OCT_DIM; z++) {
+	std::cout << "Brickmap after " << edit_count << " edits : " << brickmap.bricks_used() << " bricks" << std::endl;
 
-				sf::Vector3i pos(x, y, z);
+	return valid;
+}
 
-				bool arr2 = getVoxelFromOctree(pos);
+bool Map::validate_occupancy(int box_count) {
+
+	sf::Vector3i dimensions(dimension, dimension, dimension);
+	uint64_t voxel_count = (uint64_t)dimension * dimension * dimension;
+
+	sf::Clock timer;
+
+	OccupancyGrid occupancy;
+	occupancy.generate(voxel_data, dimensions);
+
+	std::cout << "Occupancy build : " << timer.restart().asMicroseconds() << " microseconds, "
+		<< occupancy.words.size() * sizeof(uint64_t) << " bytes vs " << voxel_count << " dense" << std::endl;
+
+	bool valid = true;
+
+	for (uint64_t i = 0; i < voxel_count; i++) {
+		sf::Vector3i position(i % dimension, (i / dimension) % dimension, i / ((uint64_t)dimension * dimension));
+		valid = valid && occupancy.is_solid(position) == (voxel_data[i] != 0);
+	}
+
+	// Boxes from a voxel up to a quarter of the map, some hanging off of the edges
+	std::mt19937 rng(1);
+	std::vector<std::pair<sf::Vector3i, sf::Vector3i>> boxes;
+
+	for (int i = 0; i < box_count; i++) {
+		int size = 1 + rng() % std::max((int)dimension / 4, 1);
+		sf::Vector3i min(
+			(int)(rng() % dimension) - size / 2,
+			(int)(rng() % dimension) - size / 2,
+			(int)(rng() % dimension) - size / 2
+		);
+		boxes.push_back(std::make_pair(min, min + sf::Vector3i(size, size, size)));
+	}
+
+	std::vector<bool> bit_results;
+	timer.restart();
+
+	for (auto &box : boxes)
+		bit_results.push_back(occupancy.is_empty(box.first, box.second));
+
+	auto bit_time = timer.restart().asMicroseconds();
+
+	std::vector<bool> voxel_results;
+
+	for (auto &box : boxes) {
+
+		bool empty = true;
+
+		for (int z = std::max(box.first.z, 0); z <= std::min(box.second.z, (int)dimension - 1) && empty; z++) {
+			for (int y = std::max(box.first.y, 0); y <= std::min(box.second.y, (int)dimension - 1) && empty; y++) {
+				for (int x = std::max(box.first.x, 0); x <= std::min(box.second.x, (int)dimension - 1) && empty; x++)
+					empty = voxel_data[x + dimension * (y + dimension * z)] == 0;
+			}
+		}
+
+		voxel_results.push_back(empty);
+	}
+
+	auto voxel_time = timer.restart().asMicroseconds();
+
+	valid = valid && bit_results == voxel_results;
+
+	std::cout << box_count << " boxes : " << bit_time << " microseconds with the bits, "
+		<< voxel_time << " with the voxels" << std::endl;
+
+	return valid;
+}
+
+bool Map::validate_palette(int edit_count) {
+
+	uint64_t voxel_count = (uint64_t)dimension * dimension * dimension;
+
+	sf::Clock timer;
+
+	PalettedVoxels voxels;
+	voxels.load_dense(voxel_data, voxel_count);
+
+	std::cout << "Palette pack : " << timer.restart().asMicroseconds() << " microseconds, "
+		<< voxels.get_palette().size() << " materials at " << voxels.get_bits() << " bits, "
+		<< voxels.bytes_used() << " bytes vs " << voxel_count << " dense" << std::endl;
+
+	bool valid = true;
+
+	for (uint64_t i = 0; i < voxel_count; i++)
+		valid = valid && voxels.get(i) == voxel_data[i];
+
+	// Materials from a small pool first, then anything, so every width gets widened through
+	std::vector<char> expected(voxel_data, voxel_data + voxel_count);
+	std::mt19937 rng(1);
+
+	for (int i = 0; i < edit_count; i++) {
+
+		uint64_t index = rng() % voxel_count;
+		char value = static_cast<char>(i < edit_count / 2 ? rng() % 4 : rng() % 256);
+
+		voxels.set(index, value);
+		expected[index] = value;
+	}
+
+	std::vector<char> decoded(voxel_count);
+	voxels.decode(decoded.data());
+
+	valid = valid && decoded == expected;
+
+	std::cout << "Palette after " << edit_count << " edits : " << voxels.get_palette().size()
+		<< " materials at " << voxels.get_bits() << " bits" << std::endl;
+
+	return valid;
+}
+
+bool Map::benchmark_queries() {
+
+	uint64_t voxel_count = (uint64_t)dimension * dimension * dimension;
+
+	// Linear xyz, the friendliest order for both, and a shuffled copy of it which is
+	// what collision queries scattered around the map look like
+	std::vector<sf::Vector3i> linear;
+	linear.reserve(voxel_count);
+
+	for (int x = 0; x < static_cast<int>(dimension); x++) {
+		for (int y = 0; y < static_cast<int>(dimension); y++) {
+			for (int z = 0; z < static_cast<int>(dimension); z++)
+				linear.push_back(sf::Vector3i(x, y, z));
+		}
+	}
+
+	std::vector<sf::Vector3i> scattered = linear;
+	std::shuffle(scattered.begin(), scattered.end(), std::mt19937(99));
+
+	std::vector<uint8_t> results(voxel_count);
+	bool valid = true;
+
+	sf::Clock timer;
+
+	std::cout << "Query timings, " << voxel_count << " points (nanoseconds per query)" << std::endl;
+	std::cout << "    order        array    get_voxel    get_voxels" << std::endl;
+
+	for (int pass = 0; pass < 2; pass++) {
+
+		std::vector<sf::Vector3i> &points = pass == 0 ? linear : scattered;
+
+		// Sum the answers so the loops can't be thrown away
+		uint64_t checksum[3] = { 0, 0, 0 };
+		double nanoseconds[3];
+
+		timer.restart();
+		for (const sf::Vector3i &p : points)
+			checksum[0] += getVoxel(p);
+		nanoseconds[0] = timer.restart().asMicroseconds() * 1000.0 / voxel_count;
+
+		for (const sf::Vector3i &p : points)
+			checksum[1] += getVoxelFromOctree(p);
+		nanoseconds[1] = timer.restart().asMicroseconds() * 1000.0 / voxel_count;
+
+		a.get_voxels(points.data(), results.data(), points.size());
+		nanoseconds[2] = timer.restart().asMicroseconds() * 1000.0 / voxel_count;
+
+		for (uint64_t i = 0; i < voxel_count; i++) {
+
+			checksum[2] += results[i];
+
+			if (results[i] != getVoxel(points[i])) {
+				std::cout << "X: " << points[i].x << "Y: " << points[i].y << "Z: " << points[i].z << std::endl;
+				valid = false;
 			}
 		}
+
+		valid = valid && checksum[0] == checksum[1] && checksum[1] == checksum[2];
+
+		std::cout << "    " << (pass == 0 ? "linear   " : "scattered") << "    ";
+		std::cout << nanoseconds[0] << "    " << nanoseconds[1] << "    " << nanoseconds[2] << std::endl;
 	}
 
-	std::cout << "Octree linear xyz access : ";
-	std::cout << timer.restart().asMicroseconds() << " microseconds" << std::endl;
+	return valid;
+}
+
+bool Map::benchmark_layouts() {
+
+	uint64_t page_size = a.pool.get_page_size();
+
+	// Scattered point queries and random rays, the same set for every layout
+	std::mt19937 rng(2024);
+	std::uniform_int_distribution<int> coord(0, dimension - 1);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	const int query_count = 1 << 20;
+	const int ray_count = 1 << 16;
+
+	std::vector<sf::Vector3i> points(query_count);
+	for (sf::Vector3i &p : points)
+		p = sf::Vector3i(coord(rng), coord(rng), coord(rng));
+
+	std::vector<std::pair<sf::Vector3f, sf::Vector3f>> rays(ray_count);
+	for (auto &ray : rays) {
+
+		sf::Vector3f origin(unit(rng) * dimension, unit(rng) * dimension, unit(rng) * dimension);
+		sf::Vector3f direction(unit(rng) - 0.5f, unit(rng) - 0.5f, unit(rng) - 0.5f);
+		direction /= std::max(sqrt(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z), 1e-3f);
+
+		ray = std::make_pair(origin, direction);
+	}
+
+	std::vector<uint8_t> results(query_count);
+	bool valid = true;
+	sf::Clock timer;
+
+	std::cout << "Pool layout timings (nanoseconds per query / ray)" << std::endl;
+	std::cout << "    layout           get_voxel    get_voxels    cast_ray" << std::endl;
+
+	const char *names[3] = { "depth first  ", "breadth first", "van emde boas" };
+
+	for (int layout = 0; layout < 3; layout++) {
+
+		generate_octree(page_size);
+
+		if (layout == 1)
+			a.relayout(OctreeLayout::BREADTH_FIRST);
+		else if (layout == 2)
+			a.relayout(OctreeLayout::VAN_EMDE_BOAS);
+
+		valid = validate_octree() && valid;
+
+		uint64_t checksum = 0;
+		double nanoseconds[3];
+
+		timer.restart();
+		for (const sf::Vector3i &p : points)
+			checksum += getVoxelFromOctree(p);
+		nanoseconds[0] = timer.restart().asMicroseconds() * 1000.0 / query_count;
+
+		a.get_voxels(points.data(), results.data(), points.size());
+		nanoseconds[1] = timer.restart().asMicroseconds() * 1000.0 / query_count;
+
+		for (auto &ray : rays)
+			checksum += a.cast_ray(ray.first, ray.second).steps;
+		nanoseconds[2] = timer.restart().asMicroseconds() * 1000.0 / ray_count;
+
+		std::cout << "    " << names[layout] << "    " << nanoseconds[0] << "    " << nanoseconds[1] << "    " << nanoseconds[2];
+		std::cout << "    (" << checksum << ")" << std::endl;
+	}
+
+	return valid;
+}
+
+void Map::test_map() {
+
+	std::cout << "Validating map..." << std::endl;
+	validate_octree();
+	std::cout << "Done" << std::endl;
+
+	// Rebuild with tiny pages so most of the children end up on another page
+	// than their parent and have to go through a far pointer
+	std::cout << "Validating far pointers..." << std::endl;
+
+	uint64_t page_size = a.pool.get_page_size();
+	generate_octree(64);
+
+	if (a.far_pointer_count == 0)
+		std::cout << "No far pointers were generated" << std::endl;
+	else if (validate_octree())
+		std::cout << "Done" << std::endl;
+
+	// Compress into a DAG and make sure lookups still agree with the array
+	std::cout << "Validating DAG..." << std::endl;
+
+	uint64_t tree_bytes = a.bytes_used();
+	double ratio = a.compress_to_dag();
+
+	std::cout << "DAG compression : " << tree_bytes << " -> " << a.bytes_used() << " bytes, ratio " << ratio << std::endl;
+
+	if (validate_octree())
+		std::cout << "Done" << std::endl;
+
+	// Edits on a dag have to copy the shared groups they touch instead of writing over them
+	std::cout << "Validating DAG edits..." << std::endl;
+	if (validate_edits(1000))
+		std::cout << "Done" << std::endl;
+
+	// And on the far pointer tree, where moved groups can end up on other pages
+	generate_octree(64);
+	std::cout << "Validating far pointer edits..." << std::endl;
+	if (validate_edits(1000))
+		std::cout << "Done" << std::endl;
+
+	generate_octree(page_size);
+
+	std::cout << "Validating edits..." << std::endl;
+	if (validate_edits(1000))
+		std::cout << "Done" << std::endl;
+
+	std::cout << "Validating save and load..." << std::endl;
+	if (validate_save_load("octree_test.svo"))
+		std::cout << "Done" << std::endl;
+
+	// Cast random rays through the octree and check them against stepping the array
+	std::cout << "Validating ray casts..." << std::endl;
+	if (validate_ray_casts(10000))
+		std::cout << "Done" << std::endl;
+
+	std::cout << "Validating batched queries..." << std::endl;
+	if (benchmark_queries())
+		std::cout << "Done" << std::endl;
+
+	std::cout << "Validating pool layouts..." << std::endl;
+	if (benchmark_layouts())
+		std::cout << "Done" << std::endl;
+
+	std::cout << "Validating brickmap..." << std::endl;
+	if (validate_brickmap(1000))
+		std::cout << "Done" << std::endl;
+
+	std::cout << "Validating occupancy..." << std::endl;
+	if (validate_occupancy(1000))
+		std::cout << "Done" << std::endl;
+
+	std::cout << "Validating palette..." << std::endl;
+	if (validate_palette(1000))
+		std::cout << "Done" << std::endl;
 
 }
 
@@ -0,0 +1,156 @@
+#include "map/Occupancy.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <functional>
+
+void OccupancyGrid::generate(const char *voxel_data, sf::Vector3i dimensions, ThreadPool *workers) {
+
+	auto parallel_for = [workers](int count, std::function<void(int)> function) {
+		if (workers != nullptr) {
+			workers->parallel_for(count, function);
+		}
+		else {
+			for (int i = 0; i < count; i++)
+				function(i);
+		}
+	};
+
+	block_dimensions = dimensions / OCCUPANCY_BLOCK;
+	summary_dimensions = sf::Vector3i(
+		(block_dimensions.x + OCCUPANCY_BLOCK - 1) / OCCUPANCY_BLOCK,
+		(block_dimensions.y + OCCUPANCY_BLOCK - 1) / OCCUPANCY_BLOCK,
+		(block_dimensions.z + OCCUPANCY_BLOCK - 1) / OCCUPANCY_BLOCK
+	);
+
+	words.assign(static_cast<size_t>(block_dimensions.x) * block_dimensions.y * block_dimensions.z, 0);
+	summary.assign(static_cast<size_t>(summary_dimensions.x) * summary_dimensions.y * summary_dimensions.z, 0);
+
+	// A slice of blocks per task, so no two tasks ever write to the same word
+	parallel_for(block_dimensions.z, [&](int bz) {
+		for (int z = bz * OCCUPANCY_BLOCK; z < (bz + 1) * OCCUPANCY_BLOCK; z++) {
+			for (int y = 0; y < dimensions.y; y++) {
+
+				const char *row = voxel_data + dimensions.x * (y + dimensions.y * z);
+				uint64_t *block_row = &words[block_dimensions.x * (y / OCCUPANCY_BLOCK + block_dimensions.y * bz)];
+
+				for (int x = 0; x < dimensions.x; x++) {
+					if (row[x] != 0)
+						block_row[x / OCCUPANCY_BLOCK] |= 1ull << bit_index(sf::Vector3i(x, y, z));
+				}
+			}
+		}
+	});
+
+	// Summary words each cover 4^3 blocks, a slice of them per task
+	parallel_for(summary_dimensions.z, [&](int sz) {
+		for (int bz = sz * OCCUPANCY_BLOCK; bz < std::min((sz + 1) * OCCUPANCY_BLOCK, block_dimensions.z); bz++) {
+			for (int by = 0; by < block_dimensions.y; by++) {
+				for (int bx = 0; bx < block_dimensions.x; bx++) {
+
+					if (words[bx + block_dimensions.x * (by + block_dimensions.y * bz)] == 0)
+						continue;
+
+					sf::Vector3i block(bx, by, bz);
+					summary[bx / OCCUPANCY_BLOCK + summary_dimensions.x * (by / OCCUPANCY_BLOCK + summary_dimensions.y * sz)] |= 1ull << bit_index(block);
+				}
+			}
+		}
+	});
+}
+
+bool OccupancyGrid::is_solid(sf::Vector3i position) const {
+
+	sf::Vector3i block = position / OCCUPANCY_BLOCK;
+
+	if (position.x < 0 || position.y < 0 || position.z < 0 ||
+		block.x >= block_dimensions.x || block.y >= block_dimensions.y || block.z >= block_dimensions.z)
+		return false;
+
+	uint64_t word = words[block.x + block_dimensions.x * (block.y + block_dimensions.y * block.z)];
+
+	return (word >> bit_index(position)) & 1;
+}
+
+void OccupancyGrid::set_solid(sf::Vector3i position, bool solid) {
+
+	sf::Vector3i block = position / OCCUPANCY_BLOCK;
+
+	if (position.x < 0 || position.y < 0 || position.z < 0 ||
+		block.x >= block_dimensions.x || block.y >= block_dimensions.y || block.z >= block_dimensions.z)
+		return;
+
+	uint64_t &word = words[block.x + block_dimensions.x * (block.y + block_dimensions.y * block.z)];
+
+	if (solid)
+		word |= 1ull << bit_index(position);
+	else
+		word &= ~(1ull << bit_index(position));
+
+	sf::Vector3i summary_position = block / OCCUPANCY_BLOCK;
+	uint64_t &summary_word = summary[summary_position.x + summary_dimensions.x * (summary_position.y + summary_dimensions.y * summary_position.z)];
+
+	if (word != 0)
+		summary_word |= 1ull << bit_index(block);
+	else
+		summary_word &= ~(1ull << bit_index(block));
+}
+
+bool OccupancyGrid::is_empty(sf::Vector3i min, sf::Vector3i max) const {
+
+	sf::Vector3i dimensions = block_dimensions * OCCUPANCY_BLOCK;
+
+	min = sf::Vector3i(std::max(min.x, 0), std::max(min.y, 0), std::max(min.z, 0));
+	max = sf::Vector3i(std::min(max.x, dimensions.x - 1), std::min(max.y, dimensions.y - 1), std::min(max.z, dimensions.z - 1));
+
+	if (min.x > max.x || min.y > max.y || min.z > max.z)
+		return true;
+
+	sf::Vector3i block_min = min / OCCUPANCY_BLOCK;
+	sf::Vector3i block_max = max / OCCUPANCY_BLOCK;
+	sf::Vector3i summary_min = block_min / OCCUPANCY_BLOCK;
+	sf::Vector3i summary_max = block_max / OCCUPANCY_BLOCK;
+
+	for (int sz = summary_min.z; sz <= summary_max.z; sz++) {
+		for (int sy = summary_min.y; sy <= summary_max.y; sy++) {
+			for (int sx = summary_min.x; sx <= summary_max.x; sx++) {
+
+				// Nothing at all in these 16^3 voxels, on to the next word
+				uint64_t summary_word = summary[sx + summary_dimensions.x * (sy + summary_dimensions.y * sz)];
+				if (summary_word == 0)
+					continue;
+
+				for (int bz = std::max(block_min.z, sz * OCCUPANCY_BLOCK); bz <= std::min(block_max.z, sz * OCCUPANCY_BLOCK + 3); bz++) {
+					for (int by = std::max(block_min.y, sy * OCCUPANCY_BLOCK); by <= std::min(block_max.y, sy * OCCUPANCY_BLOCK + 3); by++) {
+						for (int bx = std::max(block_min.x, sx * OCCUPANCY_BLOCK); bx <= std::min(block_max.x, sx * OCCUPANCY_BLOCK + 3); bx++) {
+
+							if (((summary_word >> bit_index(sf::Vector3i(bx, by, bz))) & 1) == 0)
+								continue;
+
+							uint64_t word = words[bx + block_dimensions.x * (by + block_dimensions.y * bz)];
+
+							// Mask off the part of the block that's outside of the box
+							sf::Vector3i low(std::max(min.x - bx * OCCUPANCY_BLOCK, 0), std::max(min.y - by * OCCUPANCY_BLOCK, 0), std::max(min.z - bz * OCCUPANCY_BLOCK, 0));
+							sf::Vector3i high(std::min(max.x - bx * OCCUPANCY_BLOCK, 3), std::min(max.y - by * OCCUPANCY_BLOCK, 3), std::min(max.z - bz * OCCUPANCY_BLOCK, 3));
+
+							// Four bits to a row, four rows to a layer
+							uint64_t row = (0xFull >> (3 - high.x + low.x)) << low.x;
+
+							uint64_t layer = 0;
+							for (int y = low.y; y <= high.y; y++)
+								layer |= row << (OCCUPANCY_BLOCK * y);
+
+							uint64_t mask = 0;
+							for (int z = low.z; z <= high.z; z++)
+								mask |= layer << (OCCUPANCY_BLOCK * OCCUPANCY_BLOCK * z);
+
+							if (word & mask)
+								return false;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	return true;
+}
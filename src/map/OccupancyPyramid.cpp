@@ -0,0 +1,101 @@
+#include "map/OccupancyPyramid.h"
+#include "ThreadPool.h"
+#include <functional>
+
+void OccupancyPyramid::generate(const OccupancyGrid &occupancy, ThreadPool *workers) {
+
+	auto parallel_for = [workers](int count, std::function<void(int)> function) {
+		if (workers != nullptr) {
+			workers->parallel_for(count, function);
+		}
+		else {
+			for (int i = 0; i < count; i++)
+				function(i);
+		}
+	};
+
+	sf::Vector3i dimensions = occupancy.block_dimensions * OCCUPANCY_BLOCK;
+
+	levels = 0;
+	level_offsets.assign(1, 0);
+	level_dimensions.assign(1, dimensions);
+
+	size_t cell_count = 0;
+
+	for (int level = 1; level <= MAX_MIP_LEVELS; level++) {
+
+		int side = 1 << level;
+
+		if (dimensions.x % side != 0 || dimensions.y % side != 0 || dimensions.z % side != 0)
+			break;
+
+		levels = level;
+		level_offsets.push_back(cell_count);
+		level_dimensions.push_back(dimensions / side);
+
+		cell_count += static_cast<size_t>(dimensions.x / side) * (dimensions.y / side) * (dimensions.z / side);
+	}
+
+	flags.assign(cell_count, 0);
+
+	// Each level only needs the one under it, a z slice of cells per task
+	for (int level = 1; level <= levels; level++) {
+
+		sf::Vector3i level_dimension = level_dimensions[level];
+
+		parallel_for(level_dimension.z, [&](int z) {
+			for (int y = 0; y < level_dimension.y; y++) {
+				for (int x = 0; x < level_dimension.x; x++) {
+					sf::Vector3i cell(x, y, z);
+					flags[cell_index(level, cell)] = reduce(occupancy, level, cell);
+				}
+			}
+		});
+	}
+}
+
+void OccupancyPyramid::update(const OccupancyGrid &occupancy, sf::Vector3i position) {
+
+	for (int level = 1; level <= levels; level++) {
+
+		sf::Vector3i cell(position.x >> level, position.y >> level, position.z >> level);
+		uint8_t &flag = flags[cell_index(level, cell)];
+		uint8_t value = reduce(occupancy, level, cell);
+
+		if (flag == value)
+			return;
+
+		flag = value;
+	}
+}
+
+uint8_t OccupancyPyramid::reduce(const OccupancyGrid &occupancy, int level, sf::Vector3i cell) const {
+
+	if (level == 1) {
+
+		// A 2^3 cell is an octant of its 4^3 block's word
+		sf::Vector3i block = cell / 2;
+		uint64_t word = occupancy.words[block.x + occupancy.block_dimensions.x * (block.y + static_cast<size_t>(occupancy.block_dimensions.y) * block.z)];
+
+		uint64_t mask = 0;
+		for (int z = 0; z < 2; z++) {
+			for (int y = 0; y < 2; y++) {
+				for (int x = 0; x < 2; x++)
+					mask |= 1ull << OccupancyGrid::bit_index(cell * 2 + sf::Vector3i(x, y, z));
+			}
+		}
+
+		return (word & mask) != 0;
+	}
+
+	for (int z = 0; z < 2; z++) {
+		for (int y = 0; y < 2; y++) {
+			for (int x = 0; x < 2; x++) {
+				if (flags[cell_index(level - 1, cell * 2 + sf::Vector3i(x, y, z))] != 0)
+					return 1;
+			}
+		}
+	}
+
+	return 0;
+}
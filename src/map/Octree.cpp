@@ -1,36 +1,329 @@
 #include "map/Octree.h"
+#include <algorithm>
+#include <fstream>
+#include <cstring>
 
 Octree::Octree() {
 
-	// initialize the first stack block
+}
+
+uint64_t Octree::copy_to_stack(std::vector<PendingDescriptor> children) {
+	return copy_to_stack(children.data(), static_cast<int>(children.size()));
+}
+
+uint64_t Octree::copy_to_stack(const PendingDescriptor *children, int count) {
+
+	uint64_t group_size = count;
+
+	// Count the children that would end up out of reach of the 15 bit pointer if
+	// the group was placed on the given page
+	auto count_far = [&](uint64_t page) {
+		uint64_t far_count = 0;
+		for (int i = 0; i < count; i++) {
+			if (has_children(children[i].descriptor) && pool.page_of(children[i].child_index) != page)
+				far_count++;
+		}
+		return far_count;
+	};
+
+	uint64_t position = 0;
+	uint64_t far_count = 0;
+	bool reused = false;
+
+	// Edits release runs back to the pool, take one if it fits exactly. How many far
+	// slots the group needs depends on the page, so check each run length against its own page
+	for (uint64_t run = group_size; run <= group_size + count && !reused; run++) {
+
+		uint64_t page;
+		if (pool.has_released(run, page) && group_size + count_far(page) == run) {
+			position = pool.allocate_released(run);
+			far_count = run - group_size;
+			reused = true;
+		}
+	}
+
+	if (!reused) {
+
+		// Far pointers need a slot on the same page as the group. If the group plus its
+		// far slots don't fit we tip over onto a fresh page, which means recounting as
+		// everything the group points to is now on an older page
+		uint64_t page = pool.next_page(group_size);
+		far_count = count_far(page);
+
+		if (pool.next_page(group_size + far_count) != page) {
+			page = pool.next_page(group_size + far_count);
+			far_count = count_far(page);
+		}
+
+		// The pool makes sure the whole group and its far slots land on a single page
+		position = pool.allocate(group_size + far_count);
+	}
+
+	// Far slots are packed in right after the siblings
+	uint64_t far_position = position + group_size;
 
-	for (int i = 0; i < 0x8000; i++) {
-		blob[i] = 0;
+	for (int i = 0; i < count; i++) {
+
+		uint64_t descriptor = children[i].descriptor;
+
+		// Only valid non-leaf octs have children to point to
+		if (has_children(descriptor)) {
+
+			uint64_t child_index = children[i].child_index;
+
+			if (pool.page_of(child_index) == pool.page_of(position + i)) {
+				// Near, the pointer is the childs position on our page
+				descriptor |= pool.page_offset(child_index) & child_pointer_mask;
+			}
+			else {
+				// Far, the pointer is the position of a far slot on our page which
+				// holds the global index of the children. And then set the far bit
+				pool[far_position] = child_index;
+				descriptor |= pool.page_offset(far_position) & child_pointer_mask;
+				descriptor |= far_bit_mask;
+				far_slots.push_back(far_position);
+				far_position++;
+				far_pointer_count++;
+			}
+		}
+
+		pool[position + i] = descriptor;
 	}
+
+	return position;
+}
+
+uint64_t Octree::stitch(Octree &subtree) {
+
+	uint64_t offset = pool.adopt(subtree.pool);
+
+	// Near pointers are page relative and survive the move, far slots hold
+	// global indices into the subtree's old pool so they need shifting
+	for (uint64_t far_slot : subtree.far_slots) {
+		pool[far_slot + offset] += offset;
+		far_slots.push_back(far_slot + offset);
+	}
+
+	far_pointer_count += subtree.far_pointer_count;
+
+	subtree.clear();
+
+	return offset;
+}
+
+void Octree::clear(uint64_t page_size) {
+
+	if (page_size != 0)
+		pool.set_page_size(page_size);
+	else
+		pool.clear();
+
+	root_index = 0;
+	far_pointer_count = 0;
+	far_slots.clear();
+	is_dag = false;
+	dag_compression_ratio = 1.0;
+	dag_compressed_bytes = 0;
+	dag_replaced_bytes = 0;
 }
 
-uint64_t Octree::copy_to_stack(std::vector<uint64_t> children) {
+double Octree::compress_to_dag() {
+
+	uint64_t bytes_before = bytes_used();
+
+	// Build the dag into a fresh pool with the same page size
+	Octree dag;
+	dag.clear(pool.get_page_size());
+
+	std::unordered_map<std::vector<uint64_t>, uint64_t, GroupHasher> groups;
+	std::unordered_map<uint64_t, uint64_t> copied;
+
+	// The root is a group of one like every other
+	uint64_t dag_root = dedupe_group(dag, root_index, 1, groups, copied);
+
+	// Swap the dag in, with our pool emptied the stitch offset is 0
+	uint64_t page_size = pool.get_page_size();
+	clear(page_size);
+	uint64_t offset = stitch(dag);
+
+	root_index = dag_root + offset;
+	is_dag = true;
+	dag_compression_ratio = static_cast<double>(bytes_before) / std::max<uint64_t>(bytes_used(), 1);
+	dag_compressed_bytes = bytes_used();
+
+	return dag_compression_ratio;
+}
 
-	// Check for the 15 bit boundry		
-	if (stack_pos - children.size() > stack_pos) {
-		global_pos = stack_pos;
-		stack_pos = 0x8000;
+void Octree::relayout(OctreeLayout layout) {
+
+	// Work out the order with groups as (index, size) pairs. The root is a group of one
+	std::vector<std::pair<uint64_t, int>> order;
+
+	if (layout == OctreeLayout::BREADTH_FIRST) {
+
+		order.push_back(std::make_pair(root_index, 1));
+
+		for (size_t i = 0; i < order.size(); i++)
+			groups_at_depth(order[i].first, order[i].second, 1, order);
 	}
 	else {
-		stack_pos -= children.size();
+
+		// Height of the group tree, the root plus one level per halving down to scale 1
+		int height = 1;
+		for (int size = oct_dimensions; size > 2; size /= 2)
+			height++;
+
+		layout_van_emde_boas(root_index, 1, height, order);
+	}
+
+	Octree target;
+	target.clear(pool.get_page_size());
+	target.oct_dimensions = oct_dimensions;
+	target.is_dag = is_dag;
+
+	std::unordered_map<uint64_t, uint64_t> moved;
+
+	// Children before parents, so walk the order backwards
+	for (auto group = order.rbegin(); group != order.rend(); ++group)
+		relayout_group(target, group->first, group->second, moved);
+
+	uint64_t new_root = moved.at(root_index);
+	bool dag = is_dag;
+	double ratio = dag_compression_ratio;
+
+	clear(pool.get_page_size());
+	uint64_t offset = stitch(target);
+
+	root_index = new_root + offset;
+	is_dag = dag;
+	dag_compression_ratio = ratio;
+
+	// Only what's reachable got copied, so the edits' leftovers are gone too
+	dag_compressed_bytes = dag ? bytes_used() : 0;
+}
+
+void Octree::layout_van_emde_boas(uint64_t group_index, int group_size, int height, std::vector<std::pair<uint64_t, int>> &order) {
+
+	if (height == 1) {
+		order.push_back(std::make_pair(group_index, group_size));
+		return;
 	}
 
-	// Check for the far bit
+	// Top half first, then every subtree hanging off the bottom of it
+	int top = height / 2;
 
-	memcpy(&blob[stack_pos + global_pos], children.data(), children.size() * sizeof(uint64_t));
+	layout_van_emde_boas(group_index, group_size, top, order);
 
-	// Return the bitmask encoding the index of that value
-	// If we tripped the far bit, allocate a far index to the stack and place
-	// it at the bottom of the child_descriptor node level array
-	// And then shift the far bit to 1
+	std::vector<std::pair<uint64_t, int>> bottom;
+	groups_at_depth(group_index, group_size, top, bottom);
 
-	// If not, shift the index to its correct place
-	return stack_pos;
+	for (auto &group : bottom)
+		layout_van_emde_boas(group.first, group.second, height - top, order);
+}
+
+void Octree::groups_at_depth(uint64_t group_index, int group_size, int depth, std::vector<std::pair<uint64_t, int>> &groups) {
+
+	for (int i = 0; i < group_size; i++) {
+
+		uint64_t descriptor = pool[group_index + i];
+		if (!has_children(descriptor))
+			continue;
+
+		uint64_t child_index = get_child_index(descriptor, group_index + i);
+
+		if (depth == 1)
+			groups.push_back(std::make_pair(child_index, child_count(descriptor)));
+		else
+			groups_at_depth(child_index, child_count(descriptor), depth - 1, groups);
+	}
+}
+
+uint64_t Octree::relayout_group(Octree &target, uint64_t group_index, int group_size, std::unordered_map<uint64_t, uint64_t> &moved) {
+
+	// Shared dag groups show up more than once
+	auto existing = moved.find(group_index);
+	if (existing != moved.end())
+		return existing->second;
+
+	PendingDescriptor group[8];
+
+	for (int i = 0; i < group_size; i++) {
+
+		uint64_t descriptor = pool[group_index + i];
+
+		uint64_t child_index = 0;
+		if (has_children(descriptor)) {
+
+			// In a tree the children were always copied first, in a dag a group can come
+			// up in the order before one of its parents' other children
+			child_index = relayout_group(target, get_child_index(descriptor, group_index + i), child_count(descriptor), moved);
+		}
+
+		group[i] = PendingDescriptor(descriptor & ~(child_pointer_mask | far_bit_mask), child_index);
+	}
+
+	uint64_t new_index = target.copy_to_stack(group, group_size);
+	moved.emplace(group_index, new_index);
+
+	return new_index;
+}
+
+uint64_t Octree::dedupe_group(Octree &dag, uint64_t group_index, int count,
+	std::unordered_map<std::vector<uint64_t>, uint64_t, GroupHasher> &groups,
+	std::unordered_map<uint64_t, uint64_t> &copied) {
+
+	// Compressing a dag again, this group's been reached through another parent
+	auto done = copied.find(group_index);
+	if (done != copied.end())
+		return done->second;
+
+	PendingDescriptor group[8];
+
+	// The group is identified by its masks plus the dag index of each child group.
+	// Since we go bottom-up, identical subtrees have already collapsed into the same
+	// dag index by the time their parents get hashed
+	std::vector<uint64_t> key(count * 2);
+
+	for (int i = 0; i < count; i++) {
+
+		uint64_t descriptor = pool[group_index + i];
+		uint64_t masks = descriptor & ~(child_pointer_mask | far_bit_mask);
+
+		uint64_t child_index = 0;
+		if (has_children(descriptor)) {
+			child_index = dedupe_group(
+				dag, get_child_index(descriptor, group_index + i), child_count(descriptor), groups, copied
+			);
+		}
+
+		group[i] = PendingDescriptor(masks, child_index);
+		key[i * 2] = masks;
+		key[i * 2 + 1] = child_index;
+	}
+
+	auto existing = groups.find(key);
+	if (existing != groups.end()) {
+		copied.emplace(group_index, existing->second);
+		return existing->second;
+	}
+
+	uint64_t dag_index = dag.copy_to_stack(group, count);
+	groups.emplace(std::move(key), dag_index);
+	copied.emplace(group_index, dag_index);
+
+	return dag_index;
+}
+
+uint64_t Octree::get_child_index(uint64_t descriptor, uint64_t descriptor_index) {
+
+	// Child pointers are relative to the start of the page the descriptor is on
+	uint64_t index = pool.page_base(descriptor_index) + (descriptor & child_pointer_mask);
+
+	// Check for the far bit, if set we were pointed at a far slot holding the real index
+	if (descriptor & far_bit_mask)
+		index = pool[index];
+
+	return index;
 }
 
 bool Octree::get_voxel(sf::Vector3i position) {
@@ -39,11 +332,12 @@ bool Octree::get_voxel(sf::Vector3i position) {
 	oct_state state;
 
 	// push the root node to the parent stack
-	uint64_t head = blob[root_index];
+	uint64_t head_index = root_index;
+	uint64_t head = pool[head_index];
 	state.parent_stack[state.parent_stack_position] = head;
 
 	// Set our initial dimension and the position at the corner of the oct to keep track of our position
-	int dimension = OCT_DIM;
+	int dimension = oct_dimensions;
 	sf::Vector3i quad_position(0, 0, 0);
 
 	// While we are not at the required resolution
@@ -110,13 +404,14 @@ bool Octree::get_voxel(sf::Vector3i position) {
 			state.scale++;
 			dimension /= 2;
 
-			// Count the number of valid octs that come before and add it to the index to get the position
-			// Negate it by one as it counts itself
-			int count = count_bits((uint8_t)(head >> 16) & count_mask_8[mask_index]) - 1;
+			// Count the number of stored octs that come before and add it to the index to get the position.
+			// Edits can collapse children into solid leaves, those are valid but have nothing stored
+			int count = child_offset(head, mask_index);
 
 			// access the element at which head points to and then add the specified number of indices
 			// to get to the correct child descriptor
-			head = blob[(head & child_pointer_mask) + count];
+			head_index = get_child_index(head, head_index) + count;
+			head = pool[head_index];
 
 			// Increment the parent stack position and put the new oct node as the parent
 			state.parent_stack_position++;
@@ -138,14 +433,592 @@ bool Octree::get_voxel(sf::Vector3i position) {
 	return true;
 }
 
-void Octree::print_block(int block_pos) {
+void Octree::get_voxels(const sf::Vector3i *positions, uint8_t *results, size_t count) {
+
+	for (size_t batch = 0; batch < count; batch += OCT_BATCH_LANES) {
+
+		int lanes = static_cast<int>(std::min<size_t>(OCT_BATCH_LANES, count - batch));
+
+		uint32_t x[OCT_BATCH_LANES], y[OCT_BATCH_LANES], z[OCT_BATCH_LANES];
+		uint64_t node[OCT_BATCH_LANES];
+		uint64_t descriptor[OCT_BATCH_LANES];
+
+		// The valid mask in the low byte and the leaf mask in the next, 32 bit lanes so the
+		// mask loop doesn't need 64 bit shifts the vector units don't have
+		uint32_t masks[OCT_BATCH_LANES];
+		uint32_t active[OCT_BATCH_LANES];
+		uint32_t solid[OCT_BATCH_LANES];
+
+		for (int i = 0; i < OCT_BATCH_LANES; i++) {
+
+			// Pad the last batch with a lane that's already done
+			sf::Vector3i p = i < lanes ? positions[batch + i] : sf::Vector3i(-1, -1, -1);
+
+			uint8_t inside = (p.x >= 0) & (p.x < oct_dimensions) &
+				(p.y >= 0) & (p.y < oct_dimensions) &
+				(p.z >= 0) & (p.z < oct_dimensions);
+
+			// Outside lanes still read the root, just with their coordinates zeroed
+			x[i] = inside ? p.x : 0;
+			y[i] = inside ? p.y : 0;
+			z[i] = inside ? p.z : 0;
+
+			node[i] = root_index;
+			descriptor[i] = pool[root_index];
+			masks[i] = static_cast<uint32_t>(descriptor[i] >> 16) & 0xFFFF;
+			active[i] = inside;
+			solid[i] = 0;
+		}
+
+		// The volume is a power of two and octs are aligned to their size, so the bit of
+		// the coordinate at the current half size says which side of the split it's on
+		for (uint32_t half = oct_dimensions / 2; half > 0; half /= 2) {
+
+			uint32_t any_active = 0;
+			uint32_t offset[OCT_BATCH_LANES];
+
+			// The masks first, straight arithmetic over the lanes with no loads or branches
+			// so it can go in vector registers
+			for (int i = 0; i < OCT_BATCH_LANES; i++) {
+
+				// 1 << idx, built with constant shifts since the variable ones don't vectorize
+				uint32_t bit = (x[i] & half) != 0 ? 2 : 1;
+				bit = (y[i] & half) != 0 ? bit << 2 : bit;
+				bit = (z[i] & half) != 0 ? bit << 4 : bit;
+
+				uint32_t valid_mask = masks[i] & 0xFF;
+				uint32_t leaf_mask = masks[i] >> 8;
+
+				uint32_t valid = (valid_mask & bit) != 0;
+				uint32_t leaf = (leaf_mask & bit) != 0;
+
+				// valid & leaf is solid, !valid is empty, either way the lane is done
+				solid[i] |= active[i] & valid & leaf;
+				active[i] &= valid & (leaf ^ 1);
+				any_active |= active[i];
+
+				// The stored children before this one. It's only 8 bits, counted with shifts
+				// rather than __builtin_popcount, which is a library call without -mpopcnt
+				uint32_t before = valid_mask & ~leaf_mask & (bit - 1);
+				before = before - ((before >> 1) & 0x55);
+				before = (before & 0x33) + ((before >> 2) & 0x33);
+				offset[i] = (before + (before >> 4)) & 0x0F;
+			}
+
+			// Then the child pointers, a load per lane through the page table.
+			// Child pointers are page relative, and through a far slot if the far bit is set.
+			// Lanes that are done still compute an index on their own page, it just never gets used.
+			// Far pointers are rare enough that branching on them beats always loading the slot
+			for (int i = 0; i < OCT_BATCH_LANES; i++) {
+
+				uint64_t child = pool.page_base(node[i]) + (descriptor[i] & child_pointer_mask);
+				if (descriptor[i] & far_bit_mask)
+					child = pool[child];
+
+				node[i] = active[i] ? child + offset[i] : node[i];
+			}
+
+			if (!any_active)
+				break;
+
+			for (int i = 0; i < OCT_BATCH_LANES; i++) {
+				descriptor[i] = pool[node[i]];
+				masks[i] = static_cast<uint32_t>(descriptor[i] >> 16) & 0xFFFF;
+			}
+		}
+
+		for (int i = 0; i < lanes; i++)
+			results[batch + i] = solid[i];
+	}
+}
+
+OctreeHit Octree::cast_ray(sf::Vector3f origin, sf::Vector3f direction, float max_t) {
+
+	OctreeHit result;
+
+	float dimension = static_cast<float>(oct_dimensions);
+
+	// Mirror the ray so it travels in the positive direction on every axis. That way
+	// the children of a node are always visited in increasing idx order and advancing
+	// is just setting the bit of the axis we exit through. The octant mask flips the
+	// mirrored idx back to the real one when we read the masks
+	float o[3] = { origin.x, origin.y, origin.z };
+	float d[3] = { direction.x, direction.y, direction.z };
+	float inv[3];
+	uint8_t octant_mask = 0;
+
+	for (int a = 0; a < 3; a++) {
+
+		if (d[a] < 0.0f) {
+			o[a] = dimension - o[a];
+			d[a] = -d[a];
+			octant_mask |= 1 << a;
+		}
+
+		// Axis aligned rays never cross the planes of that axis
+		inv[a] = d[a] > 1e-7f ? 1.0f / d[a] : 1e30f;
+	}
+
+	// t of the min and max planes of a node on each axis
+	auto planes_t = [&](const int *position, int size, float *t0, float *t1) {
+		for (int a = 0; a < 3; a++) {
+			t0[a] = (position[a] - o[a]) * inv[a];
+			t1[a] = (position[a] + size - o[a]) * inv[a];
+		}
+	};
+
+	float t0[3], t1[3];
+	int node_position[3] = { 0, 0, 0 };
+	int size = oct_dimensions;
+
+	// Clip the ray against the root
+	planes_t(node_position, size, t0, t1);
+	float t_enter = std::max(std::max(t0[0], t0[1]), std::max(t0[2], 0.0f));
+	float t_exit = std::min(std::min(t1[0], t1[1]), t1[2]);
+
+	if (t_enter >= t_exit || t_enter > max_t)
+		return result;
+
+	// Pick the child of the current node that the ray is in at time t
+	auto first_child = [&](float t) {
+		uint8_t idx = 0;
+		int half = size / 2;
+		for (int a = 0; a < 3; a++) {
+			if (t >= (node_position[a] + half - o[a]) * inv[a])
+				idx |= 1 << a;
+		}
+		return idx;
+	};
+
+	oct_state state;
+
+	uint64_t node_index = root_index;
+	uint64_t descriptor = pool[node_index];
+	uint8_t idx = first_child(t_enter);
+
+	while (true) {
+
+		result.steps++;
+
+		int half = size / 2;
+		int child_position[3] = {
+			node_position[0] + ((idx & idx_set_x_mask) ? half : 0),
+			node_position[1] + ((idx & idx_set_y_mask) ? half : 0),
+			node_position[2] + ((idx & idx_set_z_mask) ? half : 0)
+		};
+
+		planes_t(child_position, half, t0, t1);
+		float child_enter = std::max(std::max(t0[0], t0[1]), std::max(t0[2], 0.0f));
+		float child_exit = std::min(std::min(t1[0], t1[1]), t1[2]);
+
+		if (child_enter > max_t)
+			return result;
+
+		uint8_t real_idx = idx ^ octant_mask;
+		bool valid = ((descriptor >> 16) & mask_8[real_idx]) != 0;
+		bool leaf = ((descriptor >> 24) & mask_8[real_idx]) != 0;
+
+		// Rays that clip an edge can get a child with an empty interval, step over it
+		if (valid && child_enter <= child_exit) {
+
+			if (leaf) {
+
+				result.hit = true;
+				result.t = child_enter;
+
+				// Face we came in through is the axis whose plane we crossed last
+				int axis = 0;
+				if (t0[1] > t0[axis]) axis = 1;
+				if (t0[2] > t0[axis]) axis = 2;
+
+				// The normal of that face points back against the un-mirrored direction.
+				// Rays that start inside the voxel didn't come through a face at all
+				int face[3] = { 0, 0, 0 };
+				if (t0[axis] > 0.0f)
+					face[axis] = (octant_mask & (1 << axis)) ? 1 : -1;
+
+				result.face = sf::Vector3i(face[0], face[1], face[2]);
+
+				// Un-mirror the leaf's bounds and find the voxel in it that the ray entered
+				float hit_point[3] = {
+					origin.x + direction.x * result.t,
+					origin.y + direction.y * result.t,
+					origin.z + direction.z * result.t
+				};
+
+				int voxel[3];
+				for (int a = 0; a < 3; a++) {
+
+					int low = (octant_mask & (1 << a)) ? oct_dimensions - (child_position[a] + half) : child_position[a];
+					int v = static_cast<int>(floor(hit_point[a]));
+					voxel[a] = std::min(std::max(v, low), low + half - 1);
+				}
+
+				result.voxel = sf::Vector3i(voxel[0], voxel[1], voxel[2]);
+				return result;
+			}
+
+			// PUSH, valid non-leaf so descend and start on the first child the ray is in
+			state.parent_stack[state.scale] = node_index;
+			state.idx_stack[state.scale] = idx;
+			state.scale++;
+
+			node_index = get_child_index(descriptor, node_index) + child_offset(descriptor, real_idx);
+			descriptor = pool[node_index];
+
+			node_position[0] = child_position[0];
+			node_position[1] = child_position[1];
+			node_position[2] = child_position[2];
+			size = half;
+
+			idx = first_child(child_enter);
+			continue;
+		}
+
+		// ADVANCE, step to the sibling across whichever plane the ray exits through first.
+		// If we are already on the far side of that axis, the ray leaves the parent too
+		// and we POP up until there is a sibling to step into
+		while (true) {
+
+			int axis = 0;
+			if (t1[1] < t1[axis]) axis = 1;
+			if (t1[2] < t1[axis]) axis = 2;
+
+			if (!(idx & (1 << axis))) {
+				idx |= 1 << axis;
+				break;
+			}
+
+			// Left the root, nothing was hit
+			if (state.scale == 0)
+				return result;
+
+			state.scale--;
+			idx = state.idx_stack[state.scale];
+			node_index = state.parent_stack[state.scale];
+			descriptor = pool[node_index];
+
+			// The node we were in becomes the child again, step the position back up to the parent's
+			node_position[0] -= (idx & idx_set_x_mask) ? size : 0;
+			node_position[1] -= (idx & idx_set_y_mask) ? size : 0;
+			node_position[2] -= (idx & idx_set_z_mask) ? size : 0;
+			size *= 2;
+
+			int popped_position[3] = {
+				node_position[0] + ((idx & idx_set_x_mask) ? size / 2 : 0),
+				node_position[1] + ((idx & idx_set_y_mask) ? size / 2 : 0),
+				node_position[2] + ((idx & idx_set_z_mask) ? size / 2 : 0)
+			};
+
+			planes_t(popped_position, size / 2, t0, t1);
+		}
+	}
+}
+
+void Octree::set_voxel(sf::Vector3i position, bool solid) {
+	set_voxels(std::vector<VoxelEdit>(1, VoxelEdit(position, solid)));
+}
+
+void Octree::set_voxels(std::vector<VoxelEdit> edits) {
+
+	// Drop anything outside of the volume
+	edits.erase(std::remove_if(edits.begin(), edits.end(), [this](const VoxelEdit &edit) {
+		return edit.position.x < 0 || edit.position.x >= oct_dimensions ||
+			edit.position.y < 0 || edit.position.y >= oct_dimensions ||
+			edit.position.z < 0 || edit.position.z >= oct_dimensions;
+	}), edits.end());
+
+	if (edits.empty())
+		return;
+
+	uint64_t old_root = pool[root_index];
+	uint64_t old_children = has_children(old_root) ? get_child_index(old_root, root_index) : 0;
+
+	PendingDescriptor root = edit_node(
+		PendingDescriptor(old_root & ~(child_pointer_mask | far_bit_mask), old_children),
+		sf::Vector3i(0, 0, 0), oct_dimensions, edits.data(), static_cast<int>(edits.size())
+	);
+
+	// If the root still points at the same children just swap the masks in, otherwise
+	// the root gets re-placed like any other group of one
+	bool same_children = !has_children(root.descriptor) ||
+		(has_children(old_root) && root.child_index == old_children);
+
+	if (same_children && !is_dag) {
+		pool[root_index] = root.descriptor | (old_root & (child_pointer_mask | far_bit_mask));
+	}
+	else {
+		if (!is_dag)
+			release_group(root_index, 1);
+		else
+			dag_replaced_bytes += sizeof(uint64_t);
+
+		root_index = copy_to_stack(&root, 1);
+	}
+
+	// Collect what the edits left behind. Keep the ratio from the first compression, the
+	// pool it would be measured against now is mostly those copies
+	if (is_dag && dag_replaced_bytes > dag_compressed_bytes * DAG_REPLACED_LIMIT) {
+		double ratio = dag_compression_ratio;
+		compress_to_dag();
+		dag_compression_ratio = ratio;
+	}
+}
+
+PendingDescriptor Octree::edit_node(PendingDescriptor node, sf::Vector3i node_position, int size, VoxelEdit *edits, int count) {
+
+	uint64_t descriptor = node.descriptor;
+
+	// Scale 1, the valid mask is the voxels themselves
+	if (size == 2) {
+
+		for (int i = 0; i < count; i++) {
+
+			sf::Vector3i local = edits[i].position - node_position;
+			int idx = local.x | (local.y << 1) | (local.z << 2);
+
+			if (edits[i].solid)
+				descriptor |= (uint64_t)mask_8[idx] << 16;
+			else
+				descriptor &= ~((uint64_t)mask_8[idx] << 16);
+		}
+
+		return PendingDescriptor(descriptor, 0);
+	}
+
+	int half = size / 2;
+
+	// Bucket the edits by child, keeping their order so the last edit to a voxel wins
+	VoxelEdit *bucket_start[9];
+	bucket_start[0] = edits;
+	bucket_start[8] = edits + count;
+
+	bucket_start[4] = std::stable_partition(edits, edits + count, [&](const VoxelEdit &e) { return e.position.z < node_position.z + half; });
+
+	for (int z = 0; z < 2; z++) {
+
+		bucket_start[z * 4 + 2] = std::stable_partition(bucket_start[z * 4], bucket_start[z * 4 + 4], [&](const VoxelEdit &e) { return e.position.y < node_position.y + half; });
+
+		for (int y = 0; y < 2; y++) {
+			int b = z * 4 + y * 2;
+			bucket_start[b + 1] = std::stable_partition(bucket_start[b], bucket_start[b + 2], [&](const VoxelEdit &e) { return e.position.x < node_position.x + half; });
+		}
+	}
+
+	uint8_t old_stored = (descriptor >> 16) & ~(descriptor >> 24) & 0xFF;
+
+	// Pull out the current children in pending form
+	PendingDescriptor children[8];
+	bool changed[8] = {};
+
+	for (int idx = 0; idx < 8; idx++) {
+
+		uint64_t bit = mask_8[idx];
+
+		if (old_stored & bit) {
+			uint64_t slot = node.child_index + child_offset(descriptor, idx);
+			uint64_t child = pool[slot];
+			children[idx] = PendingDescriptor(
+				child & ~(child_pointer_mask | far_bit_mask),
+				has_children(child) ? get_child_index(child, slot) : 0
+			);
+		}
+		else {
+			// Leaves get expanded into a node whose children are all that leaf
+			bool solid = (descriptor >> 16) & bit;
+			children[idx] = PendingDescriptor(leaf_mask | (solid ? valid_mask : 0), 0);
+		}
+	}
+
+	uint64_t new_descriptor = descriptor & ~(valid_mask | leaf_mask);
+
+	for (int idx = 0; idx < 8; idx++) {
+
+		int edit_count = static_cast<int>(bucket_start[idx + 1] - bucket_start[idx]);
+
+		if (edit_count > 0) {
+
+			sf::Vector3i child_position(
+				node_position.x + ((idx & idx_set_x_mask) ? half : 0),
+				node_position.y + ((idx & idx_set_y_mask) ? half : 0),
+				node_position.z + ((idx & idx_set_z_mask) ? half : 0)
+			);
+
+			children[idx] = edit_node(children[idx], child_position, half, bucket_start[idx], edit_count);
+			changed[idx] = true;
+		}
+
+		uint64_t child_valid = (children[idx].descriptor >> 16) & 0xFF;
+		uint64_t child_leaf = (children[idx].descriptor >> 24) & 0xFF;
+
+		// Collapse uniform children into a leaf
+		if (child_valid == 0) {
+			new_descriptor |= (uint64_t)mask_8[idx] << 24;
+		}
+		else if (child_valid == 0xFF && child_leaf == 0xFF) {
+			new_descriptor |= (uint64_t)mask_8[idx] << 16;
+			new_descriptor |= (uint64_t)mask_8[idx] << 24;
+		}
+		else {
+			new_descriptor |= (uint64_t)mask_8[idx] << 16;
+		}
+	}
+
+	uint8_t new_stored = (new_descriptor >> 16) & ~(new_descriptor >> 24) & 0xFF;
+
+	// Same children stored as before, so the group can stay where it is as long as
+	// none of their own child pointers moved
+	bool in_place = !is_dag && new_stored == old_stored && new_stored != 0;
+
+	for (int idx = 0; idx < 8 && in_place; idx++) {
+
+		if (!(new_stored & mask_8[idx]) || !changed[idx] || !has_children(children[idx].descriptor))
+			continue;
+
+		uint64_t child = pool[node.child_index + child_offset(descriptor, idx)];
+		if (!has_children(child) || get_child_index(child, node.child_index + child_offset(descriptor, idx)) != children[idx].child_index)
+			in_place = false;
+	}
+
+	if (in_place) {
+
+		for (int idx = 0; idx < 8; idx++) {
+
+			if (!(new_stored & mask_8[idx]) || !changed[idx])
+				continue;
+
+			// Keep the pointer bits, even if the child has nothing left to point to they
+			// still say whether a far slot was allocated after the group
+			uint64_t &slot = pool[node.child_index + child_offset(new_descriptor, idx)];
+			slot = children[idx].descriptor | (slot & (child_pointer_mask | far_bit_mask));
+		}
+
+		return PendingDescriptor(new_descriptor, node.child_index);
+	}
+
+	// The old group is about to be replaced. In a dag it may be shared so leave it be,
+	// set_voxels collects them once there's enough
+	if (old_stored != 0 && !is_dag)
+		release_group(node.child_index, count_bits(old_stored));
+	else if (old_stored != 0)
+		dag_replaced_bytes += count_bits(old_stored) * sizeof(uint64_t);
+
+	if (new_stored == 0)
+		return PendingDescriptor(new_descriptor, 0);
+
+	PendingDescriptor group[8];
+	int group_size = 0;
+
+	for (int idx = 0; idx < 8; idx++) {
+		if (new_stored & mask_8[idx])
+			group[group_size++] = children[idx];
+	}
+
+	return PendingDescriptor(new_descriptor, copy_to_stack(group, group_size));
+}
+
+void Octree::release_group(uint64_t group_index, int group_size) {
+
+	// Far slots were packed in after the siblings, one per far bit
+	int far_count = 0;
+	for (int i = 0; i < group_size; i++) {
+		if (pool[group_index + i] & far_bit_mask)
+			far_count++;
+	}
+
+	far_pointer_count -= std::min<uint64_t>(far_pointer_count, far_count);
+
+	pool.release(group_index, group_size + far_count);
+}
+
+bool Octree::save(std::string path, uint64_t source_key) {
+
+	std::ofstream output_file(path, std::ofstream::binary | std::ofstream::out | std::ofstream::trunc);
+
+	if (!output_file.is_open()) {
+		std::cout << "Couldn't open " << path << " to save the octree" << std::endl;
+		return false;
+	}
+
+	OctreeFileHeader header;
+	header.page_size = pool.get_page_size();
+	header.page_count = pool.get_page_count();
+	header.stack_pos = pool.get_stack_pos();
+	header.slots_used = pool.bytes_used() / sizeof(uint64_t);
+	header.root_index = root_index;
+	header.far_pointer_count = far_pointer_count;
+	header.dimension = oct_dimensions;
+	header.is_dag = is_dag;
+	header.source_key = source_key;
+
+	while ((1u << header.depth) < header.dimension)
+		header.depth++;
+
+	// Pad the header out so the pages start aligned
+	std::vector<char> header_block(OCTREE_FILE_ALIGNMENT, 0);
+	memcpy(header_block.data(), &header, sizeof(header));
+
+	output_file.write(header_block.data(), header_block.size());
+	pool.write_pages(output_file);
+
+	return output_file.good();
+}
+
+bool Octree::load(std::string path, uint64_t source_key) {
+
+	clear();
+
+	std::ifstream input_file(path, std::ios::binary | std::ios::in);
+
+	if (!input_file.is_open())
+		return false;
+
+	OctreeFileHeader header;
+	input_file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	input_file.close();
+
+	if (memcmp(header.magic, OctreeFileHeader().magic, sizeof(header.magic)) != 0 ||
+		header.version != OCTREE_FILE_VERSION ||
+		header.header_size != OCTREE_FILE_ALIGNMENT ||
+		header.page_size == 0 || header.page_size > 0x8000 ||
+		(header.page_size & (header.page_size - 1)) != 0) {
+
+		std::cout << path << " isn't an octree this version can read" << std::endl;
+		return false;
+	}
+
+	if (header.source_key != source_key) {
+		std::cout << path << " was built from a different map, not using it" << std::endl;
+		return false;
+	}
+
+	pool.set_page_size(header.page_size);
+
+	if (!pool.map_pages(path, header.header_size, header.page_count, header.stack_pos, header.slots_used))
+		return false;
+
+	root_index = header.root_index;
+	far_pointer_count = header.far_pointer_count;
+	oct_dimensions = header.dimension;
+	is_dag = header.is_dag != 0;
+	dag_compressed_bytes = is_dag ? bytes_used() : 0;
+	dag_replaced_bytes = 0;
+
+	return true;
+}
+
+void Octree::print_block(int page) {
+
+	if (page < 0 || page >= static_cast<int>(pool.get_page_count()))
+		return;
+
+	uint64_t *block = pool.get_page(page);
 
 	std::stringstream sss;
-	for (int i = block_pos; i < (int)pow(2, 15); i++) {
-		PrettyPrintUINT64(blob[i], &sss);
+	for (int i = 0; i < (int)pool.get_page_size(); i++) {
+		PrettyPrintUINT64(block[i], &sss);
 		sss << "\n";
 	}
 	DumpLog(&sss, "raw_data.txt");
 
 }
-
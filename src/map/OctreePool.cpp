@@ -0,0 +1,282 @@
+#include "map/OctreePool.h"
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+OctreePool::OctreePool(uint64_t page_size) {
+	set_page_size(page_size);
+}
+
+OctreePool::~OctreePool() {
+	clear();
+}
+
+void OctreePool::set_page_size(uint64_t page_size) {
+
+	clear();
+
+	// The pointers in the child descriptors are 15 bits, they can't see past 0x8000
+	if (page_size == 0 || page_size > 0x8000 || (page_size & (page_size - 1)) != 0) {
+		std::cout << "OctreePool page size must be a power of two <= 0x8000" << std::endl;
+		abort();
+	}
+
+	this->page_size = page_size;
+
+	page_shift = 0;
+	while (((uint64_t)1 << page_shift) < page_size)
+		page_shift++;
+
+	page_mask = page_size - 1;
+}
+
+uint64_t OctreePool::next_page(uint64_t count) const {
+
+	if (pages.empty() || count > stack_pos)
+		return pages.size();
+
+	return pages.size() - 1;
+}
+
+uint64_t OctreePool::allocate(uint64_t count) {
+
+	if (count > page_size) {
+		std::cout << "OctreePool can't fit an allocation of " << count << " slots on a page" << std::endl;
+		abort();
+	}
+
+	// Check for the page boundary
+	if (pages.empty() || count > stack_pos)
+		add_page();
+
+	stack_pos -= count;
+	slots_used += count;
+
+	return ((pages.size() - 1) << page_shift) + stack_pos;
+}
+
+void OctreePool::release(uint64_t index, uint64_t count) {
+
+	if (count == 0)
+		return;
+
+	for (uint64_t i = 0; i < count; i++)
+		(*this)[index + i] = 0;
+
+	if (released.size() <= count)
+		released.resize(count + 1);
+
+	released[count].push_back(index);
+	slots_used -= count;
+}
+
+bool OctreePool::has_released(uint64_t count, uint64_t &page) const {
+
+	if (count >= released.size() || released[count].empty())
+		return false;
+
+	page = page_of(released[count].back());
+	return true;
+}
+
+uint64_t OctreePool::allocate_released(uint64_t count) {
+
+	uint64_t index = released.at(count).back();
+	released[count].pop_back();
+	slots_used += count;
+
+	return index;
+}
+
+uint64_t OctreePool::adopt(OctreePool &other) {
+
+	if (other.page_size != page_size) {
+		std::cout << "OctreePool can't adopt pages of a different size" << std::endl;
+		abort();
+	}
+
+	// Mapped pages can't change owners, the mapping is torn down as a whole
+	if (other.mapping != nullptr) {
+		std::cout << "OctreePool can't adopt pages from a mapped file" << std::endl;
+		abort();
+	}
+
+	uint64_t offset = pages.size() << page_shift;
+
+	if (other.pages.empty())
+		return offset;
+
+	pages.insert(pages.end(), other.pages.begin(), other.pages.end());
+
+	// Keep allocating from wherever the other pool left off on its last page
+	stack_pos = other.stack_pos;
+	slots_used += other.slots_used;
+
+	// Any runs the other pool had released are still free after the move
+	if (released.size() < other.released.size())
+		released.resize(other.released.size());
+
+	for (uint64_t count = 0; count < other.released.size(); count++) {
+		for (uint64_t index : other.released[count])
+			released[count].push_back(index + offset);
+	}
+
+	other.pages.clear();
+	other.released.clear();
+	other.stack_pos = 0;
+	other.slots_used = 0;
+
+	return offset;
+}
+
+void OctreePool::write_pages(std::ostream &stream) const {
+
+	for (uint64_t *page : pages)
+		stream.write(reinterpret_cast<const char*>(page), page_size * sizeof(uint64_t));
+}
+
+bool OctreePool::map_pages(const std::string &path, uint64_t offset, uint64_t page_count, uint64_t stack_pos, uint64_t slots_used) {
+
+	clear();
+
+	uint64_t size = offset + page_count * page_size * sizeof(uint64_t);
+
+#ifdef _WIN32
+
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		std::cout << "Couldn't open " << path << " for mapping" << std::endl;
+		return false;
+	}
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || (uint64_t)file_size.QuadPart < size) {
+		std::cout << path << " is smaller than its header says" << std::endl;
+		CloseHandle(file);
+		return false;
+	}
+
+	// Copy on write, edits go to our own copy of the page and never back to the file
+	HANDLE mapping_object = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	void *view = mapping_object ? MapViewOfFile(mapping_object, FILE_MAP_COPY, 0, 0, 0) : nullptr;
+
+	if (view == nullptr) {
+		std::cout << "Couldn't map " << path << std::endl;
+		if (mapping_object)
+			CloseHandle(mapping_object);
+		CloseHandle(file);
+		return false;
+	}
+
+	file_handle = file;
+	mapping_handle = mapping_object;
+
+#else
+
+	int file = open(path.c_str(), O_RDONLY);
+	if (file < 0) {
+		std::cout << "Couldn't open " << path << " for mapping" << std::endl;
+		return false;
+	}
+
+	struct stat file_stat;
+	if (fstat(file, &file_stat) != 0 || (uint64_t)file_stat.st_size < size) {
+		std::cout << path << " is smaller than its header says" << std::endl;
+		close(file);
+		return false;
+	}
+
+	// Copy on write, edits go to our own copy of the page and never back to the file
+	void *view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+
+	// The mapping keeps its own reference to the file
+	close(file);
+
+	if (view == MAP_FAILED) {
+		std::cout << "Couldn't map " << path << std::endl;
+		return false;
+	}
+
+#endif
+
+	mapping = view;
+	mapping_size = size;
+	mapped_page_count = page_count;
+
+	uint64_t *first_page = reinterpret_cast<uint64_t*>(static_cast<char*>(view) + offset);
+	for (uint64_t i = 0; i < page_count; i++)
+		pages.push_back(first_page + i * page_size);
+
+	this->stack_pos = page_count > 0 ? stack_pos : 0;
+	this->slots_used = slots_used;
+
+	return true;
+}
+
+const uint64_t* OctreePool::contiguous_pages() const {
+
+	if (pages.empty() || pages.size() != mapped_page_count)
+		return nullptr;
+
+	return pages[0];
+}
+
+void OctreePool::unmap() {
+
+	if (mapping == nullptr)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(mapping);
+	CloseHandle(static_cast<HANDLE>(mapping_handle));
+	CloseHandle(static_cast<HANDLE>(file_handle));
+#else
+	munmap(mapping, mapping_size);
+#endif
+
+	mapping = nullptr;
+	mapping_size = 0;
+	mapped_page_count = 0;
+	file_handle = nullptr;
+	mapping_handle = nullptr;
+}
+
+void OctreePool::flatten(std::vector<uint64_t> &out) const {
+
+	out.resize(pages.size() * page_size);
+
+	for (uint64_t i = 0; i < pages.size(); i++)
+		memcpy(out.data() + i * page_size, pages[i], page_size * sizeof(uint64_t));
+}
+
+void OctreePool::clear() {
+
+	// Mapped pages belong to the mapping, only the ones added since came off the heap
+	for (uint64_t i = mapped_page_count; i < pages.size(); i++)
+		delete[] pages[i];
+
+	unmap();
+
+	pages.clear();
+	released.clear();
+	stack_pos = 0;
+	slots_used = 0;
+}
+
+void OctreePool::add_page() {
+
+	uint64_t *page = new uint64_t[page_size];
+	memset(page, 0, page_size * sizeof(uint64_t));
+
+	pages.push_back(page);
+	stack_pos = page_size;
+}
@@ -4,23 +4,51 @@
 #include "util.hpp"
 #include <map/Old_Map.h>
 #include <algorithm>
-
-Old_Map::Old_Map(sf::Vector3i dim) {
+#include <cstring>
+#include <chrono>
+#include "ThreadPool.h"
+#include "map/DistanceField.h"
+#include "map/VoxFile.h"
+#include <fstream>
+#include <atomic>
+#include <cstdio>
+
+Old_Map::Old_Map(sf::Vector3i dim, MAP_LAYOUTS layout) {
 	dimensions = dim;
+
+	bool power_of_two_cube = dim.x == dim.y && dim.y == dim.z && dim.x <= 1024 && (dim.x & (dim.x - 1)) == 0;
+
+	if (layout == MORTON_LAYOUT && !power_of_two_cube) {
+		std::cout << "Morton layout needs a power of two cube, falling back to linear" << std::endl;
+		layout = LINEAR_LAYOUT;
+	}
+
+	// Paletted is for chunks only
+	this->layout = layout == MORTON_LAYOUT ? MORTON_LAYOUT : LINEAR_LAYOUT;
 }
 
 
 Old_Map::~Old_Map() {
 }
 
-void generate_at(int x, int y, std::vector<std::vector<int>> *grid) {
+// Streams the generator draws from, the diamond square passes use 2 per side length above these
+enum TERRAIN_STREAMS {
+	CORNER_STREAM = 0,
+	MAZE_STREAM = 1,
+	PASS_STREAM = 2
+};
+
+void generate_at(int x, int y, std::vector<std::vector<int>> *grid, uint64_t seed, uint64_t *counter) {
 
 	size_t x_bound = grid->size();
 	size_t y_bound = grid->at(0).size();
 
 	//					   N  S  E  W
 	std::vector<int> t = { 1, 2, 3, 4 };
-	std::random_shuffle(t.begin(), t.end());
+
+	// Fisher-Yates by hand, std::shuffle is free to differ between standard libraries
+	for (int i = static_cast<int>(t.size()) - 1; i > 0; i--)
+		std::swap(t[i], t[terrain_hash(seed, MAZE_STREAM, (*counter)++) % (i + 1)]);
 
 	while (t.size() > 0) {
 
@@ -31,7 +59,7 @@ void generate_at(int x, int y, std::vector<std::vector<int>> *grid) {
 			if (y + 1 < y_bound && grid->at(x).at(y + 1) == 0) {
 				grid->at(x).at(y) = 1;
 				grid->at(x).at(y + 1) = 2;
-				generate_at(x, y + 1, grid);
+				generate_at(x, y + 1, grid, seed, counter);
 			}
 			break;
 		}
@@ -39,7 +67,7 @@ void generate_at(int x, int y, std::vector<std::vector<int>> *grid) {
 			if (y - 1 >= 0 && grid->at(x).at(y - 1) == 0) {
 				grid->at(x).at(y) = 2;
 				grid->at(x).at(y - 1) = 1;
-				generate_at(x, y - 1, grid);
+				generate_at(x, y - 1, grid, seed, counter);
 			}
 			break;
 		}
@@ -47,7 +75,7 @@ void generate_at(int x, int y, std::vector<std::vector<int>> *grid) {
 			if (x + 1 < x_bound && grid->at(x+1).at(y) == 0) {
 				grid->at(x).at(y) = 3;
 				grid->at(x + 1).at(y) = 4;
-				generate_at(x + 1, y, grid);
+				generate_at(x + 1, y, grid, seed, counter);
 			}
 			break;
 		}
@@ -55,7 +83,7 @@ void generate_at(int x, int y, std::vector<std::vector<int>> *grid) {
 			if (x - 1 >= 0 && grid->at(x-1).at(y) == 0) {
 				grid->at(x).at(y) = 4;
 				grid->at(x - 1).at(y) = 3;
-				generate_at(x - 1, y, grid);
+				generate_at(x - 1, y, grid, seed, counter);
 			}
 			break;
 		}
@@ -65,11 +93,12 @@ void generate_at(int x, int y, std::vector<std::vector<int>> *grid) {
 	}
 }
 
-std::vector<std::vector<int>> generate_maze(sf::Vector2i dimensions, sf::Vector2i start_point) {
+std::vector<std::vector<int>> generate_maze(sf::Vector2i dimensions, sf::Vector2i start_point, uint64_t seed) {
 
 	std::vector<std::vector<int>> grid(dimensions.x, std::vector<int>(dimensions.y, 0));
 
-	generate_at(start_point.x, start_point.y, &grid);
+	uint64_t counter = 0;
+	generate_at(start_point.x, start_point.y, &grid, seed, &counter);
 
 	return grid;
 }
@@ -77,17 +106,14 @@ std::vector<std::vector<int>> generate_maze(sf::Vector2i dimensions, sf::Vector2
 
 
 
-void Old_Map::generate_terrain() {
-	std::mt19937 gen;
-	std::uniform_real_distribution<double> dis(-1.0, 1.0);
-	auto f_rand = std::bind(dis, std::ref(gen));
+void Old_Map::generate_terrain(uint64_t seed, unsigned int thread_count) {
 
-	voxel_data = new char[dimensions.x * dimensions.y * dimensions.z];
-	height_map = new double[dimensions.x * dimensions.y];
+	ThreadPool workers(thread_count);
 
-	for (int i = 0; i < dimensions.x * dimensions.y * dimensions.z; i++) {
-		voxel_data[i] = 0;
-	}
+	clear_voxels(workers);
+
+	delete[] height_map;
+	height_map = new double[dimensions.x * dimensions.y];
 
 	//set_voxel(sf::Vector3i(63, 63, 63), 1);
 
@@ -100,8 +126,7 @@ void Old_Map::generate_terrain() {
 	//value 2^n+1
 	int DATA_SIZE = dimensions.x + 1;
 	//an initial seed value for the corners of the data
-	//srand(f_rand());
-	double SEED = rand() % 10 + 30;
+	double SEED = terrain_hash(seed, CORNER_STREAM, 0) % 10 + 30;
 
 	//seed the data
 	set_sample(0, 0, SEED);
@@ -126,8 +151,15 @@ void Old_Map::generate_terrain() {
 		//(just to make calcs below a little clearer)
 		int halfSide = sideLength / 2;
 
+		// Every sample in a pass only reads the ones from earlier passes, so a pass
+		// can be split up by columns. The random offsets are keyed on the pass and
+		// position so the split doesn't change them
+		uint64_t square_stream = PASS_STREAM + 2 * static_cast<uint64_t>(sideLength);
+		uint64_t diamond_stream = square_stream + 1;
+
 		//generate the new square values
-		for (int x = 0; x < DATA_SIZE - 1; x += sideLength) {
+		workers.parallel_for((DATA_SIZE - 1) / sideLength, [&](int column) {
+			int x = column * sideLength;
 			for (int y = 0; y < DATA_SIZE - 1; y += sideLength) {
 				//x, y is upper left corner of square
 				//calculate average of existing corners
@@ -142,16 +174,17 @@ void Old_Map::generate_terrain() {
 					//We calculate random value in range of 2h
 					//and then subtract h so the end value is
 					//in the range (-h, +h)
-					avg + (f_rand() * 2 * h) - h);
+					avg + (terrain_random(seed, square_stream, x + y * DATA_SIZE) * 2 * h) - h);
 			}
-		}
+		});
 
 		//generate the diamond values
 		//since the diamonds are staggered we only move x
 		//by half side
 		//NOTE: if the data shouldn't wrap then x < DATA_SIZE
 		//to generate the far edge values
-		for (int x = 0; x < DATA_SIZE - 1; x += halfSide) {
+		workers.parallel_for((DATA_SIZE - 1) / halfSide, [&](int column) {
+			int x = column * halfSide;
 			//and y is x offset by half a side, but moved by
 			//the full side length
 			//NOTE: if the data shouldn't wrap then y < DATA_SIZE
@@ -171,7 +204,7 @@ void Old_Map::generate_terrain() {
 				//We calculate random value in range of 2h
 				//and then subtract h so the end value is
 				//in the range (-h, +h)
-				avg = avg + (f_rand() * 2 * h) - h;
+				avg = avg + (terrain_random(seed, diamond_stream, x + y * DATA_SIZE) * 2 * h) - h;
 				//update value for center of diamond
 				set_sample(x, y, avg);
 
@@ -181,7 +214,7 @@ void Old_Map::generate_terrain() {
 				if (x == 0)  set_sample(DATA_SIZE - 1, y, avg);
 				if (y == 0)  set_sample(x, DATA_SIZE - 1, avg);
 			}
-		}
+		});
 	}
 
 	//for (int x = 100; x < 150; x += 10) {
@@ -196,7 +229,8 @@ void Old_Map::generate_terrain() {
 
 
 
-	for (int x = 0; x < dimensions.x; x++) {
+	// Each column only writes its own voxels
+	workers.parallel_for(dimensions.x, [&](int x) {
 		for (int y = 0; y < dimensions.y; y++) {
 
 			if (height_map[x + y * dimensions.x] > 0) {
@@ -210,7 +244,7 @@ void Old_Map::generate_terrain() {
 			}
 
 		}
-	}
+	});
 
 
 	for (int x = dimensions.x / 2; x < dimensions.x / 2 + dimensions.x / 64; x++) {
@@ -225,7 +259,7 @@ void Old_Map::generate_terrain() {
 	for (int x = 60; x < 65; x++) {
 		for (int y = 60; y < 65; y++) {
 			for (int z = 30; z < 35; z++) {
-				voxel_data[x + dimensions.x * (y + dimensions.z * z)] = 6;
+				set_voxel(sf::Vector3i(x, y, z), 6);
 			}
 		}
 	}
@@ -250,7 +284,7 @@ void Old_Map::generate_terrain() {
 	// Hand code in some constructions
 
 	std::vector<std::vector<int>> maze = 
-		generate_maze(sf::Vector2i(8, 8), sf::Vector2i(0, 0));
+		generate_maze(sf::Vector2i(8, 8), sf::Vector2i(0, 0), seed);
 
 	for (int x = 0; x < maze.size(); x++) {
 		for (int y = 0; y < maze.at(0).size(); y++) {
@@ -258,33 +292,33 @@ void Old_Map::generate_terrain() {
 			switch(maze.at(x).at(y)) {
 				
 			case 1: { // North
-				voxel_data[x * 3 + 1 + dimensions.x * (y * 3     + dimensions.z * 1)] = 6;
-				voxel_data[x * 3 + 1 + dimensions.x * (y * 3 + 1 + dimensions.z * 1)] = 6;
-				voxel_data[x * 3 + 1 + dimensions.x * (y * 3 + 2 + dimensions.z * 1)] = 5;
+				set_voxel(sf::Vector3i(x * 3 + 1, y * 3, 1), 6);
+				set_voxel(sf::Vector3i(x * 3 + 1, y * 3 + 1, 1), 6);
+				set_voxel(sf::Vector3i(x * 3 + 1, y * 3 + 2, 1), 5);
 				//voxel_data[x * 3     + dimensions.x * (y * 3 + 2 + dimensions.z * 1)] = 6;
 				//voxel_data[x * 3 + 2 + dimensions.x * (y * 3 + 2 + dimensions.z * 1)] = 6;
 				break;
 			}
 			case 2: { // South
-				voxel_data[x * 3 + 1 + dimensions.x * (y * 3     + dimensions.z * 1)] = 5;
-				voxel_data[x * 3 + 1 + dimensions.x * (y * 3 + 1 + dimensions.z * 1)] = 6;
-				voxel_data[x * 3 + 1 + dimensions.x * (y * 3 + 2 + dimensions.z * 1)] = 6;
+				set_voxel(sf::Vector3i(x * 3 + 1, y * 3, 1), 5);
+				set_voxel(sf::Vector3i(x * 3 + 1, y * 3 + 1, 1), 6);
+				set_voxel(sf::Vector3i(x * 3 + 1, y * 3 + 2, 1), 6);
 				//voxel_data[x * 3     + dimensions.x * (y * 3     + dimensions.z * 1)] = 6;
 				//voxel_data[x * 3 + 2 + dimensions.x * (y * 3     + dimensions.z * 1)] = 6;
 				break;
 			}
 			case 3: { // East
-				voxel_data[x * 3     + dimensions.x * (y * 3 + 1 + dimensions.z * 1)] = 6;
-				voxel_data[x * 3 + 1 + dimensions.x * (y * 3 + 1 + dimensions.z * 1)] = 6;
-				voxel_data[x * 3 + 2 + dimensions.x * (y * 3 + 1 + dimensions.z * 1)] = 5;
+				set_voxel(sf::Vector3i(x * 3, y * 3 + 1, 1), 6);
+				set_voxel(sf::Vector3i(x * 3 + 1, y * 3 + 1, 1), 6);
+				set_voxel(sf::Vector3i(x * 3 + 2, y * 3 + 1, 1), 5);
 				//voxel_data[x * 3 + 2 + dimensions.x * (y * 3     + dimensions.z * 1)] = 6;
 				//voxel_data[x * 3 + 2 + dimensions.x * (y * 3 + 2 + dimensions.z * 1)] = 6;
 				break;
 			}
 			case 4: { // West
-				voxel_data[x * 3     + dimensions.x * (y * 3 + 1 + dimensions.z * 1)] = 5;
-				voxel_data[x * 3 + 1 + dimensions.x * (y * 3 + 1 + dimensions.z * 1)] = 6;
-				voxel_data[x * 3 + 2 + dimensions.x * (y * 3 + 1 + dimensions.z * 1)] = 6;
+				set_voxel(sf::Vector3i(x * 3, y * 3 + 1, 1), 5);
+				set_voxel(sf::Vector3i(x * 3 + 1, y * 3 + 1, 1), 6);
+				set_voxel(sf::Vector3i(x * 3 + 2, y * 3 + 1, 1), 6);
 				//voxel_data[x * 3     + dimensions.x * (y * 3     + dimensions.z * 1)] = 6;
 				//voxel_data[x * 3     + dimensions.x * (y * 3 + 2 + dimensions.z * 1)] = 6;
 				break;
@@ -307,10 +341,856 @@ void Old_Map::generate_terrain() {
 	set_voxel(sf::Vector3i(47, 70, 6), 6);
 	set_voxel(sf::Vector3i(100, 100, 50), 1);
 
+	apply_layout(workers);
+
+	generate_distance_field(thread_count);
+	generate_occupancy(thread_count);
+}
+
+void Old_Map::clear_voxels(ThreadPool &workers) {
+
+	size_t slice_size = static_cast<size_t>(dimensions.x) * dimensions.y;
+
+	if (voxel_data == nullptr)
+		voxel_data = new char[slice_size * dimensions.z];
+
+	// Clear a z slice per task
+	workers.parallel_for(dimensions.z, [&](int z) {
+		memset(voxel_data + slice_size * z, 0, slice_size);
+	});
+}
+
+void Old_Map::apply_layout(ThreadPool &workers) {
+
+	if (layout == LINEAR_LAYOUT)
+		return;
+
+	char *laid_out = new char[static_cast<size_t>(dimensions.x) * dimensions.y * dimensions.z];
+
+	// Every voxel lands on its own index, so z slices can go in parallel
+	workers.parallel_for(dimensions.z, [&](int z) {
+		for (int y = 0; y < dimensions.y; y++) {
+			for (int x = 0; x < dimensions.x; x++)
+				laid_out[voxel_index(sf::Vector3i(x, y, z))] = voxel_data[x + dimensions.x * (y + dimensions.z * z)];
+		}
+	});
+
+	delete[] voxel_data;
+	voxel_data = laid_out;
+}
+
+std::vector<char> Old_Map::get_linear_voxel_data() const {
+
+	size_t voxel_count = static_cast<size_t>(dimensions.x) * dimensions.y * dimensions.z;
+
+	if (layout == LINEAR_LAYOUT)
+		return std::vector<char>(voxel_data, voxel_data + voxel_count);
+
+	std::vector<char> linear(voxel_count);
+
+	for (int z = 0; z < dimensions.z; z++) {
+		for (int y = 0; y < dimensions.y; y++) {
+			for (int x = 0; x < dimensions.x; x++)
+				linear[x + dimensions.x * (y + dimensions.z * z)] = get_voxel(sf::Vector3i(x, y, z));
+		}
+	}
+
+	return linear;
+}
+
+void Old_Map::benchmark_layouts(int ray_count) {
+
+	bool power_of_two_cube = dimensions.x == dimensions.y && dimensions.y == dimensions.z && dimensions.x <= 1024 && (dimensions.x & (dimensions.x - 1)) == 0;
+
+	if (!power_of_two_cube) {
+		std::cout << "Layout benchmark needs a power of two cube" << std::endl;
+		return;
+	}
+
+	std::vector<char> linear = get_linear_voxel_data();
+	std::vector<char> morton(linear.size());
+
+	for (int z = 0; z < dimensions.z; z++) {
+		for (int y = 0; y < dimensions.y; y++) {
+			for (int x = 0; x < dimensions.x; x++)
+				morton[morton_encode(sf::Vector3i(x, y, z))] = linear[x + dimensions.x * (y + dimensions.z * z)];
+		}
+	}
+
+	struct BenchmarkRay {
+		sf::Vector3f origin;
+		sf::Vector3f direction;
+	};
+
+	std::vector<BenchmarkRay> camera_rays;
+	std::vector<BenchmarkRay> shadow_rays;
+
+	sf::Vector3f center = sf::Vector3f(dimensions) * 0.5f;
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> unit(0, 1);
+
+	// A camera circling the map looking in and down at the middle, a square of rays per stop
+	const int stops = 8;
+	int side = std::max(static_cast<int>(std::sqrt(ray_count / stops)), 1);
+
+	for (int stop = 0; stop < stops; stop++) {
+
+		float angle = 2 * PI_F * stop / stops;
+		sf::Vector3f position(center.x + std::cos(angle) * dimensions.x * 0.45f, center.y + std::sin(angle) * dimensions.y * 0.45f, dimensions.z * 0.9f);
+
+		sf::Vector3f forward = Normalize(center - position);
+		sf::Vector3f right = Normalize(sf::Vector3f(-forward.y, forward.x, 0));
+		sf::Vector3f up(
+			right.y * forward.z - right.z * forward.y,
+			right.z * forward.x - right.x * forward.z,
+			right.x * forward.y - right.y * forward.x
+		);
+
+		for (int v = 0; v < side; v++) {
+			for (int u = 0; u < side; u++) {
+				float du = static_cast<float>(u) / side - 0.5f;
+				float dv = static_cast<float>(v) / side - 0.5f;
+				camera_rays.push_back({ position, Normalize(forward + right * du + up * dv) });
+			}
+		}
+	}
+
+	// Shadow rays start wherever and all head for the one light, so neighbouring rays
+	// have nothing to do with each other
+	sf::Vector3f light(center.x, center.y, dimensions.z * 2.0f);
+
+	for (size_t i = 0; i < camera_rays.size(); i++) {
+		sf::Vector3f origin(unit(rng) * dimensions.x, unit(rng) * dimensions.y, unit(rng) * dimensions.z);
+		shadow_rays.push_back({ origin, Normalize(light - origin) });
+	}
+
+	// Woo stepping until something is hit or the ray leaves, the same as the kernel. Returns
+	// the voxel steps it took and adds what it hit to checksum so both layouts can be compared
+	auto cast = [this](const char *data, bool is_morton, const BenchmarkRay &ray, uint64_t &checksum) {
+
+		sf::Vector3i voxel(ray.origin);
+		sf::Vector3i step(
+			(ray.direction.x > 0) - (ray.direction.x < 0),
+			(ray.direction.y > 0) - (ray.direction.y < 0),
+			(ray.direction.z > 0) - (ray.direction.z < 0)
+		);
+
+		float delta[3] = {
+			std::fabs(1.0f / ray.direction.x),
+			std::fabs(1.0f / ray.direction.y),
+			std::fabs(1.0f / ray.direction.z)
+		};
+
+		float origin[3] = { ray.origin.x, ray.origin.y, ray.origin.z };
+		int position[3] = { voxel.x, voxel.y, voxel.z };
+		int steps[3] = { step.x, step.y, step.z };
+		int bounds[3] = { dimensions.x, dimensions.y, dimensions.z };
+		float next[3];
+
+		for (int a = 0; a < 3; a++)
+			next[a] = steps[a] > 0 ? (position[a] + 1 - origin[a]) * delta[a] : (origin[a] - position[a]) * delta[a];
+
+		uint64_t count = 0;
+
+		while (true) {
+
+			int a = next[0] <= next[1] ? (next[0] <= next[2] ? 0 : 2) : (next[1] <= next[2] ? 1 : 2);
+			position[a] += steps[a];
+			next[a] += delta[a];
+			count++;
+
+			if (position[a] < 0 || position[a] >= bounds[a])
+				return count;
+
+			sf::Vector3i p(position[0], position[1], position[2]);
+			size_t index = is_morton ? morton_encode(p) : p.x + static_cast<size_t>(dimensions.x) * (p.y + static_cast<size_t>(dimensions.z) * p.z);
+
+			if (data[index] != 0) {
+				checksum += p.x + 1024ull * (p.y + 1024ull * p.z);
+				return count;
+			}
+		}
+	};
+
+	auto run = [&](const char *name, const std::vector<BenchmarkRay> &rays) {
+
+		double nanoseconds[2];
+		uint64_t checksums[2] = { 0, 0 };
+		uint64_t steps = 0;
+
+		for (int is_morton = 0; is_morton < 2; is_morton++) {
+
+			const char *data = is_morton ? morton.data() : linear.data();
+			steps = 0;
+
+			auto start = std::chrono::steady_clock::now();
+
+			for (auto &ray : rays)
+				steps += cast(data, is_morton != 0, ray, checksums[is_morton]);
+
+			nanoseconds[is_morton] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / std::max<uint64_t>(steps, 1);
+		}
+
+		std::cout << "    " << name << " : " << rays.size() << " rays, " << steps << " steps, linear "
+			<< nanoseconds[0] << " ns per step, morton " << nanoseconds[1] << " ns per step"
+			<< (checksums[0] == checksums[1] ? "" : ", HITS DIFFER") << std::endl;
+	};
+
+	std::cout << "Layout benchmark :" << std::endl;
+	run("Camera rays", camera_rays);
+	run("Shadow rays", shadow_rays);
+}
+
+void Old_Map::generate_distance_field(unsigned int thread_count) {
+
+	ThreadPool workers(thread_count);
+
+	if (layout == LINEAR_LAYOUT) {
+		::generate_distance_field(voxel_data, dimensions, distance_field, distance_field_dimensions, false, &workers);
+		return;
+	}
+
+	std::vector<char> linear = get_linear_voxel_data();
+	::generate_distance_field(linear.data(), dimensions, distance_field, distance_field_dimensions, false, &workers);
+}
+
+void Old_Map::generate_occupancy(unsigned int thread_count) {
+
+	ThreadPool workers(thread_count);
+
+	if (layout == LINEAR_LAYOUT) {
+		occupancy.generate(voxel_data, dimensions, &workers);
+	}
+	else {
+		std::vector<char> linear = get_linear_voxel_data();
+		occupancy.generate(linear.data(), dimensions, &workers);
+	}
+
+	occupancy_pyramid.generate(occupancy, &workers);
+}
+
+const OccupancyGrid& Old_Map::get_occupancy() {
+	return occupancy;
+}
+
+const OccupancyPyramid& Old_Map::get_occupancy_pyramid() {
+	return occupancy_pyramid;
+}
+
+bool Old_Map::is_solid(sf::Vector3i position) {
+	return occupancy.is_solid(position);
+}
+
+bool Old_Map::is_empty(sf::Vector3i min, sf::Vector3i max) {
+	return occupancy.is_empty(min, max);
+}
+
+void Old_Map::edit_voxel(sf::Vector3i position, char value) {
+
+	if (position.x < 0 || position.x >= dimensions.x ||
+		position.y < 0 || position.y >= dimensions.y ||
+		position.z < 0 || position.z >= dimensions.z)
+		return;
+
+	char &voxel = voxel_data[voxel_index(position)];
+
+	if (voxel == value)
+		return;
+
+	voxel = value;
+	occupancy.set_solid(position, value != 0);
+	occupancy_pyramid.update(occupancy, position);
+	dirty_voxels.add(position);
+
+	// Clearing a voxel leaves the distances short, which only costs a little leaping.
+	// Filling one in can make them too long though, and those have to come down now
+	sf::Vector3i changed_min, changed_max;
+
+	if (value != 0 && mark_distance_field_occupied(distance_field, distance_field_dimensions, position / DISTANCE_BLOCK, changed_min, changed_max))
+		dirty_distance_field.add(changed_min, changed_max);
+}
+
+std::vector<DirtyRegion> Old_Map::take_dirty_voxels() {
+	return dirty_voxels.take();
+}
+
+std::vector<DirtyRegion> Old_Map::take_dirty_distance_field() {
+	return dirty_distance_field.take();
+}
+
+bool Old_Map::validate_edits(int stroke_count) {
+
+	// Whatever's pending from before counts as already on the device
+	take_dirty_voxels();
+	take_dirty_distance_field();
+
+	size_t voxel_count = static_cast<size_t>(dimensions.x) * dimensions.y * dimensions.z;
+
+	std::vector<char> device_voxels(voxel_data, voxel_data + voxel_count);
+	std::vector<uint64_t> device_words = occupancy.words;
+	std::vector<uint8_t> device_flags = occupancy_pyramid.flags;
+	std::vector<uint8_t> device_field = distance_field;
+
+	size_t uploaded = 0;
+	int flushes = 0;
+
+	// Hardware_Caster::flush_map_edits, but into the copies
+	auto flush = [&]() {
+
+		sf::Vector3i block_dimensions = occupancy.block_dimensions;
+
+		for (auto &region : take_dirty_voxels()) {
+
+			for (int z = region.min.z; z <= region.max.z; z++) {
+				for (int y = region.min.y; y <= region.max.y; y++) {
+					for (int x = region.min.x; x <= region.max.x; x++) {
+						size_t i = voxel_index(sf::Vector3i(x, y, z));
+						device_voxels[i] = voxel_data[i];
+						uploaded++;
+					}
+				}
+			}
+
+			sf::Vector3i block_min = region.min / OCCUPANCY_BLOCK;
+			sf::Vector3i block_max = region.max / OCCUPANCY_BLOCK;
+
+			for (int z = block_min.z; z <= block_max.z; z++) {
+				for (int y = block_min.y; y <= block_max.y; y++) {
+					for (int x = block_min.x; x <= block_max.x; x++) {
+						size_t i = x + block_dimensions.x * (y + static_cast<size_t>(block_dimensions.y) * z);
+						device_words[i] = occupancy.words[i];
+						uploaded += sizeof(uint64_t);
+					}
+				}
+			}
+
+			for (int level = 1; level <= occupancy_pyramid.levels; level++) {
+				for (int z = region.min.z >> level; z <= region.max.z >> level; z++) {
+					for (int y = region.min.y >> level; y <= region.max.y >> level; y++) {
+						for (int x = region.min.x >> level; x <= region.max.x >> level; x++) {
+							size_t i = occupancy_pyramid.cell_index(level, sf::Vector3i(x, y, z));
+							device_flags[i] = occupancy_pyramid.flags[i];
+							uploaded++;
+						}
+					}
+				}
+			}
+		}
+
+		for (auto &region : take_dirty_distance_field()) {
+			for (int z = region.min.z; z <= region.max.z; z++) {
+				for (int y = region.min.y; y <= region.max.y; y++) {
+					for (int x = region.min.x; x <= region.max.x; x++) {
+						size_t i = x + distance_field_dimensions.x * (y + static_cast<size_t>(distance_field_dimensions.y) * z);
+						device_field[i] = distance_field[i];
+						uploaded++;
+					}
+				}
+			}
+		}
+
+		flushes++;
+	};
+
+	std::mt19937 rng(13);
+	std::uniform_int_distribution<int> position_x(0, dimensions.x - 1);
+	std::uniform_int_distribution<int> position_y(0, dimensions.y - 1);
+	std::uniform_int_distribution<int> position_z(0, dimensions.z - 1);
+	std::uniform_int_distribution<int> radius_range(1, 6);
+	std::uniform_int_distribution<int> color(1, 255);
+	std::uniform_int_distribution<int> coin(0, 1);
+
+	for (int stroke = 0; stroke < stroke_count; stroke++) {
+
+		sf::Vector3i center(position_x(rng), position_y(rng), position_z(rng));
+		int radius = radius_range(rng);
+		char value = coin(rng) ? static_cast<char>(color(rng)) : 0;
+
+		for (int z = -radius; z <= radius; z++) {
+			for (int y = -radius; y <= radius; y++) {
+				for (int x = -radius; x <= radius; x++) {
+					if (x * x + y * y + z * z <= radius * radius)
+						edit_voxel(center + sf::Vector3i(x, y, z), value);
+				}
+			}
+		}
+
+		// A few strokes to a frame
+		if (stroke % 4 == 3 || stroke == stroke_count - 1)
+			flush();
+	}
+
+	size_t stale = 0;
+
+	for (size_t i = 0; i < voxel_count; i++)
+		stale += device_voxels[i] != voxel_data[i];
+	for (size_t i = 0; i < device_words.size(); i++)
+		stale += device_words[i] != occupancy.words[i];
+	for (size_t i = 0; i < device_flags.size(); i++)
+		stale += device_flags[i] != occupancy_pyramid.flags[i];
+	for (size_t i = 0; i < device_field.size(); i++)
+		stale += device_field[i] != distance_field[i];
+
+	std::vector<char> linear = get_linear_voxel_data();
+
+	OccupancyGrid rebuilt_occupancy;
+	rebuilt_occupancy.generate(linear.data(), dimensions);
+
+	OccupancyPyramid rebuilt_pyramid;
+	rebuilt_pyramid.generate(rebuilt_occupancy);
+
+	std::vector<uint8_t> rebuilt_field;
+	sf::Vector3i rebuilt_field_dimensions;
+	::generate_distance_field(linear.data(), dimensions, rebuilt_field, rebuilt_field_dimensions, false);
+
+	size_t occupancy_wrong = 0;
+
+	for (size_t i = 0; i < occupancy.words.size(); i++)
+		occupancy_wrong += occupancy.words[i] != rebuilt_occupancy.words[i];
+	for (size_t i = 0; i < occupancy.summary.size(); i++)
+		occupancy_wrong += occupancy.summary[i] != rebuilt_occupancy.summary[i];
+	for (size_t i = 0; i < occupancy_pyramid.flags.size(); i++)
+		occupancy_wrong += occupancy_pyramid.flags[i] != rebuilt_pyramid.flags[i];
+
+	// Carving leaves distances short, which only costs some leaping. One too long would
+	// let a ray leap through something
+	size_t too_long = 0;
+	size_t too_short = 0;
+
+	for (size_t i = 0; i < distance_field.size(); i++) {
+		too_long += distance_field[i] > rebuilt_field[i];
+		too_short += distance_field[i] < rebuilt_field[i];
+	}
+
+	size_t whole = voxel_count + occupancy.words.size() * sizeof(uint64_t) + occupancy_pyramid.flags.size() + distance_field.size();
+
+	std::cout << "Flushed " << stroke_count << " strokes in " << flushes << " uploads of " << uploaded / 1024 << " KB against "
+		<< whole * flushes / 1024 << " KB whole, " << stale << " stale on the copy, " << occupancy_wrong << " occupancy words and cells wrong, "
+		<< too_long << " distances too long and " << too_short << " short" << std::endl;
+
+	return stale == 0 && occupancy_wrong == 0 && too_long == 0;
+}
+
+bool Old_Map::import_vox(std::string path, sf::Vector3i position, unsigned int thread_count) {
+
+	VoxFile file;
+
+	if (!file.open(path))
+		return false;
+
+	ThreadPool workers(thread_count);
+
+	if (voxel_data == nullptr)
+		clear_voxels(workers);
+
+	const std::vector<VoxInstance> &instances = file.get_instances();
+
+	sf::Vector3i scene_min, scene_max;
+	file.bounds(scene_min, scene_max);
+
+	// An instance goes in the wave after the last earlier instance it overlaps. Everything
+	// in a wave writes to different voxels, and overlaps still land in file order
+	std::vector<sf::Vector3i> instance_min(instances.size());
+	std::vector<sf::Vector3i> instance_max(instances.size());
+	std::vector<int> waves(instances.size(), 0);
+	int wave_count = 0;
+
+	for (size_t i = 0; i < instances.size(); i++) {
+
+		instances[i].bounds(file.get_model_size(instances[i].model), instance_min[i], instance_max[i]);
+
+		for (size_t j = 0; j < i; j++) {
+
+			bool overlapping =
+				instance_min[i].x <= instance_max[j].x && instance_min[j].x <= instance_max[i].x &&
+				instance_min[i].y <= instance_max[j].y && instance_min[j].y <= instance_max[i].y &&
+				instance_min[i].z <= instance_max[j].z && instance_min[j].z <= instance_max[i].z;
+
+			if (overlapping)
+				waves[i] = std::max(waves[i], waves[j] + 1);
+		}
+
+		wave_count = std::max(wave_count, waves[i] + 1);
+	}
+
+	struct ImportTask {
+		size_t instance;
+		uint32_t first;
+		uint32_t count;
+	};
+
+	sf::Vector3i offset = position - scene_min;
+	std::atomic<bool> failed(false);
+
+	for (int wave = 0; wave < wave_count; wave++) {
+
+		std::vector<ImportTask> tasks;
+
+		for (size_t i = 0; i < instances.size(); i++) {
+
+			if (waves[i] != wave)
+				continue;
+
+			uint32_t voxel_count = file.get_voxel_count(instances[i].model);
+
+			for (uint32_t first = 0; first < voxel_count; first += VOX_TASK_RECORDS)
+				tasks.push_back({ i, first, std::min<uint32_t>(VOX_TASK_RECORDS, voxel_count - first) });
+		}
+
+		workers.parallel_for(static_cast<int>(tasks.size()), [&](int t) {
+
+			const ImportTask &task = tasks[t];
+			const VoxInstance &instance = instances[task.instance];
+			sf::Vector3i size = file.get_model_size(instance.model);
+
+			bool read = file.read_records(instance.model, task.first, task.count, [&](const VoxRecord *records, size_t count) {
+
+				for (size_t r = 0; r < count; r++) {
+
+					// Outside of its model would be outside of its box, and maybe in another task's
+					if (records[r].x >= size.x || records[r].y >= size.y || records[r].z >= size.z)
+						continue;
+
+					sf::Vector3i voxel = instance.transform(sf::Vector3i(records[r].x, records[r].y, records[r].z), size) + offset;
+
+					if (voxel.x < 0 || voxel.x >= dimensions.x ||
+						voxel.y < 0 || voxel.y >= dimensions.y ||
+						voxel.z < 0 || voxel.z >= dimensions.z)
+						continue;
+
+					voxel_data[voxel_index(voxel)] = static_cast<char>(records[r].color_index);
+				}
+			});
+
+			if (!read)
+				failed = true;
+		});
+	}
+
+	if (failed)
+		std::cout << "Couldn't read all of " << path << std::endl;
+
+	if (!instances.empty())
+		finish_import(position, position + scene_max - scene_min, thread_count);
+
+	return !failed;
+}
+
+bool Old_Map::import_raw(std::string path, sf::Vector3i volume_dimensions, sf::Vector3i position, unsigned int thread_count) {
+
+	uint64_t slice_size = static_cast<uint64_t>(volume_dimensions.x) * volume_dimensions.y;
+
+	std::ifstream input_file(path, std::ios::binary | std::ios::in | std::ios::ate);
+
+	if (!input_file.is_open()) {
+		std::cout << "Couldn't open " << path << std::endl;
+		return false;
+	}
+
+	if (static_cast<uint64_t>(input_file.tellg()) != slice_size * volume_dimensions.z) {
+		std::cout << path << " isn't a " << volume_dimensions.x << "x" << volume_dimensions.y << "x" << volume_dimensions.z << " volume" << std::endl;
+		return false;
+	}
+
+	input_file.close();
+
+	ThreadPool workers(thread_count);
+
+	if (voxel_data == nullptr)
+		clear_voxels(workers);
+
+	// The part of the map the volume covers
+	sf::Vector3i min(std::max(position.x, 0), std::max(position.y, 0), std::max(position.z, 0));
+	sf::Vector3i max(
+		std::min(position.x + volume_dimensions.x, dimensions.x) - 1,
+		std::min(position.y + volume_dimensions.y, dimensions.y) - 1,
+		std::min(position.z + volume_dimensions.z, dimensions.z) - 1
+	);
+
+	if (min.x > max.x || min.y > max.y || min.z > max.z)
+		return true;
+
+	const int slab_slices = 8;
+	int slab_count = (max.z - min.z) / slab_slices + 1;
+
+	int row_length = max.x - min.x + 1;
+	int row_count = max.y - min.y + 1;
+
+	std::atomic<bool> failed(false);
+
+	workers.parallel_for(slab_count, [&](int slab) {
+
+		std::ifstream slab_file(path, std::ios::binary | std::ios::in);
+
+		// The rows we want out of a slice are back to back in the file, so a slice is one read
+		std::vector<char> rows(static_cast<size_t>(row_count) * volume_dimensions.x);
+
+		int first_z = min.z + slab * slab_slices;
+		int last_z = std::min(max.z, first_z + slab_slices - 1);
+
+		for (int z = first_z; z <= last_z; z++) {
+
+			sf::Vector3i source = sf::Vector3i(min.x, min.y, z) - position;
+
+			slab_file.seekg(source.z * slice_size + static_cast<uint64_t>(source.y) * volume_dimensions.x);
+			slab_file.read(rows.data(), rows.size());
+
+			if (!slab_file.good()) {
+				failed = true;
+				return;
+			}
+
+			for (int y = 0; y < row_count; y++) {
+
+				const char *row = rows.data() + static_cast<size_t>(y) * volume_dimensions.x + source.x;
+
+				if (layout == LINEAR_LAYOUT) {
+					memcpy(voxel_data + voxel_index(sf::Vector3i(min.x, min.y + y, z)), row, row_length);
+					continue;
+				}
+
+				for (int x = 0; x < row_length; x++)
+					voxel_data[voxel_index(sf::Vector3i(min.x + x, min.y + y, z))] = row[x];
+			}
+		}
+	});
+
+	if (failed)
+		std::cout << "Couldn't read all of " << path << std::endl;
+
+	finish_import(min, max, thread_count);
+
+	return !failed;
+}
+
+bool Old_Map::validate_import(std::string directory) {
+
+	std::mt19937 rng(7);
+	std::uniform_int_distribution<int> color(1, 255);
+	std::uniform_int_distribution<int> percent(0, 99);
+
+	// Two models, a sparse one and a solid one
+	sf::Vector3i sizes[2] = { sf::Vector3i(48, 40, 24), sf::Vector3i(20, 20, 20) };
+	std::vector<VoxRecord> records[2];
+
+	for (int model = 0; model < 2; model++) {
+		for (int z = 0; z < sizes[model].z; z++) {
+			for (int y = 0; y < sizes[model].y; y++) {
+				for (int x = 0; x < sizes[model].x; x++) {
+					if (model == 1 || percent(rng) < 30)
+						records[model].push_back({ uint8_t(x), uint8_t(y), uint8_t(z), uint8_t(color(rng)) });
+				}
+			}
+		}
+	}
+
+	// The root moves everything by root_translation. Model 0 goes in twice, the second
+	// copy rotated over the first, and model 1 after and overlapping both
+	sf::Vector3i root_translation(5, -3, 2);
+	struct Placement { int model; int packed_rotation; sf::Vector3i translation; };
+	Placement placements[3] = {
+		{ 0, 4, sf::Vector3i(30, 30, 20) },
+		{ 0, 1 | (0 << 2) | (1 << 4), sf::Vector3i(40, 36, 24) },
+		{ 1, 4, sf::Vector3i(34, 30, 26) }
+	};
+
+	std::string vox_path = directory + "validate_import.vox";
+	std::ofstream vox_file(vox_path, std::ios::binary | std::ios::out | std::ios::trunc);
+
+	if (!vox_file.is_open()) {
+		std::cout << "Couldn't open " << vox_path << " to validate the importer" << std::endl;
+		return false;
+	}
+
+	std::string content;
+
+	auto put_int = [](std::string &out, int32_t value) { out.append(reinterpret_cast<char*>(&value), sizeof(value)); };
+	auto put_string = [&](std::string &out, std::string value) { put_int(out, static_cast<int32_t>(value.size())); out += value; };
+	auto put_chunk = [&](std::string &out, const char *id, const std::string &chunk) {
+		out.append(id, 4);
+		put_int(out, static_cast<int32_t>(chunk.size()));
+		put_int(out, 0);
+		out += chunk;
+	};
+
+	for (int model = 0; model < 2; model++) {
+
+		std::string size, xyzi;
+		put_int(size, sizes[model].x);
+		put_int(size, sizes[model].y);
+		put_int(size, sizes[model].z);
+		put_int(xyzi, static_cast<int32_t>(records[model].size()));
+		xyzi.append(reinterpret_cast<const char*>(records[model].data()), records[model].size() * sizeof(VoxRecord));
+
+		put_chunk(content, "SIZE", size);
+		put_chunk(content, "XYZI", xyzi);
+	}
+
+	auto put_transform = [&](int node, int child, int packed_rotation, sf::Vector3i translation) {
+		std::string chunk;
+		put_int(chunk, node);
+		put_int(chunk, 0);
+		put_int(chunk, child);
+		put_int(chunk, -1);
+		put_int(chunk, 0);
+		put_int(chunk, 1);
+		put_int(chunk, 2);
+		put_string(chunk, "_r");
+		put_string(chunk, std::to_string(packed_rotation));
+		put_string(chunk, "_t");
+		put_string(chunk, std::to_string(translation.x) + " " + std::to_string(translation.y) + " " + std::to_string(translation.z));
+		put_chunk(content, "nTRN", chunk);
+	};
+
+	put_transform(0, 1, 4, root_translation);
+
+	std::string group;
+	put_int(group, 1);
+	put_int(group, 0);
+	put_int(group, 3);
+	for (int i = 0; i < 3; i++)
+		put_int(group, 2 + 2 * i);
+	put_chunk(content, "nGRP", group);
+
+	for (int i = 0; i < 3; i++) {
+
+		put_transform(2 + 2 * i, 3 + 2 * i, placements[i].packed_rotation, placements[i].translation);
+
+		std::string shape;
+		put_int(shape, 3 + 2 * i);
+		put_int(shape, 0);
+		put_int(shape, 1);
+		put_int(shape, placements[i].model);
+		put_int(shape, 0);
+		put_chunk(content, "nSHP", shape);
+	}
+
+	std::string file_contents = "VOX ";
+	put_int(file_contents, 150);
+	file_contents += "MAIN";
+	put_int(file_contents, 0);
+	put_int(file_contents, static_cast<int32_t>(content.size()));
+	file_contents += content;
+
+	vox_file.write(file_contents.data(), file_contents.size());
+	vox_file.close();
+
+	// Place them by hand. _r of 4 is the identity, the second is x <- -y, y <- x
+	size_t voxel_count = static_cast<size_t>(dimensions.x) * dimensions.y * dimensions.z;
+	std::vector<char> expected(voxel_count, 0);
+
+	auto placed = [&](int i, sf::Vector3i local) {
+		sf::Vector3i centered = local - sizes[placements[i].model] / 2;
+		if (i == 1)
+			centered = sf::Vector3i(-centered.y, centered.x, centered.z);
+		return centered + placements[i].translation + root_translation;
+	};
+
+	sf::Vector3i scene_min(INT32_MAX, INT32_MAX, INT32_MAX);
+
+	for (int i = 0; i < 3; i++) {
+		sf::Vector3i size = sizes[placements[i].model];
+		for (sf::Vector3i corner : { sf::Vector3i(0, 0, 0), size - sf::Vector3i(1, 1, 1) }) {
+			sf::Vector3i p = placed(i, corner);
+			scene_min = sf::Vector3i(std::min(scene_min.x, p.x), std::min(scene_min.y, p.y), std::min(scene_min.z, p.z));
+		}
+	}
+
+	sf::Vector3i position(3, 4, 5);
+
+	for (int i = 0; i < 3; i++) {
+		for (const VoxRecord &record : records[placements[i].model]) {
+			sf::Vector3i p = placed(i, sf::Vector3i(record.x, record.y, record.z)) - scene_min + position;
+			if (p.x >= 0 && p.y >= 0 && p.z >= 0 && p.x < dimensions.x && p.y < dimensions.y && p.z < dimensions.z)
+				expected[p.x + dimensions.x * (p.y + dimensions.z * p.z)] = static_cast<char>(record.color_index);
+		}
+	}
+
+	// And a raw volume hanging off of the far corner of the map, over the top of it
+	sf::Vector3i raw_dimensions(dimensions.x / 2 + 7, dimensions.y / 2 + 3, dimensions.z / 2 + 5);
+	sf::Vector3i raw_position = dimensions - raw_dimensions / 2;
+	std::vector<char> raw(static_cast<size_t>(raw_dimensions.x) * raw_dimensions.y * raw_dimensions.z);
+
+	for (char &voxel : raw)
+		voxel = percent(rng) < 20 ? static_cast<char>(color(rng)) : 0;
+
+	std::string raw_path = directory + "validate_import.raw";
+	std::ofstream raw_file(raw_path, std::ios::binary | std::ios::out | std::ios::trunc);
+	raw_file.write(raw.data(), raw.size());
+	raw_file.close();
+
+	for (int z = 0; z < raw_dimensions.z; z++) {
+		for (int y = 0; y < raw_dimensions.y; y++) {
+			for (int x = 0; x < raw_dimensions.x; x++) {
+				sf::Vector3i p = raw_position + sf::Vector3i(x, y, z);
+				if (p.x < dimensions.x && p.y < dimensions.y && p.z < dimensions.z)
+					expected[p.x + dimensions.x * (p.y + dimensions.z * p.z)] = raw[x + raw_dimensions.x * (y + static_cast<size_t>(raw_dimensions.y) * z)];
+			}
+		}
+	}
+
+	Old_Map imported(dimensions, layout);
+
+	auto start = std::chrono::steady_clock::now();
+	bool read = imported.import_vox(vox_path, position) && imported.import_raw(raw_path, raw_dimensions, raw_position);
+	double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	std::remove(vox_path.c_str());
+	std::remove(raw_path.c_str());
+
+	size_t mismatches = 0;
+
+	for (int z = 0; z < dimensions.z; z++) {
+		for (int y = 0; y < dimensions.y; y++) {
+			for (int x = 0; x < dimensions.x; x++) {
+				sf::Vector3i p(x, y, z);
+				char voxel = expected[x + dimensions.x * (y + dimensions.z * z)];
+				if (imported.get_voxel(p) != voxel || imported.is_solid(p) != (voxel != 0))
+					mismatches++;
+			}
+		}
+	}
+
+	std::cout << "Imported " << (file_contents.size() + raw.size()) / 1024 << " KB of .vox and raw in " << milliseconds << " ms, "
+		<< mismatches << " voxels wrong" << std::endl;
+
+	return read && mismatches == 0;
+}
+
+void Old_Map::finish_import(sf::Vector3i min, sf::Vector3i max, unsigned int thread_count) {
+
+	generate_distance_field(thread_count);
+	generate_occupancy(thread_count);
+
+	min = sf::Vector3i(std::max(min.x, 0), std::max(min.y, 0), std::max(min.z, 0));
+	max = sf::Vector3i(std::min(max.x, dimensions.x - 1), std::min(max.y, dimensions.y - 1), std::min(max.z, dimensions.z - 1));
+
+	if (min.x > max.x || min.y > max.y || min.z > max.z)
+		return;
+
+	// So a caster that already has the map can flush it up like any other edit. The
+	// distance field is rebuilt whole, and an import can change it anywhere
+	dirty_voxels.add(min, max);
+	dirty_distance_field.add(sf::Vector3i(0, 0, 0), distance_field_dimensions - sf::Vector3i(1, 1, 1));
+}
+
+uint8_t* Old_Map::get_distance_field() {
+	return distance_field.data();
+}
+
+sf::Vector3i Old_Map::get_distance_field_dimensions() {
+	return distance_field_dimensions;
 }
 
 
 void Old_Map::set_voxel(sf::Vector3i position, int val) {
+
+	// The hand placed bits of the terrain are for a big map, a small one just loses them
+	if (position.x < 0 || position.x >= dimensions.x ||
+		position.y < 0 || position.y >= dimensions.y ||
+		position.z < 0 || position.z >= dimensions.z)
+		return;
+
 	voxel_data[position.x + dimensions.x * (position.y + dimensions.z * position.z)] = val;
 }
 
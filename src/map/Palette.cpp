@@ -0,0 +1,115 @@
+#include "map/Palette.h"
+#include <algorithm>
+
+PalettedVoxels::PalettedVoxels(size_t voxel_count) :
+	voxel_count(voxel_count),
+	palette(1, 0) {
+}
+
+void PalettedVoxels::load_dense(const char *voxels, size_t voxel_count) {
+
+	this->voxel_count = voxel_count;
+
+	// Where each material landed in the palette, -1 if it hasn't yet
+	int entries[PALETTE_SIZE];
+	std::fill(entries, entries + PALETTE_SIZE, -1);
+
+	palette.clear();
+
+	for (size_t i = 0; i < voxel_count; i++) {
+
+		uint8_t material = static_cast<uint8_t>(voxels[i]);
+
+		if (entries[material] < 0) {
+			entries[material] = static_cast<int>(palette.size());
+			palette.push_back(voxels[i]);
+		}
+	}
+
+	if (palette.empty())
+		palette.push_back(0);
+
+	bits = bits_for(palette.size());
+	words.assign(bits == 0 ? 0 : (voxel_count * bits + 31) / 32, 0);
+
+	if (bits == 0)
+		return;
+
+	for (size_t i = 0; i < voxel_count; i++) {
+		size_t bit = i * bits;
+		words[bit / 32] |= static_cast<uint32_t>(entries[static_cast<uint8_t>(voxels[i])]) << (bit % 32);
+	}
+}
+
+void PalettedVoxels::decode(char *voxels) const {
+
+	if (bits == 0) {
+		std::fill(voxels, voxels + voxel_count, palette[0]);
+		return;
+	}
+
+	uint32_t mask = (1u << bits) - 1;
+	int per_word = 32 / bits;
+
+	for (size_t i = 0; i < voxel_count; i++)
+		voxels[i] = palette[(words[i / per_word] >> ((i % per_word) * bits)) & mask];
+}
+
+void PalettedVoxels::set(size_t index, char value) {
+
+	if (index >= voxel_count)
+		return;
+
+	auto entry = std::find(palette.begin(), palette.end(), value);
+
+	if (entry == palette.end()) {
+
+		palette.push_back(value);
+		entry = palette.end() - 1;
+
+		if (bits_for(palette.size()) > bits)
+			widen(bits_for(palette.size()));
+	}
+
+	// A single material run already is the value
+	if (bits == 0)
+		return;
+
+	uint32_t palette_index = static_cast<uint32_t>(entry - palette.begin());
+
+	size_t bit = index * bits;
+	uint32_t &word = words[bit / 32];
+
+	word &= ~(((1u << bits) - 1) << (bit % 32));
+	word |= palette_index << (bit % 32);
+}
+
+void PalettedVoxels::widen(int new_bits) {
+
+	std::vector<uint32_t> widened((voxel_count * new_bits + 31) / 32, 0);
+
+	// Every old index stays the same, it just takes more room. Coming from 0 bits they're all 0
+	for (size_t i = 0; i < voxel_count && bits > 0; i++) {
+
+		size_t bit = i * bits;
+		uint32_t palette_index = (words[bit / 32] >> (bit % 32)) & ((1u << bits) - 1);
+
+		size_t new_bit = i * new_bits;
+		widened[new_bit / 32] |= palette_index << (new_bit % 32);
+	}
+
+	words.swap(widened);
+	bits = new_bits;
+}
+
+int PalettedVoxels::bits_for(size_t palette_size) {
+
+	if (palette_size <= 1)
+		return 0;
+
+	int bits = 1;
+	while ((1u << bits) < palette_size)
+		bits *= 2;
+
+	return bits;
+}
@@ -0,0 +1,351 @@
+#include "map/VoxFile.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+sf::Vector3i VoxInstance::transform(sf::Vector3i local, sf::Vector3i size) const {
+
+	int centered[3] = { local.x - size.x / 2, local.y - size.y / 2, local.z - size.z / 2 };
+	int world[3];
+
+	for (int row = 0; row < 3; row++)
+		world[row] = rotation[row][0] * centered[0] + rotation[row][1] * centered[1] + rotation[row][2] * centered[2];
+
+	return sf::Vector3i(world[0], world[1], world[2]) + translation;
+}
+
+void VoxInstance::bounds(sf::Vector3i size, sf::Vector3i &min, sf::Vector3i &max) const {
+
+	// Rotations only permute and flip the axes, so the opposite corners stay opposite
+	sf::Vector3i a = transform(sf::Vector3i(0, 0, 0), size);
+	sf::Vector3i b = transform(size - sf::Vector3i(1, 1, 1), size);
+
+	min = sf::Vector3i(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
+	max = sf::Vector3i(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
+}
+
+namespace {
+
+	// Everything in a .vox is little endian, as is everything we run on
+	struct ChunkReader {
+
+		const std::vector<char> &content;
+		size_t position = 0;
+		bool ok = true;
+
+		ChunkReader(const std::vector<char> &content) : content(content) {}
+
+		int32_t read_int() {
+			int32_t value = 0;
+			if (position + sizeof(value) > content.size()) {
+				ok = false;
+				return 0;
+			}
+			memcpy(&value, content.data() + position, sizeof(value));
+			position += sizeof(value);
+			return value;
+		}
+
+		std::string read_string() {
+			int32_t size = read_int();
+			if (size < 0 || position + size > content.size()) {
+				ok = false;
+				return std::string();
+			}
+			std::string value(content.data() + position, size);
+			position += size;
+			return value;
+		}
+
+		std::map<std::string, std::string> read_dict() {
+			std::map<std::string, std::string> dict;
+			int32_t count = read_int();
+			for (int32_t i = 0; i < count && ok; i++) {
+				std::string key = read_string();
+				dict[key] = read_string();
+			}
+			return dict;
+		}
+	};
+
+	// _r packs the signed permutation: the column of row 0's one in bits 0-1, row 1's
+	// in bits 2-3, row 2 gets whichever is left. Bits 4-6 make rows 0-2 negative
+	void unpack_rotation(int packed, int rotation[3][3]) {
+
+		int columns[3];
+		columns[0] = packed & 3;
+		columns[1] = (packed >> 2) & 3;
+		columns[2] = 3 - columns[0] - columns[1];
+
+		// Not a permutation, leave it unrotated
+		if (columns[0] > 2 || columns[1] > 2 || columns[0] == columns[1])
+			return;
+
+		for (int row = 0; row < 3; row++) {
+			for (int column = 0; column < 3; column++)
+				rotation[row][column] = 0;
+
+			rotation[row][columns[row]] = (packed >> (4 + row)) & 1 ? -1 : 1;
+		}
+	}
+}
+
+bool VoxFile::open(std::string path) {
+
+	this->path = path;
+	models.clear();
+	instances.clear();
+
+	// Files without a palette chunk get a grey ramp
+	for (int i = 0; i < 256; i++)
+		palette[i] = 0xFF000000 | (i << 16) | (i << 8) | i;
+
+	std::ifstream input_file(path, std::ios::binary | std::ios::in);
+
+	if (!input_file.is_open()) {
+		std::cout << "Couldn't open " << path << std::endl;
+		return false;
+	}
+
+	char magic[4];
+	int32_t version = 0;
+	input_file.read(magic, sizeof(magic));
+	input_file.read(reinterpret_cast<char*>(&version), sizeof(version));
+
+	if (!input_file.good() || memcmp(magic, "VOX ", 4) != 0) {
+		std::cout << path << " isn't a .vox file" << std::endl;
+		return false;
+	}
+
+	std::map<int, SceneNode> nodes;
+	sf::Vector3i size;
+	bool have_size = false;
+
+	// MAIN's children are every other chunk, one after another. Only the small chunks get
+	// read in whole, XYZI just has its count read and the records skipped over
+	while (true) {
+
+		char id[4];
+		int32_t content_size = 0;
+		int32_t children_size = 0;
+
+		input_file.read(id, sizeof(id));
+		input_file.read(reinterpret_cast<char*>(&content_size), sizeof(content_size));
+		input_file.read(reinterpret_cast<char*>(&children_size), sizeof(children_size));
+
+		if (!input_file.good())
+			break;
+
+		if (content_size < 0 || children_size < 0) {
+			std::cout << path << " has a broken chunk" << std::endl;
+			return false;
+		}
+
+		uint64_t content_start = static_cast<uint64_t>(input_file.tellg());
+		std::string chunk(id, 4);
+
+		if (chunk == "MAIN")
+			continue;
+
+		if (chunk == "XYZI") {
+
+			uint32_t count = 0;
+			input_file.read(reinterpret_cast<char*>(&count), sizeof(count));
+
+			if (!have_size || !input_file.good() || static_cast<uint64_t>(count) * sizeof(VoxRecord) + sizeof(count) > static_cast<uint64_t>(content_size)) {
+				std::cout << path << " has a broken model" << std::endl;
+				return false;
+			}
+
+			VoxModel model;
+			model.size = size;
+			model.voxel_count = count;
+			model.records_offset = content_start + sizeof(count);
+			models.push_back(model);
+
+			have_size = false;
+		}
+		else if (chunk == "SIZE" || chunk == "RGBA" || chunk == "nTRN" || chunk == "nGRP" || chunk == "nSHP") {
+
+			std::vector<char> content(content_size);
+			input_file.read(content.data(), content_size);
+			ChunkReader reader(content);
+
+			if (chunk == "SIZE") {
+				size.x = reader.read_int();
+				size.y = reader.read_int();
+				size.z = reader.read_int();
+				have_size = true;
+			}
+			else if (chunk == "RGBA") {
+				for (int i = 0; i < 255; i++)
+					palette[i + 1] = static_cast<uint32_t>(reader.read_int());
+			}
+			else {
+
+				int node_id = reader.read_int();
+				std::map<std::string, std::string> attributes = reader.read_dict();
+				SceneNode &node = nodes[node_id];
+
+				if (chunk == "nTRN") {
+
+					node.type = SceneNode::TRANSFORM;
+					node.hidden = attributes["_h"] == "1";
+					node.children.push_back(reader.read_int());
+
+					reader.read_int(); // reserved
+					reader.read_int(); // layer
+
+					// Only the first frame, there's no animation here
+					int frame_count = reader.read_int();
+					if (frame_count > 0) {
+
+						std::map<std::string, std::string> frame = reader.read_dict();
+
+						if (!frame["_r"].empty())
+							unpack_rotation(atoi(frame["_r"].c_str()), node.transform.rotation);
+
+						std::istringstream translation(frame["_t"]);
+						translation >> node.transform.translation.x >> node.transform.translation.y >> node.transform.translation.z;
+					}
+				}
+				else if (chunk == "nGRP") {
+
+					node.type = SceneNode::GROUP;
+
+					int child_count = reader.read_int();
+					for (int i = 0; i < child_count && reader.ok; i++)
+						node.children.push_back(reader.read_int());
+				}
+				else {
+
+					node.type = SceneNode::SHAPE;
+
+					int model_count = reader.read_int();
+					for (int i = 0; i < model_count && reader.ok; i++) {
+						node.models.push_back(reader.read_int());
+						reader.read_dict();
+					}
+				}
+			}
+
+			if (!reader.ok || !input_file.good()) {
+				std::cout << path << " has a broken " << chunk << " chunk" << std::endl;
+				return false;
+			}
+		}
+
+		input_file.seekg(content_start + static_cast<uint64_t>(content_size) + static_cast<uint64_t>(children_size));
+	}
+
+	// Older files have no scene graph, each model just sits at the origin
+	if (nodes.count(0) == 0) {
+
+		for (size_t i = 0; i < models.size(); i++) {
+			VoxInstance instance;
+			instance.model = static_cast<int>(i);
+			instance.translation = models[i].size / 2;
+			instances.push_back(instance);
+		}
+	}
+	else {
+		place(nodes, 0, VoxInstance(), 0);
+	}
+
+	return true;
+}
+
+void VoxFile::place(const std::map<int, SceneNode> &nodes, int node_id, const VoxInstance &parent, int depth) {
+
+	auto found = nodes.find(node_id);
+
+	// A broken file could loop forever
+	if (found == nodes.end() || depth > 64)
+		return;
+
+	const SceneNode &node = found->second;
+
+	if (node.hidden)
+		return;
+
+	VoxInstance placed = parent;
+
+	if (node.type == SceneNode::TRANSFORM) {
+
+		// parent * node, the node's translation goes through the parent's rotation
+		const VoxInstance &local = node.transform;
+		int local_translation[3] = { local.translation.x, local.translation.y, local.translation.z };
+		int translated[3];
+
+		for (int row = 0; row < 3; row++) {
+			translated[row] = 0;
+
+			for (int column = 0; column < 3; column++) {
+				translated[row] += parent.rotation[row][column] * local_translation[column];
+
+				placed.rotation[row][column] = 0;
+				for (int k = 0; k < 3; k++)
+					placed.rotation[row][column] += parent.rotation[row][k] * local.rotation[k][column];
+			}
+		}
+
+		placed.translation = parent.translation + sf::Vector3i(translated[0], translated[1], translated[2]);
+	}
+
+	for (int model : node.models) {
+
+		if (model < 0 || model >= static_cast<int>(models.size()))
+			continue;
+
+		VoxInstance instance = placed;
+		instance.model = model;
+		instances.push_back(instance);
+	}
+
+	for (int child : node.children)
+		place(nodes, child, placed, depth + 1);
+}
+
+void VoxFile::bounds(sf::Vector3i &min, sf::Vector3i &max) const {
+
+	min = sf::Vector3i(INT32_MAX, INT32_MAX, INT32_MAX);
+	max = sf::Vector3i(INT32_MIN, INT32_MIN, INT32_MIN);
+
+	for (const VoxInstance &instance : instances) {
+
+		sf::Vector3i instance_min, instance_max;
+		instance.bounds(models[instance.model].size, instance_min, instance_max);
+
+		min = sf::Vector3i(std::min(min.x, instance_min.x), std::min(min.y, instance_min.y), std::min(min.z, instance_min.z));
+		max = sf::Vector3i(std::max(max.x, instance_max.x), std::max(max.y, instance_max.y), std::max(max.z, instance_max.z));
+	}
+}
+
+bool VoxFile::read_records(int model, uint32_t first, uint32_t count, std::function<void(const VoxRecord*, size_t)> sink) const {
+
+	std::ifstream input_file(path, std::ios::binary | std::ios::in);
+
+	if (!input_file.is_open())
+		return false;
+
+	input_file.seekg(models[model].records_offset + static_cast<uint64_t>(first) * sizeof(VoxRecord));
+
+	std::vector<VoxRecord> batch(std::min<uint32_t>(count, VOX_RECORD_BATCH));
+
+	while (count > 0) {
+
+		size_t batch_count = std::min<size_t>(count, batch.size());
+		input_file.read(reinterpret_cast<char*>(batch.data()), batch_count * sizeof(VoxRecord));
+
+		if (!input_file.good())
+			return false;
+
+		sink(batch.data(), batch_count);
+		count -= static_cast<uint32_t>(batch_count);
+	}
+
+	return true;
+}
@@ -1,4 +1,5 @@
 #include "raycaster/Hardware_Caster.h"
+#include <algorithm>
 
 Hardware_Caster::Hardware_Caster() {
 
@@ -61,6 +62,18 @@ int Hardware_Caster::init() {
 		return error;
 	}
 
+	error = compile_kernel("../kernels/ray_caster_kernel.cl", true, "raycaster_octree");
+	if (vr_assert(error, "compile_kernel")) {
+		std::cin.get();
+		return error;
+	}
+
+	error = compile_kernel("../kernels/ray_caster_kernel.cl", true, "raycaster_brickmap");
+	if (vr_assert(error, "compile_kernel")) {
+		std::cin.get();
+		return error;
+	}
+
 	srand(time(nullptr));
 
 	int *seed_memory = new int[1920*1080];
@@ -74,11 +87,324 @@ int Hardware_Caster::init() {
 void Hardware_Caster::assign_map(Old_Map *map) {
 
 	this->map = map;
+	chunk_manager = nullptr;
 	auto dimensions = map->getDimensions();
 	
 	create_buffer("map", sizeof(char) * dimensions.x * dimensions.y * dimensions.z, map->get_voxel_data());
 	create_buffer("map_dimensions", sizeof(int) * 3, &dimensions);
 
+	// Lets the dense kernel leap over empty blocks instead of stepping every voxel
+	auto field_dimensions = map->get_distance_field_dimensions();
+	create_buffer("distance_field", sizeof(uint8_t) * field_dimensions.x * field_dimensions.y * field_dimensions.z, map->get_distance_field());
+
+	// Old_Map isn't a ring buffer, window space is map space
+	int map_offset[4] = { 0, 0, 0, map->get_layout() };
+	create_buffer("map_offset", sizeof(int) * 4, map_offset);
+
+	// The shadow rays only need solid or not
+	const OccupancyGrid &occupancy = map->get_occupancy();
+	create_buffer("occupancy", static_cast<cl_uint>(sizeof(uint64_t) * occupancy.words.size()), const_cast<uint64_t*>(occupancy.words.data()));
+
+	// The kernel reads the bytes straight out of map, these just have to be bound
+	int chunk_bits = 0;
+	uint32_t chunk_word = 0;
+	char chunk_palette = 0;
+
+	create_buffer("chunk_words", sizeof(uint32_t), &chunk_word);
+	create_buffer("chunk_palettes", sizeof(char), &chunk_palette);
+	create_buffer("chunk_bits", sizeof(int), &chunk_bits);
+
+	const OccupancyPyramid &pyramid = map->get_occupancy_pyramid();
+	create_buffer("occupancy_mips", static_cast<cl_uint>(pyramid.flags.size()), const_cast<uint8_t*>(pyramid.flags.data()));
+	upload_mip_settings();
+
+}
+
+void Hardware_Caster::assign_chunk_manager(ChunkManager *chunk_manager) {
+
+	this->chunk_manager = chunk_manager;
+
+	// The buffers below start out zeroed, so everything the manager thinks is on the
+	// device has to go up again
+	chunk_manager->invalidate_slots();
+
+	sf::Vector3i dimensions = chunk_manager->get_window_dimensions();
+	sf::Vector3i field_dimensions = dimensions / DISTANCE_BLOCK;
+
+	// Start empty, the chunks come in through upload_chunks as they're generated. The voxels
+	// live paletted a slot at a time, map is only there to be bound
+	size_t slot_count = static_cast<size_t>(dimensions.x / CHUNK_DIM) * (dimensions.y / CHUNK_DIM) * (dimensions.z / CHUNK_DIM);
+
+	char empty_map = 0;
+	std::vector<uint32_t> empty_words(slot_count * CHUNK_VOXELS / 4, 0);
+	std::vector<char> empty_palettes(slot_count * PALETTE_SIZE, 0);
+	std::vector<int> empty_bits(slot_count, 0);
+	std::vector<uint8_t> empty_field(static_cast<size_t>(field_dimensions.x) * field_dimensions.y * field_dimensions.z, 0);
+	std::vector<uint64_t> empty_occupancy(static_cast<size_t>(dimensions.x) * dimensions.y * dimensions.z / (OCCUPANCY_BLOCK * OCCUPANCY_BLOCK * OCCUPANCY_BLOCK), 0);
+
+	sf::Vector3i ring_offset = chunk_manager->get_ring_offset();
+	int map_offset[4] = { ring_offset.x, ring_offset.y, ring_offset.z, PALETTED_LAYOUT };
+
+	create_buffer("map", sizeof(char), &empty_map);
+	create_buffer("map_dimensions", sizeof(int) * 3, &dimensions);
+	create_buffer("distance_field", static_cast<cl_uint>(empty_field.size()), empty_field.data());
+	create_buffer("map_offset", sizeof(int) * 4, map_offset);
+	create_buffer("occupancy", static_cast<cl_uint>(sizeof(uint64_t) * empty_occupancy.size()), empty_occupancy.data());
+	create_buffer("chunk_words", static_cast<cl_uint>(sizeof(uint32_t) * empty_words.size()), empty_words.data());
+	create_buffer("chunk_palettes", static_cast<cl_uint>(empty_palettes.size()), empty_palettes.data());
+	create_buffer("chunk_bits", static_cast<cl_uint>(sizeof(int) * empty_bits.size()), empty_bits.data());
+
+	// No pyramid for chunks, upload_mip_settings tells the kernel it has no levels
+	uint8_t empty_mips = 0;
+	create_buffer("occupancy_mips", sizeof(uint8_t), &empty_mips);
+	upload_mip_settings();
+}
+
+void Hardware_Caster::upload_chunks() {
+
+	if (chunk_manager == nullptr)
+		return;
+
+	sf::Vector3i dimensions = chunk_manager->get_window_dimensions();
+	sf::Vector3i chunk_dimensions(CHUNK_DIM, CHUNK_DIM, CHUNK_DIM);
+
+	// What a slot gets cleared to while its chunk is still generating. A 0 distance
+	// just means no leaping, the voxels are still checked one at a time
+	PalettedVoxels empty_voxels(CHUNK_VOXELS);
+	std::vector<uint8_t> empty_field;
+	std::vector<uint64_t> empty_occupancy;
+
+	int slots = dimensions.x / CHUNK_DIM;
+
+	for (auto &upload : chunk_manager->take_uploads()) {
+
+		if (upload.chunk == nullptr && empty_field.empty()) {
+			empty_field.assign(CHUNK_VOXELS / (DISTANCE_BLOCK * DISTANCE_BLOCK * DISTANCE_BLOCK), 0);
+			empty_occupancy.assign(CHUNK_VOXELS / (OCCUPANCY_BLOCK * OCCUPANCY_BLOCK * OCCUPANCY_BLOCK), 0);
+		}
+
+		const PalettedVoxels &voxels = upload.chunk ? upload.chunk->voxels : empty_voxels;
+		const uint8_t *field = upload.chunk ? upload.chunk->distance_field.data() : empty_field.data();
+		const uint64_t *occupancy = upload.chunk ? upload.chunk->occupancy.words.data() : empty_occupancy.data();
+
+		sf::Vector3i slot_position = upload.buffer_position / CHUNK_DIM;
+		size_t slot = slot_position.x + slots * (slot_position.y + slots * slot_position.z);
+
+		// Only as many words as the chunk's width needs go up, none at all for a chunk of one
+		// material. Slots are sized for 8 bit indices, CHUNK_VOXELS bytes each
+		int bits = voxels.get_bits();
+
+		if (bits != 0)
+			write_buffer("chunk_words", voxels.get_words().size() * sizeof(uint32_t), voxels.get_words().data(), slot * CHUNK_VOXELS);
+
+		write_buffer("chunk_palettes", voxels.get_palette().size(), voxels.get_palette().data(), slot * PALETTE_SIZE);
+		write_buffer("chunk_bits", sizeof(int), &bits, slot * sizeof(int));
+
+		write_buffer_region("distance_field", dimensions / DISTANCE_BLOCK, upload.buffer_position / DISTANCE_BLOCK, chunk_dimensions / DISTANCE_BLOCK, sizeof(uint8_t), field);
+		write_buffer_region("occupancy", dimensions / OCCUPANCY_BLOCK, upload.buffer_position / OCCUPANCY_BLOCK, chunk_dimensions / OCCUPANCY_BLOCK, sizeof(uint64_t), occupancy);
+	}
+
+	sf::Vector3i ring_offset = chunk_manager->get_ring_offset();
+	int map_offset[4] = { ring_offset.x, ring_offset.y, ring_offset.z, PALETTED_LAYOUT };
+
+	write_buffer("map_offset", sizeof(int) * 4, map_offset);
+}
+
+void Hardware_Caster::flush_map_edits() {
+
+	if (map == nullptr || chunk_manager != nullptr)
+		return;
+
+	sf::Vector3i dimensions = map->getDimensions();
+	sf::Vector3i block_dimensions = dimensions / OCCUPANCY_BLOCK;
+	const OccupancyGrid &occupancy = map->get_occupancy();
+	const OccupancyPyramid &pyramid = map->get_occupancy_pyramid();
+
+	// The boxes are block aligned, so the occupancy words they cover are whole
+	for (auto &region : map->take_dirty_voxels()) {
+
+		sf::Vector3i size = region.max - region.min + sf::Vector3i(1, 1, 1);
+
+		if (map->get_layout() == MORTON_LAYOUT)
+			write_morton_region(region);
+		else
+			write_buffer_region("map", dimensions, region.min, size, sizeof(char), map->get_voxel_data(), dimensions, region.min);
+		write_buffer_region(
+			"occupancy", block_dimensions, region.min / OCCUPANCY_BLOCK, size / OCCUPANCY_BLOCK,
+			sizeof(uint64_t), occupancy.words.data(), block_dimensions, region.min / OCCUPANCY_BLOCK
+		);
+
+		// Each level's cells for the box. Levels start on a whole z slice of their own
+		// dimensions, so their offset folds into the z of the box
+		for (int level = 1; level <= pyramid.levels; level++) {
+
+			sf::Vector3i level_dimensions = pyramid.level_dimensions[level];
+			int first_slice = static_cast<int>(pyramid.level_offsets[level] / (static_cast<size_t>(level_dimensions.x) * level_dimensions.y));
+
+			sf::Vector3i cell_min(region.min.x >> level, region.min.y >> level, region.min.z >> level);
+			sf::Vector3i cell_max(region.max.x >> level, region.max.y >> level, region.max.z >> level);
+			sf::Vector3i position = cell_min + sf::Vector3i(0, 0, first_slice);
+
+			write_buffer_region(
+				"occupancy_mips", level_dimensions, position, cell_max - cell_min + sf::Vector3i(1, 1, 1),
+				sizeof(uint8_t), pyramid.flags.data(), level_dimensions, position
+			);
+		}
+	}
+
+	sf::Vector3i field_dimensions = map->get_distance_field_dimensions();
+
+	for (auto &region : map->take_dirty_distance_field()) {
+
+		sf::Vector3i size = region.max - region.min + sf::Vector3i(1, 1, 1);
+
+		write_buffer_region("distance_field", field_dimensions, region.min, size, sizeof(uint8_t), map->get_distance_field(), field_dimensions, region.min);
+	}
+}
+
+void Hardware_Caster::write_morton_region(const DirtyRegion &region) {
+
+	// An aligned block is one contiguous run in Morton order. Sort the box's blocks by
+	// where they start and write each run of back to back blocks in one go
+	const int block_voxels = OCCUPANCY_BLOCK * OCCUPANCY_BLOCK * OCCUPANCY_BLOCK;
+	std::vector<uint32_t> starts;
+
+	for (int z = region.min.z; z <= region.max.z; z += OCCUPANCY_BLOCK) {
+		for (int y = region.min.y; y <= region.max.y; y += OCCUPANCY_BLOCK) {
+			for (int x = region.min.x; x <= region.max.x; x += OCCUPANCY_BLOCK)
+				starts.push_back(morton_encode(sf::Vector3i(x, y, z)));
+		}
+	}
+
+	std::sort(starts.begin(), starts.end());
+
+	const char *voxels = map->get_voxel_data();
+
+	for (size_t i = 0; i < starts.size();) {
+
+		size_t run = 1;
+		while (i + run < starts.size() && starts[i + run] == starts[i] + run * block_voxels)
+			run++;
+
+		write_buffer("map", run * block_voxels, voxels + starts[i], starts[i]);
+		i += run;
+	}
+}
+
+uint64_t Hardware_Caster::take_uploaded_bytes() {
+
+	uint64_t bytes = uploaded_bytes;
+	uploaded_bytes = 0;
+
+	return bytes;
+}
+
+void Hardware_Caster::assign_octree(Octree *octree) {
+
+	this->octree = octree;
+
+	// A freshly loaded octree is still one contiguous mapping and can go up as is.
+	// Otherwise the pool's pages live all over the heap, pack them into one buffer
+	const uint64_t *pages = octree->pool.contiguous_pages();
+	uint64_t slot_count = octree->pool.get_page_count() * octree->pool.get_page_size();
+
+	std::vector<uint64_t> descriptors;
+	if (pages == nullptr) {
+		octree->pool.flatten(descriptors);
+		pages = descriptors.data();
+	}
+
+	cl_uint settings[3] = {
+		static_cast<cl_uint>(octree->root_index),
+		static_cast<cl_uint>(octree->pool.get_page_shift()),
+		static_cast<cl_uint>(octree->oct_dimensions)
+	};
+
+	create_buffer("octree_descriptors", static_cast<cl_uint>(sizeof(uint64_t) * slot_count), const_cast<uint64_t*>(pages));
+	create_buffer("octree_settings", sizeof(cl_uint) * 3, settings);
+
+	// Buffers were re-created, so the kernel has to be pointed at the new ones
+	if (kernel_map.count("raycaster_octree") > 0) {
+		set_kernel_arg("raycaster_octree", 0, "octree_descriptors");
+		set_kernel_arg("raycaster_octree", 1, "octree_settings");
+	}
+}
+
+void Hardware_Caster::assign_brickmap(BrickMap *brickmap) {
+
+	this->brickmap = brickmap;
+
+	sf::Vector3i grid_dimensions = brickmap->get_grid_dimensions();
+
+	cl_uint settings[3] = {
+		static_cast<cl_uint>(grid_dimensions.x),
+		static_cast<cl_uint>(grid_dimensions.y),
+		static_cast<cl_uint>(grid_dimensions.z)
+	};
+
+	// A map with nothing but empty and solid cells has no bricks, but CL won't take an empty buffer
+	std::vector<char> empty_brick(BRICK_VOXELS, 0);
+	const std::vector<char> &bricks = brickmap->get_bricks().empty() ? empty_brick : brickmap->get_bricks();
+
+	create_buffer("brickmap_grid", static_cast<cl_uint>(sizeof(uint32_t) * brickmap->get_grid().size()), const_cast<uint32_t*>(brickmap->get_grid().data()));
+	create_buffer("brickmap_bricks", static_cast<cl_uint>(bricks.size()), const_cast<char*>(bricks.data()));
+	create_buffer("brickmap_settings", sizeof(cl_uint) * 3, settings);
+
+	if (kernel_map.count("raycaster_brickmap") > 0) {
+		set_kernel_arg("raycaster_brickmap", 0, "brickmap_grid");
+		set_kernel_arg("raycaster_brickmap", 1, "brickmap_bricks");
+		set_kernel_arg("raycaster_brickmap", 13, "brickmap_settings");
+	}
+}
+
+void Hardware_Caster::set_storage_mode(STORAGE_MODES mode) {
+
+	if (mode == OCTREE && octree == nullptr) {
+		std::cout << "Can't switch to the octree kernel, no octree has been assigned" << std::endl;
+		return;
+	}
+
+	if (mode == BRICKMAP && brickmap == nullptr) {
+		std::cout << "Can't switch to the brickmap kernel, no brickmap has been assigned" << std::endl;
+		return;
+	}
+
+	if (mode == DENSE && !has_dense_map()) {
+		std::cout << "Can't switch to the dense kernel, no map has been assigned" << std::endl;
+		return;
+	}
+
+	storage_mode = mode;
+}
+
+void Hardware_Caster::set_dense_traversal(DENSE_TRAVERSALS traversal) {
+
+	dense_traversal = traversal;
+
+	if (has_dense_map())
+		upload_mip_settings();
+}
+
+void Hardware_Caster::upload_mip_settings() {
+
+	int settings[2 + MAX_MIP_LEVELS] = { 0 };
+
+	if (map != nullptr && chunk_manager == nullptr) {
+
+		const OccupancyPyramid &pyramid = map->get_occupancy_pyramid();
+
+		settings[0] = pyramid.levels;
+		settings[1] = dense_traversal;
+
+		for (int level = 1; level <= pyramid.levels; level++)
+			settings[1 + level] = static_cast<int>(pyramid.level_offsets[level]);
+	}
+
+	// Write over it if it's there, the kernel keeps pointing at the same one
+	if (buffer_map.count("mip_settings") > 0)
+		write_buffer("mip_settings", sizeof(settings), settings);
+	else
+		create_buffer("mip_settings", sizeof(settings), settings);
 }
 
 void Hardware_Caster::assign_camera(Camera *camera) {
@@ -93,28 +419,64 @@ void Hardware_Caster::validate()
 {
 	// Check to make sure everything has been entered;
 	if (camera == nullptr ||
-		map == nullptr ||
+		(!has_dense_map() && octree == nullptr && brickmap == nullptr) ||
 		viewport_image == nullptr ||
 		viewport_matrix == nullptr) {
 		
-		std::cout << "Raycaster.validate() failed, camera, map, or viewport not initialized";
+		std::cout << "Raycaster.validate() failed, camera, map, or viewport not initialized" << std::endl;
 	
 	} else {
-	
+
+		// The kernels only differ in their map buffers, args 0 and 1 and whatever extra they take at 13
+		std::vector<std::string> kernels;
+
+		if (has_dense_map()) {
+			set_kernel_arg("raycaster", 0, "map");
+			set_kernel_arg("raycaster", 1, "map_dimensions");
+			set_kernel_arg("raycaster", 13, "distance_field");
+			set_kernel_arg("raycaster", 14, "map_offset");
+			set_kernel_arg("raycaster", 15, "occupancy");
+			set_kernel_arg("raycaster", 16, "chunk_words");
+			set_kernel_arg("raycaster", 17, "chunk_palettes");
+			set_kernel_arg("raycaster", 18, "chunk_bits");
+			set_kernel_arg("raycaster", 19, "occupancy_mips");
+			set_kernel_arg("raycaster", 20, "mip_settings");
+			kernels.push_back("raycaster");
+		}
+
+		if (octree != nullptr) {
+			set_kernel_arg("raycaster_octree", 0, "octree_descriptors");
+			set_kernel_arg("raycaster_octree", 1, "octree_settings");
+			kernels.push_back("raycaster_octree");
+		}
+
+		if (brickmap != nullptr) {
+			set_kernel_arg("raycaster_brickmap", 0, "brickmap_grid");
+			set_kernel_arg("raycaster_brickmap", 1, "brickmap_bricks");
+			set_kernel_arg("raycaster_brickmap", 13, "brickmap_settings");
+			kernels.push_back("raycaster_brickmap");
+		}
+
 		// Set all the kernel args
-		set_kernel_arg("raycaster", 0, "map");
-		set_kernel_arg("raycaster", 1, "map_dimensions");
-		set_kernel_arg("raycaster", 2, "viewport_resolution");
-		set_kernel_arg("raycaster", 3, "viewport_matrix");
-		set_kernel_arg("raycaster", 4, "camera_direction");
-		set_kernel_arg("raycaster", 5, "camera_position");
-		set_kernel_arg("raycaster", 6, "lights");
-		set_kernel_arg("raycaster", 7, "light_count");
-		set_kernel_arg("raycaster", 8, "image");
-		set_kernel_arg("raycaster", 9, "seed");
-		set_kernel_arg("raycaster", 10, "texture_atlas");
-		set_kernel_arg("raycaster", 11, "atlas_dim");
-		set_kernel_arg("raycaster", 12, "tile_dim");
+		for (auto &kernel : kernels) {
+			set_kernel_arg(kernel, 2, "viewport_resolution");
+			set_kernel_arg(kernel, 3, "viewport_matrix");
+			set_kernel_arg(kernel, 4, "camera_direction");
+			set_kernel_arg(kernel, 5, "camera_position");
+			set_kernel_arg(kernel, 6, "lights");
+			set_kernel_arg(kernel, 7, "light_count");
+			set_kernel_arg(kernel, 8, "image");
+			set_kernel_arg(kernel, 9, "seed");
+			set_kernel_arg(kernel, 10, "texture_atlas");
+			set_kernel_arg(kernel, 11, "atlas_dim");
+			set_kernel_arg(kernel, 12, "tile_dim");
+		}
+
+		// Fall back to whatever we have data for
+		if ((storage_mode == DENSE && !has_dense_map()) ||
+			(storage_mode == OCTREE && octree == nullptr) ||
+			(storage_mode == BRICKMAP && brickmap == nullptr))
+			storage_mode = has_dense_map() ? DENSE : octree != nullptr ? OCTREE : BRICKMAP;
 
 		//print_kernel_arguments();
 	}
@@ -135,7 +497,13 @@ void Hardware_Caster::create_texture_atlas(sf::Texture *t, sf::Vector2i tile_dim
 
 void Hardware_Caster::compute() {
 	// correlating work size with texture size? good, bad?
-	run_kernel("raycaster", viewport_texture.getSize().x, viewport_texture.getSize().y);
+	std::string kernel = "raycaster";
+	if (storage_mode == OCTREE)
+		kernel = "raycaster_octree";
+	else if (storage_mode == BRICKMAP)
+		kernel = "raycaster_brickmap";
+
+	run_kernel(kernel, viewport_texture.getSize().x, viewport_texture.getSize().y);
 }
 
 // There is a possibility that I would want to move this over to be all inside it's own
@@ -149,70 +517,17 @@ void Hardware_Caster::create_viewport(int width, int height, float v_fov, float
 
 	// And an array of vectors describing the way the "lens" of our
 	// camera works
-
-	// This could be modified to make some odd looking camera lenses
-
-	double y_increment_radians = DegreesToRadians(v_fov / view_res.y);
-	double x_increment_radians = DegreesToRadians(h_fov / view_res.x);
-
-	viewport_matrix = new sf::Vector4f[width * height * 4];
-
-	for (int y = -view_res.y / 2; y < view_res.y / 2; y++) {
-		for (int x = -view_res.x / 2; x < view_res.x / 2; x++) {
-
-			// The base ray direction to slew from
-			sf::Vector3f ray(1, 0, 0);
-
-			// Y axis, pitch
-			ray = sf::Vector3f(
-				static_cast<float>(ray.z * sin(y_increment_radians * y) + ray.x * cos(y_increment_radians * y)),
-				static_cast<float>(ray.y),
-				static_cast<float>(ray.z * cos(y_increment_radians * y) - ray.x * sin(y_increment_radians * y))
-			);
-
-			// Z axis, yaw
-			ray = sf::Vector3f(
-				static_cast<float>(ray.x * cos(x_increment_radians * x) - ray.y * sin(x_increment_radians * x)),
-				static_cast<float>(ray.x * sin(x_increment_radians * x) + ray.y * cos(x_increment_radians * x)),
-				static_cast<float>(ray.z)
-			);
-
-			// correct for the base ray pointing to (1, 0, 0) as (0, 0). Should equal (1.57, 0)
-			ray = sf::Vector3f(
-				static_cast<float>(ray.z * sin(-1.57) + ray.x * cos(-1.57)),
-				static_cast<float>(ray.y),
-				static_cast<float>(ray.z * cos(-1.57) - ray.x * sin(-1.57))
-			);
-
-			int index = (x + view_res.x / 2) + view_res.x * (y + view_res.y / 2);
-			ray = Normalize(ray);
-
-			viewport_matrix[index] = sf::Vector4f(
-				ray.x,
-				ray.y,
-				ray.z,
-				0
-			);
-		}
-	}
+	create_viewport_matrix(width, height, v_fov, h_fov);
 
 	create_buffer("viewport_matrix", sizeof(float) * 4 * view_res.x * view_res.y, viewport_matrix, CL_MEM_USE_HOST_PTR);
 
 	// Create the image that opencl's rays write to
-	viewport_image = new sf::Uint8[width * height * 4];
-
-	for (int i = 0; i < width * height * 4; i += 4) {
-
-		viewport_image[i] = 255;     // R
-		viewport_image[i + 1] = 255; // G
-		viewport_image[i + 2] = 255; // B
-		viewport_image[i + 3] = 100; // A
-	}
+	create_viewport_image(width, height);
 
 	// Interop lets us keep a reference to it as a texture
 	viewport_texture.create(width, height);
 	viewport_texture.update(viewport_image);
-	viewport_sprite.setTexture(viewport_texture);
+	viewport_sprite.setTexture(viewport_texture, true);
 
 	// Pass the buffer to opencl
 	create_image_buffer("image", sizeof(sf::Uint8) * width * height * 4, &viewport_texture, CL_MEM_WRITE_ONLY);
@@ -235,9 +550,21 @@ void Hardware_Caster::assign_lights(std::vector<PackedData> *data) {
 }
 
 void Hardware_Caster::draw(sf::RenderWindow* window) {
+	fit_viewport_sprite(window);
 	window->draw(viewport_sprite);
 }
 
+void Hardware_Caster::resize_viewport(sf::Vector2i resolution) {
+
+	if (resolution == viewport_resolution)
+		return;
+
+	RayCaster::resize_viewport(resolution);
+
+	// The viewport buffers and the image are new cl_mems, the kernels need them again
+	validate();
+}
+
 int Hardware_Caster::debug_quick_recompile()
 {
 	int error = compile_kernel("../kernels/ray_caster_kernel.cl", true, "raycaster");
@@ -245,6 +572,19 @@ int Hardware_Caster::debug_quick_recompile()
 		std::cin.get(); // hang the output window so we can read the error
 		return error;
 	}
+
+	error = compile_kernel("../kernels/ray_caster_kernel.cl", true, "raycaster_octree");
+	if (vr_assert(error, "compile_kernel")) {
+		std::cin.get();
+		return error;
+	}
+
+	error = compile_kernel("../kernels/ray_caster_kernel.cl", true, "raycaster_brickmap");
+	if (vr_assert(error, "compile_kernel")) {
+		std::cin.get();
+		return error;
+	}
+
 	validate();
 
 	return 0;
@@ -702,6 +1042,9 @@ int Hardware_Caster::create_buffer(std::string buffer_name, cl_uint size, void*
 
 	store_buffer(buff, buffer_name);
 
+	if (flags & CL_MEM_COPY_HOST_PTR)
+		uploaded_bytes += size;
+
 	return 1;
 
 }
@@ -723,11 +1066,55 @@ int Hardware_Caster::create_buffer(std::string buffer_name, cl_uint size, void*
 		return OPENCL_ERROR;
 
 	store_buffer(buff, buffer_name);
+	uploaded_bytes += size;
 
 	return 1;
 
 }
 
+int Hardware_Caster::write_buffer(std::string buffer_name, size_t size, const void* data, size_t offset) {
+
+	error = clEnqueueWriteBuffer(
+		getCommandQueue(), buffer_map.at(buffer_name), CL_TRUE,
+		offset, size, data, 0, NULL, NULL
+		);
+
+	if (vr_assert(error, "clEnqueueWriteBuffer"))
+		return OPENCL_ERROR;
+
+	uploaded_bytes += size;
+
+	return 1;
+}
+
+int Hardware_Caster::write_buffer_region(std::string buffer_name, sf::Vector3i buffer_dimensions, sf::Vector3i position, sf::Vector3i region, size_t element_size, const void* data) {
+	return write_buffer_region(buffer_name, buffer_dimensions, position, region, element_size, data, region, sf::Vector3i(0, 0, 0));
+}
+
+int Hardware_Caster::write_buffer_region(std::string buffer_name, sf::Vector3i buffer_dimensions, sf::Vector3i position, sf::Vector3i region, size_t element_size, const void* data, sf::Vector3i data_dimensions, sf::Vector3i data_position) {
+
+	// The x extents are in bytes, y and z in rows and slices
+	size_t buffer_origin[3] = { position.x * element_size, static_cast<size_t>(position.y), static_cast<size_t>(position.z) };
+	size_t host_origin[3] = { data_position.x * element_size, static_cast<size_t>(data_position.y), static_cast<size_t>(data_position.z) };
+	size_t region_size[3] = { region.x * element_size, static_cast<size_t>(region.y), static_cast<size_t>(region.z) };
+
+	// Blocking, the chunks the data comes out of can be evicted right after
+	error = clEnqueueWriteBufferRect(
+		getCommandQueue(), buffer_map.at(buffer_name), CL_TRUE,
+		buffer_origin, host_origin, region_size,
+		buffer_dimensions.x * element_size, buffer_dimensions.x * buffer_dimensions.y * element_size,
+		data_dimensions.x * element_size, data_dimensions.x * data_dimensions.y * element_size,
+		data, 0, NULL, NULL
+		);
+
+	if (vr_assert(error, "clEnqueueWriteBufferRect"))
+		return OPENCL_ERROR;
+
+	uploaded_bytes += region_size[0] * region_size[1] * region_size[2];
+
+	return 1;
+}
+
 int Hardware_Caster::release_buffer(std::string buffer_name) {
 
 	if (buffer_map.count(buffer_name) > 0) {
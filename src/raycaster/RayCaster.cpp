@@ -0,0 +1,101 @@
+#include "raycaster/RayCaster.h"
+#include "util.hpp"
+
+RayCaster::RayCaster() {
+}
+
+RayCaster::~RayCaster() {
+	delete[] viewport_matrix;
+	delete[] viewport_image;
+}
+
+void RayCaster::resize_viewport(sf::Vector2i resolution) {
+
+	if (resolution != viewport_resolution)
+		create_viewport(resolution.x, resolution.y, viewport_fov.x, viewport_fov.y);
+}
+
+void RayCaster::create_viewport_matrix(int width, int height, float v_fov, float h_fov) {
+
+	// This could be modified to make some odd looking camera lenses
+
+	sf::Vector2i view_res(width, height);
+	viewport_resolution = view_res;
+
+	double y_increment_radians = DegreesToRadians(v_fov / view_res.y);
+	double x_increment_radians = DegreesToRadians(h_fov / view_res.x);
+
+	viewport_increment = sf::Vector2f(static_cast<float>(x_increment_radians), static_cast<float>(y_increment_radians));
+	viewport_fov = sf::Vector2f(v_fov, h_fov);
+
+	delete[] viewport_matrix;
+	viewport_matrix = new sf::Vector4f[width * height];
+
+	// Every pixel, as an offset from the centre one. Odd sizes get the extra row and
+	// column on the far side
+	for (int row = 0; row < view_res.y; row++) {
+		for (int column = 0; column < view_res.x; column++) {
+
+			int x = column - view_res.x / 2;
+			int y = row - view_res.y / 2;
+
+			// The base ray direction to slew from
+			sf::Vector3f ray(1, 0, 0);
+
+			// Y axis, pitch
+			ray = sf::Vector3f(
+				static_cast<float>(ray.z * sin(y_increment_radians * y) + ray.x * cos(y_increment_radians * y)),
+				static_cast<float>(ray.y),
+				static_cast<float>(ray.z * cos(y_increment_radians * y) - ray.x * sin(y_increment_radians * y))
+			);
+
+			// Z axis, yaw
+			ray = sf::Vector3f(
+				static_cast<float>(ray.x * cos(x_increment_radians * x) - ray.y * sin(x_increment_radians * x)),
+				static_cast<float>(ray.x * sin(x_increment_radians * x) + ray.y * cos(x_increment_radians * x)),
+				static_cast<float>(ray.z)
+			);
+
+			// correct for the base ray pointing to (1, 0, 0) as (0, 0). Should equal (1.57, 0)
+			ray = sf::Vector3f(
+				static_cast<float>(ray.z * sin(-1.57) + ray.x * cos(-1.57)),
+				static_cast<float>(ray.y),
+				static_cast<float>(ray.z * cos(-1.57) - ray.x * sin(-1.57))
+			);
+
+			int index = column + view_res.x * row;
+			ray = Normalize(ray);
+
+			viewport_matrix[index] = sf::Vector4f(
+				ray.x,
+				ray.y,
+				ray.z,
+				0
+			);
+		}
+	}
+}
+
+void RayCaster::create_viewport_image(int width, int height) {
+
+	delete[] viewport_image;
+	viewport_image = new sf::Uint8[width * height * 4];
+
+	for (int i = 0; i < width * height * 4; i += 4) {
+
+		viewport_image[i] = 255;     // R
+		viewport_image[i + 1] = 255; // G
+		viewport_image[i + 2] = 255; // B
+		viewport_image[i + 3] = 100; // A
+	}
+}
+
+void RayCaster::fit_viewport_sprite(sf::RenderWindow* window) {
+
+	viewport_texture.setSmooth(true);
+
+	viewport_sprite.setScale(
+		static_cast<float>(window->getSize().x) / viewport_resolution.x,
+		static_cast<float>(window->getSize().y) / viewport_resolution.y
+	);
+}
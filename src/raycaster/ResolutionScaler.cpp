@@ -0,0 +1,113 @@
+#include "raycaster/ResolutionScaler.h"
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include "imgui/imgui.h"
+
+ResolutionScaler::ResolutionScaler(sf::Vector2i output_resolution, float budget_ms, float min_scale, float max_scale) :
+	output_resolution(output_resolution), budget_ms(budget_ms), min_scale(min_scale), max_scale(max_scale), scale(max_scale) {
+
+	render_resolution = get_render_resolution();
+}
+
+bool ResolutionScaler::frame(double render_ms) {
+
+	last_ms = render_ms;
+
+	if (arr_pos == RESOLUTION_HISTORY)
+		arr_pos = 0;
+
+	render_ms_array[arr_pos] = static_cast<float>(render_ms);
+	arr_pos++;
+
+	if (!enabled) {
+		scale = max_scale;
+	}
+	else if (settle > 0) {
+		settle--;
+	}
+	else {
+
+		samples++;
+
+		if (samples == 1)
+			average_ms = render_ms;
+		else
+			average_ms += (render_ms - average_ms) * RESOLUTION_SMOOTHING;
+
+		if (average_ms < budget_ms * RESOLUTION_RAISE_BELOW)
+			under_budget++;
+		else
+			under_budget = 0;
+
+		// Where the pixel count would put it right on the headroom, on the step below
+		float fit = scale * static_cast<float>(std::sqrt(budget_ms * RESOLUTION_HEADROOM / std::max(average_ms, 0.001)));
+		fit = std::floor(fit / RESOLUTION_SCALE_STEP + 0.001f) * RESOLUTION_SCALE_STEP;
+
+		float next = scale;
+
+		if (samples >= 2 && average_ms > budget_ms)
+			next = std::min(fit, scale - RESOLUTION_SCALE_STEP);
+		else if (under_budget >= RESOLUTION_RAISE_FRAMES)
+			next = std::min(fit, scale + RESOLUTION_RAISE_MAX);
+
+		next = std::max(min_scale, std::min(max_scale, next));
+
+		if (std::abs(next - scale) > RESOLUTION_SCALE_STEP / 2) {
+			scale = next;
+			samples = 0;
+			under_budget = 0;
+			settle = RESOLUTION_SETTLE_FRAMES;
+		}
+	}
+
+	sf::Vector2i resolution = get_render_resolution();
+
+	if (resolution == render_resolution)
+		return false;
+
+	render_resolution = resolution;
+	return true;
+}
+
+sf::Vector2i ResolutionScaler::get_render_resolution() const {
+
+	auto align = [&](int side) {
+		int aligned = static_cast<int>(side * scale / RESOLUTION_ALIGNMENT + 0.5f) * RESOLUTION_ALIGNMENT;
+		return std::max(RESOLUTION_ALIGNMENT, std::min(aligned, side));
+	};
+
+	return sf::Vector2i(align(output_resolution.x), align(output_resolution.y));
+}
+
+void ResolutionScaler::set_enabled(bool enabled) {
+
+	this->enabled = enabled;
+
+	samples = 0;
+	under_budget = 0;
+}
+
+void ResolutionScaler::draw() {
+
+	ImGui::Begin("Performance");
+
+	bool enabled = this->enabled;
+	if (ImGui::Checkbox("Dynamic resolution", &enabled))
+		set_enabled(enabled);
+
+	ImGui::SliderFloat("Budget ms", &budget_ms, 1.0f, 50.0f);
+
+	if (ImGui::SliderFloat("Min scale", &min_scale, RESOLUTION_SCALE_STEP, 1.0f))
+		max_scale = std::max(max_scale, min_scale);
+
+	if (ImGui::SliderFloat("Max scale", &max_scale, RESOLUTION_SCALE_STEP, 1.0f))
+		min_scale = std::min(min_scale, max_scale);
+
+	ImGui::Text("Scale : %.2f, %d x %d of %d x %d", scale, render_resolution.x, render_resolution.y, output_resolution.x, output_resolution.y);
+	ImGui::Text("Render : %.2f ms, %.2f ms avg", last_ms, average_ms);
+
+	ImGui::PlotLines("Render ms", render_ms_array, RESOLUTION_HISTORY, arr_pos, std::to_string(last_ms).c_str(), 0.0f, budget_ms * 2, ImVec2(200, 80));
+
+	ImGui::End();
+}
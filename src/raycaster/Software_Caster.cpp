@@ -0,0 +1,1269 @@
+#include "raycaster/Software_Caster.h"
+#include "LightController.h"
+#include "util.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#ifdef __AVX2__
+#  include <immintrin.h>
+#endif
+
+namespace {
+
+	// The kernel's constants
+	const sf::Vector4f fog_color(0.73f, 0.81f, 0.89f, 0.8f);
+	const sf::Vector4f overshoot_color(0.25f, 0.48f, 0.52f, 0.8f);
+	const sf::Vector4f overshoot_color_2(0.25f, 0.1f, 0.52f, 0.8f);
+	const sf::Vector4f out_of_steps_color(0.40f, 0.00f, 0.40f, 0.2f);
+
+	float dot(sf::Vector3f a, sf::Vector3f b) {
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	float length(sf::Vector3f a) {
+		return std::sqrt(dot(a, a));
+	}
+
+	// A zero vector stays zero instead of going NaN
+	sf::Vector3f normalize(sf::Vector3f a) {
+		float l = length(a);
+		return l > 0.0f ? a / l : a;
+	}
+
+	sf::Vector3f to_float(sf::Vector3i a) {
+		return sf::Vector3f(static_cast<float>(a.x), static_cast<float>(a.y), static_cast<float>(a.z));
+	}
+
+	sf::Vector4f mix(sf::Vector4f a, sf::Vector4f b, float t) {
+		return a + (b - a) * t;
+	}
+
+	// The Woo step. Picks the axes with the nearest crossing, face_mask is -1 on them
+	void woo_step(sf::Vector3i &voxel, sf::Vector3f &intersection_t, sf::Vector3i &face_mask, sf::Vector3f delta_t, sf::Vector3i voxel_step) {
+
+		face_mask.x = intersection_t.x <= std::fmin(intersection_t.y, intersection_t.z) ? -1 : 0;
+		face_mask.y = intersection_t.y <= std::fmin(intersection_t.z, intersection_t.x) ? -1 : 0;
+		face_mask.z = intersection_t.z <= std::fmin(intersection_t.x, intersection_t.y) ? -1 : 0;
+
+		intersection_t.x += delta_t.x * -face_mask.x;
+		intersection_t.y += delta_t.y * -face_mask.y;
+		intersection_t.z += delta_t.z * -face_mask.z;
+
+		voxel.x += voxel_step.x * face_mask.x;
+		voxel.y += voxel_step.y * face_mask.y;
+		voxel.z += voxel_step.z * face_mask.z;
+	}
+
+	// Where a ray starting at ray_pos first crosses each axis, and the Woo loop's step.
+	// As in the kernel voxel_step is -1 on the axes the ray heads positive along
+	void woo_setup(sf::Vector3f ray_pos, sf::Vector3f ray_dir, sf::Vector3i &voxel, sf::Vector3f &intersection_t, sf::Vector3f &delta_t, sf::Vector3i &voxel_step) {
+
+		voxel_step.x = ray_dir.x > 0 ? -1 : ray_dir.x < 0 ? 1 : 0;
+		voxel_step.y = ray_dir.y > 0 ? -1 : ray_dir.y < 0 ? 1 : 0;
+		voxel_step.z = ray_dir.z > 0 ? -1 : ray_dir.z < 0 ? 1 : 0;
+
+		voxel = sf::Vector3i(static_cast<int>(ray_pos.x), static_cast<int>(ray_pos.y), static_cast<int>(ray_pos.z));
+
+		delta_t = sf::Vector3f(std::fabs(1.0f / ray_dir.x), std::fabs(1.0f / ray_dir.y), std::fabs(1.0f / ray_dir.z));
+
+		intersection_t = sf::Vector3f(
+			delta_t.x * (ray_pos.x - std::floor(ray_pos.x)) * voxel_step.x,
+			delta_t.y * (ray_pos.y - std::floor(ray_pos.y)) * voxel_step.y,
+			delta_t.z * (ray_pos.z - std::floor(ray_pos.z)) * voxel_step.z
+		);
+
+		// for negative values, wrap around the delta_t
+		if (intersection_t.x < 0) intersection_t.x += delta_t.x;
+		if (intersection_t.y < 0) intersection_t.y += delta_t.y;
+		if (intersection_t.z < 0) intersection_t.z += delta_t.z;
+	}
+
+	bool outside(sf::Vector3i voxel, sf::Vector3i dimensions) {
+		return voxel.x >= dimensions.x || voxel.y >= dimensions.y || voxel.z >= dimensions.z ||
+			voxel.x < 0 || voxel.y < 0 || voxel.z < 0;
+	}
+
+	// The kernel's empty_box_leap, every Woo step inside of the empty box in one go
+	void empty_box_leap(sf::Vector3i box_min, sf::Vector3i box_max, sf::Vector3i &voxel, sf::Vector3f &intersection_t, sf::Vector3f delta_t, sf::Vector3i voxel_step) {
+
+		int v[3] = { voxel.x, voxel.y, voxel.z };
+		float it[3] = { intersection_t.x, intersection_t.y, intersection_t.z };
+		float dt[3] = { delta_t.x, delta_t.y, delta_t.z };
+		int st[3] = { -voxel_step.x, -voxel_step.y, -voxel_step.z };
+		int low[3] = { box_min.x, box_min.y, box_min.z };
+		int high[3] = { box_max.x, box_max.y, box_max.z };
+
+		int limit[3];
+		float exit_t = FLT_MAX;
+
+		for (int a = 0; a < 3; a++) {
+
+			if (st[a] == 0)
+				continue;
+
+			int reach = st[a] > 0 ? high[a] : low[a];
+			limit[a] = std::abs(reach - v[a]);
+
+			// Added up a crossing at a time like woo_step, so it rounds the same
+			float axis_exit = it[a];
+			for (int i = 0; i < limit[a]; i++)
+				axis_exit += dt[a];
+
+			exit_t = std::fmin(exit_t, axis_exit);
+		}
+
+		for (int a = 0; a < 3; a++) {
+
+			if (st[a] == 0)
+				continue;
+
+			for (int i = 0; i < limit[a] && it[a] < exit_t; i++) {
+				v[a] += st[a];
+				it[a] += dt[a];
+			}
+		}
+
+		voxel = sf::Vector3i(v[0], v[1], v[2]);
+		intersection_t = sf::Vector3f(it[0], it[1], it[2]);
+	}
+
+	sf::Vector4f white_light(sf::Vector4f input, sf::Vector3f light, sf::Vector3i mask) {
+
+		sf::Vector3f facing = to_float(sf::Vector3i(mask.x * -mask.x, mask.y * -mask.y, mask.z * -mask.z));
+		float cosine = std::fmax(-1.0f, std::fmin(1.0f, dot(normalize(light), normalize(facing))));
+
+		input.w = input.w + std::acos(cosine) / 32;
+		input.w += 0.25f;
+
+		return input;
+	}
+
+	sf::Vector4f view_light(sf::Vector4f in_color, sf::Vector3f light, sf::Vector4f light_color, sf::Vector3f view, sf::Vector3i mask) {
+
+		float d = length(light) / 100.0f;
+		d *= d;
+
+		sf::Vector3f normal = normalize(to_float(mask));
+
+		float diffuse = std::fmax(dot(normal, normalize(light)), 0.0f);
+		in_color += light_color * (diffuse * 0.5f / d);
+
+		if (dot(light, normal) > 0.0f) {
+			sf::Vector3f halfway = normalize(normalize(light) + normalize(view));
+			float specular = std::fmax(dot(normal, halfway), 0.0f);
+			in_color += light_color * (std::pow(specular, 8.0f) * 0.5f / d);
+		}
+
+		if (in_color.w > 1.0f) {
+			in_color.x *= in_color.w;
+			in_color.y *= in_color.w;
+			in_color.z *= in_color.w;
+		}
+
+		return in_color;
+	}
+
+#ifdef __AVX2__
+
+	// std::fmin, a NaN loses to the other operand. _mm256_min_ps already gives b when a is NaN
+	inline __m256 fmin_ps(__m256 a, __m256 b) {
+		return _mm256_blendv_ps(_mm256_min_ps(a, b), a, _mm256_cmp_ps(b, b, _CMP_UNORD_Q));
+	}
+
+	inline __m256i select_epi32(__m256i a, __m256i b, __m256i mask) {
+		return _mm256_blendv_epi8(a, b, mask);
+	}
+
+	inline int lane_mask(__m256i mask) {
+		return _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+	}
+
+#endif
+
+	// write_imagef into an 8 bit image
+	sf::Uint8 to_unorm8(float value) {
+		return static_cast<sf::Uint8>(std::fmin(std::fmax(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+	}
+}
+
+Software_Caster::Software_Caster(unsigned int thread_count) : workers(thread_count) {
+}
+
+Software_Caster::~Software_Caster() {
+}
+
+int Software_Caster::init() {
+
+	std::cout << "Casting on the CPU with " << workers.get_thread_count() << " threads" << std::endl;
+	return 1;
+}
+
+void Software_Caster::create_viewport(int width, int height, float v_fov, float h_fov) {
+
+	create_viewport_matrix(width, height, v_fov, h_fov);
+	create_viewport_image(width, height);
+
+	history_valid = false;
+}
+
+void Software_Caster::assign_lights(std::vector<PackedData> *data) {
+
+	lights = data;
+	light_count = static_cast<int>(lights->size());
+}
+
+void Software_Caster::assign_map(Old_Map *map) {
+	this->map = map;
+	history_valid = false;
+}
+
+void Software_Caster::assign_camera(Camera *camera) {
+	this->camera = camera;
+}
+
+void Software_Caster::create_texture_atlas(sf::Texture *t, sf::Vector2i tile_dim) {
+	create_texture_atlas(t->copyToImage(), tile_dim);
+}
+
+void Software_Caster::create_texture_atlas(const sf::Image &atlas, sf::Vector2i tile_dim) {
+
+	texture_atlas = atlas;
+	atlas_dim = sf::Vector2i(texture_atlas.getSize());
+	this->tile_dim = tile_dim;
+}
+
+void Software_Caster::validate() {
+
+	valid = camera != nullptr && map != nullptr && viewport_image != nullptr && viewport_matrix != nullptr;
+
+	if (!valid)
+		std::cout << "Software_Caster.validate() failed, camera, map, or viewport not initialized" << std::endl;
+
+	storage_mode = DENSE;
+}
+
+void Software_Caster::set_storage_mode(STORAGE_MODES mode) {
+
+	if (mode != DENSE)
+		std::cout << "Only the dense map can be cast on the CPU" << std::endl;
+}
+
+void Software_Caster::flush_map_edits() {
+
+	if (map == nullptr)
+		return;
+
+	// Nothing to send anywhere, the rays read the map as is. Still take them so they
+	// don't pile up, and so we know the history is stale
+	bool edited = !map->take_dirty_voxels().empty();
+	edited |= !map->take_dirty_distance_field().empty();
+
+	if (edited)
+		history_valid = false;
+}
+
+void Software_Caster::set_reprojection(bool enabled) {
+
+	reprojection = enabled;
+	history_valid = false;
+}
+
+void Software_Caster::compute() {
+
+	if (!valid)
+		return;
+
+	FrameState frame = frame_state();
+	size_t pixel_count = static_cast<size_t>(viewport_resolution.x) * viewport_resolution.y;
+
+	frame.reproject = reprojection && history_valid && history.size() == pixel_count;
+	frame.light_moved = !frame.reproject || memcmp(&frame.light[4], &history_frame.light[4], sizeof(float) * 3) != 0;
+	frame.frame_number = frame_number++;
+
+	if (reprojection)
+		next_history.resize(pixel_count);
+
+	int tiles_x = (viewport_resolution.x + TILE_SIZE - 1) / TILE_SIZE;
+	int tiles_y = (viewport_resolution.y + TILE_SIZE - 1) / TILE_SIZE;
+
+	std::atomic<int> traced(0);
+
+	workers.parallel_for(tiles_x * tiles_y, [&](int tile) {
+		traced += render_tile(tile, frame);
+	});
+
+	traced_rays = traced;
+
+	if (reprojection) {
+		history.swap(next_history);
+		history_frame = frame;
+		history_valid = true;
+	}
+}
+
+void Software_Caster::draw(sf::RenderWindow* window) {
+
+	// Made here instead of create_viewport, it needs a GL context
+	if (sf::Vector2i(viewport_texture.getSize()) != viewport_resolution) {
+		viewport_texture.create(viewport_resolution.x, viewport_resolution.y);
+		viewport_sprite.setTexture(viewport_texture, true);
+	}
+
+	viewport_texture.update(viewport_image);
+	fit_viewport_sprite(window);
+	window->draw(viewport_sprite);
+}
+
+Software_Caster::FrameState Software_Caster::frame_state() const {
+
+	FrameState frame;
+
+	frame.camera_position = *camera->get_position_pointer();
+
+	sf::Vector2f direction = *camera->get_direction_pointer();
+	frame.pitch_sin = std::sin(direction.x);
+	frame.pitch_cos = std::cos(direction.x);
+	frame.yaw_sin = std::sin(direction.y);
+	frame.yaw_cos = std::cos(direction.y);
+
+	// The kernel only ever looks at the first light
+	memset(frame.light, 0, sizeof(frame.light));
+
+	if (lights != nullptr && !lights->empty())
+		memcpy(frame.light, lights->data(), sizeof(frame.light));
+
+	return frame;
+}
+
+int Software_Caster::render_tile(int tile, const FrameState &frame) {
+
+	int tiles_x = (viewport_resolution.x + TILE_SIZE - 1) / TILE_SIZE;
+
+	sf::Vector2i start((tile % tiles_x) * TILE_SIZE, (tile / tiles_x) * TILE_SIZE);
+	sf::Vector2i end(std::min(start.x + TILE_SIZE, viewport_resolution.x), std::min(start.y + TILE_SIZE, viewport_resolution.y));
+
+	int traced = 0;
+
+	for (int y = start.y; y < end.y; y += PACKET_HEIGHT) {
+		for (int x = start.x; x < end.x; x += PACKET_WIDTH) {
+
+			sf::Vector2i pixel[PACKET_RAYS];
+			sf::Vector3f ray_dir[PACKET_RAYS];
+			RayHit hits[PACKET_RAYS];
+			bool inside[PACKET_RAYS];
+			bool trace_ray[PACKET_RAYS];
+
+			int to_trace = 0;
+
+			for (int lane = 0; lane < PACKET_RAYS; lane++) {
+
+				pixel[lane] = sf::Vector2i(x + lane % PACKET_WIDTH, y + lane / PACKET_WIDTH);
+				inside[lane] = pixel[lane].x < end.x && pixel[lane].y < end.y;
+				trace_ray[lane] = false;
+
+				if (!inside[lane])
+					continue;
+
+				ray_dir[lane] = ray_direction(pixel[lane], frame);
+				trace_ray[lane] = !reproject(pixel[lane], ray_dir[lane], frame, hits[lane]);
+				to_trace += trace_ray[lane];
+			}
+
+			bool whole = x + PACKET_WIDTH <= end.x && y + PACKET_HEIGHT <= end.y;
+
+			// A packet costs about what its slowest lane does, so if any of it has to be traced
+			// all of it is. The reprojected lanes keep their shadow if they landed the same
+			if (packet_rays && whole && to_trace > 0) {
+
+				RayHit reprojected[PACKET_RAYS];
+				for (int lane = 0; lane < PACKET_RAYS; lane++)
+					reprojected[lane] = hits[lane];
+
+				trace_packet(frame.camera_position, ray_dir, hits);
+
+				for (int lane = 0; lane < PACKET_RAYS; lane++) {
+
+					if (trace_ray[lane] || hits[lane].result != RayHit::HIT || hits[lane].voxel != reprojected[lane].voxel)
+						continue;
+
+					if (record(hits[lane]).face == record(reprojected[lane]).face)
+						hits[lane].shadowed = reprojected[lane].shadowed;
+				}
+
+				traced += PACKET_RAYS;
+			}
+			else {
+
+				for (int lane = 0; lane < PACKET_RAYS; lane++)
+					if (trace_ray[lane])
+						hits[lane] = trace(frame.camera_position, ray_dir[lane]);
+
+				traced += to_trace;
+			}
+
+			for (int lane = 0; lane < PACKET_RAYS; lane++) {
+
+				if (!inside[lane])
+					continue;
+
+				sf::Vector4f color = shade(hits[lane], ray_dir[lane], frame);
+				size_t index = pixel[lane].x + static_cast<size_t>(viewport_resolution.x) * pixel[lane].y;
+
+				sf::Uint8 *out = viewport_image + 4 * index;
+				out[0] = to_unorm8(color.x);
+				out[1] = to_unorm8(color.y);
+				out[2] = to_unorm8(color.z);
+				out[3] = to_unorm8(color.w);
+
+				if (reprojection)
+					next_history[index] = record(hits[lane]);
+			}
+		}
+	}
+
+	return traced;
+}
+
+sf::Vector3f Software_Caster::ray_direction(sf::Vector2i pixel, const FrameState &frame) const {
+
+	sf::Vector4f lens = viewport_matrix[pixel.x + viewport_resolution.x * pixel.y];
+	sf::Vector3f ray_dir(lens.x, lens.y, lens.z);
+
+	// Pitch
+	ray_dir = sf::Vector3f(
+		ray_dir.z * frame.pitch_sin + ray_dir.x * frame.pitch_cos,
+		ray_dir.y,
+		ray_dir.z * frame.pitch_cos - ray_dir.x * frame.pitch_sin
+	);
+
+	// Yaw
+	ray_dir = sf::Vector3f(
+		ray_dir.x * frame.yaw_cos - ray_dir.y * frame.yaw_sin,
+		ray_dir.x * frame.yaw_sin + ray_dir.y * frame.yaw_cos,
+		ray_dir.z
+	);
+
+	return ray_dir;
+}
+
+Software_Caster::RayHit Software_Caster::trace(sf::Vector3f ray_pos, sf::Vector3f ray_dir) const {
+
+	RayHit hit;
+	woo_setup(ray_pos, ray_dir, hit.voxel, hit.intersection_t, hit.delta_t, hit.voxel_step);
+
+	int mip_level = 1;
+	march(hit, mip_level);
+
+	return hit;
+}
+
+void Software_Caster::march(RayHit &hit, int &mip_level) const {
+
+	sf::Vector3i dimensions = map->getDimensions();
+
+	do {
+
+		woo_step(hit.voxel, hit.intersection_t, hit.face_mask, hit.delta_t, hit.voxel_step);
+
+		if (hit.voxel.x >= dimensions.x || hit.voxel.y >= dimensions.y || hit.voxel.z >= dimensions.z) {
+			hit.result = RayHit::PAST_MAX;
+			return;
+		}
+
+		if (hit.voxel.x < 0 || hit.voxel.y < 0 || hit.voxel.z < 0) {
+			hit.result = RayHit::PAST_MIN;
+			return;
+		}
+
+		hit.voxel_data = map->get_voxel(hit.voxel);
+
+		if (hit.voxel_data != 0) {
+			hit.result = RayHit::HIT;
+			return;
+		}
+
+		empty_space_leap(mip_level, hit.voxel, hit.intersection_t, hit.delta_t, hit.voxel_step);
+
+	} while (++hit.steps < MAX_RAY_STEPS);
+
+	hit.result = RayHit::OUT_OF_STEPS;
+}
+
+#ifdef __AVX2__
+
+void Software_Caster::trace_packet(sf::Vector3f ray_pos, const sf::Vector3f *ray_dir, RayHit *hits) const {
+
+	// Lanes leaping by their own mip levels don't stay in step well, leave those scalar
+	if (dense_traversal != DISTANCE_FIELD_TRAVERSAL) {
+		for (int lane = 0; lane < PACKET_RAYS; lane++)
+			hits[lane] = trace(ray_pos, ray_dir[lane]);
+		return;
+	}
+
+	// Set each lane up just like a scalar ray so they start off from the same bits
+	alignas(32) int voxel[3][PACKET_RAYS];
+	alignas(32) int voxel_step[3][PACKET_RAYS];
+	alignas(32) int face_mask[3][PACKET_RAYS];
+	alignas(32) float intersection_t[3][PACKET_RAYS];
+	alignas(32) float delta_t[3][PACKET_RAYS];
+
+	for (int lane = 0; lane < PACKET_RAYS; lane++) {
+
+		RayHit &hit = hits[lane];
+		hit = RayHit();
+		woo_setup(ray_pos, ray_dir[lane], hit.voxel, hit.intersection_t, hit.delta_t, hit.voxel_step);
+
+		int lane_voxel[3] = { hit.voxel.x, hit.voxel.y, hit.voxel.z };
+		int lane_step[3] = { hit.voxel_step.x, hit.voxel_step.y, hit.voxel_step.z };
+		float lane_t[3] = { hit.intersection_t.x, hit.intersection_t.y, hit.intersection_t.z };
+		float lane_delta[3] = { hit.delta_t.x, hit.delta_t.y, hit.delta_t.z };
+
+		for (int a = 0; a < 3; a++) {
+			voxel[a][lane] = lane_voxel[a];
+			voxel_step[a][lane] = lane_step[a];
+			intersection_t[a][lane] = lane_t[a];
+			delta_t[a][lane] = lane_delta[a];
+		}
+	}
+
+	sf::Vector3i dimensions = map->getDimensions();
+	int last_voxel[3] = { dimensions.x - 1, dimensions.y - 1, dimensions.z - 1 };
+
+	const OccupancyGrid &occupancy = map->get_occupancy();
+	const int *occupancy_words = reinterpret_cast<const int*>(occupancy.words.data());
+
+	const uint8_t *distance_field = map->get_distance_field();
+	sf::Vector3i field_dimensions = map->get_distance_field_dimensions();
+
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i three = _mm256_set1_epi32(3);
+
+	// SoA, a register per axis
+	__m256i v[3], step[3], last[3], mask[3];
+	__m256 t[3], dt[3];
+
+	for (int a = 0; a < 3; a++) {
+		v[a] = _mm256_load_si256(reinterpret_cast<const __m256i*>(voxel[a]));
+		step[a] = _mm256_load_si256(reinterpret_cast<const __m256i*>(voxel_step[a]));
+		t[a] = _mm256_load_ps(intersection_t[a]);
+		dt[a] = _mm256_load_ps(delta_t[a]);
+		last[a] = _mm256_set1_epi32(last_voxel[a]);
+		mask[a] = zero;
+	}
+
+	// Lanes still stepping
+	__m256i live = _mm256_set1_epi32(-1);
+	int steps = 0;
+
+	// Write the lanes in lanes back out to their hits
+	auto spill = [&](int lanes) {
+
+		for (int a = 0; a < 3; a++) {
+			_mm256_store_si256(reinterpret_cast<__m256i*>(voxel[a]), v[a]);
+			_mm256_store_si256(reinterpret_cast<__m256i*>(face_mask[a]), mask[a]);
+			_mm256_store_ps(intersection_t[a], t[a]);
+		}
+
+		for (int lane = 0; lane < PACKET_RAYS; lane++) {
+
+			if (!(lanes & (1 << lane)))
+				continue;
+
+			RayHit &hit = hits[lane];
+			hit.voxel = sf::Vector3i(voxel[0][lane], voxel[1][lane], voxel[2][lane]);
+			hit.face_mask = sf::Vector3i(face_mask[0][lane], face_mask[1][lane], face_mask[2][lane]);
+			hit.intersection_t = sf::Vector3f(intersection_t[0][lane], intersection_t[1][lane], intersection_t[2][lane]);
+			hit.steps = steps;
+		}
+	};
+
+	while (true) {
+
+		// woo_step, for the live lanes
+		__m256 nearest[3] = {
+			_mm256_cmp_ps(t[0], fmin_ps(t[1], t[2]), _CMP_LE_OQ),
+			_mm256_cmp_ps(t[1], fmin_ps(t[2], t[0]), _CMP_LE_OQ),
+			_mm256_cmp_ps(t[2], fmin_ps(t[0], t[1]), _CMP_LE_OQ)
+		};
+
+		for (int a = 0; a < 3; a++) {
+			mask[a] = _mm256_and_si256(_mm256_castps_si256(nearest[a]), live);
+			t[a] = _mm256_add_ps(t[a], _mm256_and_ps(dt[a], _mm256_castsi256_ps(mask[a])));
+			v[a] = _mm256_sub_epi32(v[a], _mm256_and_si256(step[a], mask[a]));
+		}
+
+		__m256i past_max = _mm256_or_si256(_mm256_or_si256(
+			_mm256_cmpgt_epi32(v[0], last[0]),
+			_mm256_cmpgt_epi32(v[1], last[1])),
+			_mm256_cmpgt_epi32(v[2], last[2]));
+
+		__m256i past_min = _mm256_or_si256(_mm256_or_si256(
+			_mm256_cmpgt_epi32(zero, v[0]),
+			_mm256_cmpgt_epi32(zero, v[1])),
+			_mm256_cmpgt_epi32(zero, v[2]));
+
+		past_max = _mm256_and_si256(past_max, live);
+		past_min = _mm256_andnot_si256(past_max, _mm256_and_si256(past_min, live));
+
+		__m256i inside = _mm256_andnot_si256(_mm256_or_si256(past_max, past_min), live);
+
+		// The voxel's bit out of the occupancy, gathering the half of its block's word it's in
+		__m256i block[3];
+		for (int a = 0; a < 3; a++)
+			block[a] = _mm256_srai_epi32(v[a], 2);
+
+		__m256i block_index = _mm256_add_epi32(block[0], _mm256_mullo_epi32(_mm256_set1_epi32(occupancy.block_dimensions.x),
+			_mm256_add_epi32(block[1], _mm256_mullo_epi32(_mm256_set1_epi32(occupancy.block_dimensions.y), block[2]))));
+
+		__m256i bit = _mm256_add_epi32(_mm256_and_si256(v[0], three), _mm256_slli_epi32(
+			_mm256_add_epi32(_mm256_and_si256(v[1], three), _mm256_slli_epi32(_mm256_and_si256(v[2], three), 2)), 2));
+
+		__m256i word_index = _mm256_add_epi32(_mm256_slli_epi32(block_index, 1), _mm256_srli_epi32(bit, 5));
+		__m256i word = _mm256_mask_i32gather_epi32(zero, occupancy_words, word_index, inside, 4);
+
+		__m256i solid = _mm256_and_si256(inside, _mm256_cmpeq_epi32(
+			_mm256_and_si256(_mm256_srlv_epi32(word, _mm256_and_si256(bit, _mm256_set1_epi32(31))), one), one));
+
+		int ended = lane_mask(_mm256_or_si256(_mm256_or_si256(past_max, past_min), solid));
+
+		if (ended) {
+
+			spill(ended);
+
+			int max_lanes = lane_mask(past_max);
+			int min_lanes = lane_mask(past_min);
+
+			for (int lane = 0; lane < PACKET_RAYS; lane++) {
+
+				if (!(ended & (1 << lane)))
+					continue;
+
+				RayHit &hit = hits[lane];
+
+				if (max_lanes & (1 << lane)) {
+					hit.result = RayHit::PAST_MAX;
+				}
+				else if (min_lanes & (1 << lane)) {
+					hit.result = RayHit::PAST_MIN;
+				}
+				else {
+					hit.result = RayHit::HIT;
+					hit.voxel_data = map->get_voxel(hit.voxel);
+				}
+			}
+
+			live = _mm256_andnot_si256(_mm256_or_si256(_mm256_or_si256(past_max, past_min), solid), live);
+		}
+
+		int live_lanes = lane_mask(live);
+
+		if (live_lanes == 0)
+			return;
+
+		// The distance field leap. Bytes don't gather, so it's a load per lane
+		alignas(32) int field_index[PACKET_RAYS];
+		alignas(32) int distance[PACKET_RAYS];
+
+		__m256i field_offset = _mm256_add_epi32(block[0], _mm256_mullo_epi32(_mm256_set1_epi32(field_dimensions.x),
+			_mm256_add_epi32(block[1], _mm256_mullo_epi32(_mm256_set1_epi32(field_dimensions.y), block[2]))));
+
+		_mm256_store_si256(reinterpret_cast<__m256i*>(field_index), field_offset);
+
+		for (int lane = 0; lane < PACKET_RAYS; lane++)
+			distance[lane] = live_lanes & (1 << lane) ? distance_field[field_index[lane]] : 0;
+
+		__m256i block_distance = _mm256_load_si256(reinterpret_cast<const __m256i*>(distance));
+		__m256i leaping = _mm256_cmpgt_epi32(block_distance, zero);
+
+		if (lane_mask(leaping)) {
+
+			// empty_box_leap, lane for lane. The adds go on until the lane with the most
+			// crossings is done, the others masked off
+			__m256i limit[3], toward[3], moving[3];
+			__m256 nearest_exit = _mm256_set1_ps(FLT_MAX);
+
+			for (int a = 0; a < 3; a++) {
+
+				__m256i box_min = _mm256_slli_epi32(_mm256_sub_epi32(block[a], _mm256_sub_epi32(block_distance, one)), 2);
+				__m256i box_max = _mm256_sub_epi32(_mm256_slli_epi32(_mm256_add_epi32(block[a], block_distance), 2), one);
+
+				toward[a] = _mm256_sub_epi32(zero, step[a]);
+				moving[a] = _mm256_and_si256(_mm256_xor_si256(_mm256_cmpeq_epi32(step[a], zero), _mm256_set1_epi32(-1)), leaping);
+
+				__m256i reach = select_epi32(box_min, box_max, _mm256_cmpgt_epi32(toward[a], zero));
+				limit[a] = _mm256_abs_epi32(_mm256_sub_epi32(reach, v[a]));
+
+				__m256 exit = t[a];
+				__m256i counted = zero;
+
+				while (true) {
+
+					__m256i adding = _mm256_and_si256(moving[a], _mm256_cmpgt_epi32(limit[a], counted));
+
+					if (!lane_mask(adding))
+						break;
+
+					exit = _mm256_blendv_ps(exit, _mm256_add_ps(exit, dt[a]), _mm256_castsi256_ps(adding));
+					counted = _mm256_sub_epi32(counted, adding);
+				}
+
+				nearest_exit = _mm256_blendv_ps(nearest_exit, fmin_ps(nearest_exit, exit), _mm256_castsi256_ps(moving[a]));
+			}
+
+			for (int a = 0; a < 3; a++) {
+
+				__m256i counted = zero;
+
+				while (true) {
+
+					__m256i crossing = _mm256_and_si256(_mm256_and_si256(moving[a], _mm256_cmpgt_epi32(limit[a], counted)),
+						_mm256_castps_si256(_mm256_cmp_ps(t[a], nearest_exit, _CMP_LT_OQ)));
+
+					if (!lane_mask(crossing))
+						break;
+
+					v[a] = select_epi32(v[a], _mm256_add_epi32(v[a], toward[a]), crossing);
+					t[a] = _mm256_blendv_ps(t[a], _mm256_add_ps(t[a], dt[a]), _mm256_castsi256_ps(crossing));
+					counted = _mm256_sub_epi32(counted, crossing);
+				}
+			}
+		}
+
+		if (++steps >= MAX_RAY_STEPS)
+			break;
+
+		// Too few lanes left to be worth the packet, carry them on one at a time
+		if (count_bits(static_cast<int32_t>(live_lanes)) < PACKET_MIN_LANES) {
+
+			spill(live_lanes);
+
+			for (int lane = 0; lane < PACKET_RAYS; lane++) {
+				if (live_lanes & (1 << lane)) {
+					int mip_level = 1;
+					march(hits[lane], mip_level);
+				}
+			}
+
+			return;
+		}
+	}
+
+	int live_lanes = lane_mask(live);
+	spill(live_lanes);
+
+	for (int lane = 0; lane < PACKET_RAYS; lane++)
+		if (live_lanes & (1 << lane))
+			hits[lane].result = RayHit::OUT_OF_STEPS;
+}
+
+#else
+
+void Software_Caster::trace_packet(sf::Vector3f ray_pos, const sf::Vector3f *ray_dir, RayHit *hits) const {
+
+	for (int lane = 0; lane < PACKET_RAYS; lane++)
+		hits[lane] = trace(ray_pos, ray_dir[lane]);
+}
+
+#endif
+
+void Software_Caster::benchmark_packets(int frames) {
+
+	if (!valid)
+		return;
+
+	FrameState frame = frame_state();
+
+	// Only the whole packets, so both sides trace the same rays
+	sf::Vector2i packets(viewport_resolution.x / PACKET_WIDTH, viewport_resolution.y / PACKET_HEIGHT);
+	int ray_count = packets.x * packets.y * PACKET_RAYS;
+
+	std::vector<sf::Vector3f> ray_dir(ray_count);
+
+	for (int packet = 0; packet < packets.x * packets.y; packet++) {
+
+		sf::Vector2i corner((packet % packets.x) * PACKET_WIDTH, (packet / packets.x) * PACKET_HEIGHT);
+
+		for (int lane = 0; lane < PACKET_RAYS; lane++)
+			ray_dir[packet * PACKET_RAYS + lane] = ray_direction(corner + sf::Vector2i(lane % PACKET_WIDTH, lane / PACKET_WIDTH), frame);
+	}
+
+	std::vector<RayHit> scalar_hits(ray_count);
+	std::vector<RayHit> packet_hits(ray_count);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < frames; i++)
+		for (int ray = 0; ray < ray_count; ray++)
+			scalar_hits[ray] = trace(frame.camera_position, ray_dir[ray]);
+
+	double scalar_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < frames; i++)
+		for (int ray = 0; ray < ray_count; ray += PACKET_RAYS)
+			trace_packet(frame.camera_position, &ray_dir[ray], &packet_hits[ray]);
+
+	double packet_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	int differ = 0;
+	uint64_t steps = 0;
+
+	for (int ray = 0; ray < ray_count; ray++) {
+
+		const RayHit &a = scalar_hits[ray];
+		const RayHit &b = packet_hits[ray];
+
+		steps += a.steps;
+
+		if (a.result != b.result || a.voxel != b.voxel || a.face_mask != b.face_mask || a.steps != b.steps)
+			differ++;
+	}
+
+	double rays = static_cast<double>(ray_count) * frames;
+
+	std::cout << "Packet benchmark : " << ray_count << " camera rays, " << steps / std::max(ray_count, 1) << " steps a ray"
+#ifdef __AVX2__
+		<< ", AVX2"
+#else
+		<< ", no AVX2, packets are scalar"
+#endif
+		<< std::endl;
+
+	std::cout << "    scalar " << rays / scalar_seconds / 1000000.0 << " Mrays/s, packets "
+		<< rays / packet_seconds / 1000000.0 << " Mrays/s"
+		<< (differ == 0 ? "" : ", HITS DIFFER on " + std::to_string(differ) + " rays") << std::endl;
+}
+
+sf::Vector4f Software_Caster::shade(RayHit &hit, sf::Vector3f ray_dir, const FrameState &frame) const {
+
+	sf::Vector3f sky_light(frame.light[7], frame.light[8], frame.light[9]);
+	float fade = 1.0f - std::fmax(hit.steps / static_cast<float>(MAX_RAY_STEPS), 0.0f);
+
+	if (hit.result == RayHit::PAST_MAX)
+		return white_light(mix(fog_color, overshoot_color, fade), sky_light, hit.face_mask);
+
+	if (hit.result == RayHit::PAST_MIN)
+		return white_light(mix(fog_color, overshoot_color_2, fade), sky_light, hit.face_mask);
+
+	if (hit.result == RayHit::OUT_OF_STEPS)
+		return white_light(mix(fog_color, out_of_steps_color, fade), sky_light, hit.face_mask);
+
+	const sf::Vector3f &intersection_t = hit.intersection_t;
+	const sf::Vector3f &delta_t = hit.delta_t;
+
+	// Where on the face the ray came in, as a percent of the way across it
+	sf::Vector3f face_position(0, 0, 0);
+	sf::Vector2f tile_face_position(0, 0);
+
+	if (hit.face_mask.x == -1) {
+		float z_percent = (intersection_t.z - (intersection_t.x - delta_t.x)) / delta_t.z;
+		float y_percent = (intersection_t.y - (intersection_t.x - delta_t.x)) / delta_t.y;
+		face_position = sf::Vector3f(1.0001f, y_percent, z_percent);
+		tile_face_position = sf::Vector2f(y_percent, z_percent);
+	}
+	else if (hit.face_mask.y == -1) {
+		float x_percent = (intersection_t.x - (intersection_t.y - delta_t.y)) / delta_t.x;
+		float z_percent = (intersection_t.z - (intersection_t.y - delta_t.y)) / delta_t.z;
+		face_position = sf::Vector3f(x_percent, 1.0001f, z_percent);
+		tile_face_position = sf::Vector2f(x_percent, z_percent);
+	}
+	else if (hit.face_mask.z == -1) {
+		float x_percent = (intersection_t.x - (intersection_t.z - delta_t.z)) / delta_t.x;
+		float y_percent = (intersection_t.y - (intersection_t.z - delta_t.z)) / delta_t.y;
+		face_position = sf::Vector3f(x_percent, y_percent, 1.0001f);
+		tile_face_position = sf::Vector2f(x_percent, y_percent);
+	}
+
+	// Flip them over into the quadrant the ray is actually in, see the kernel
+	if (ray_dir.x > 0)
+		face_position.x = -face_position.x + 1.0f;
+	if (ray_dir.x < 0)
+		tile_face_position.x = -tile_face_position.x + 1.0f;
+
+	if (ray_dir.y > 0) {
+		face_position.y = -face_position.y + 1;
+	}
+	else {
+		tile_face_position.x = 1.0f - tile_face_position.x;
+
+		if (hit.face_mask.z == -1) {
+			tile_face_position.x = 1.0f - tile_face_position.x;
+			tile_face_position.y = 1.0f - tile_face_position.y;
+		}
+	}
+
+	if (ray_dir.z > 0)
+		face_position.z = -face_position.z + 1.0f;
+	if (ray_dir.z < 0)
+		tile_face_position.y = -tile_face_position.y + 1.0f;
+
+	// get_voxel_color's selects test the top bit of (int4)(1), so every material ends up
+	// with the atlas sample. Do the same so the two match
+	sf::Vector4f voxel_color = sample_atlas(tile_face_position);
+	voxel_color.w = 0.0f;
+
+	sf::Vector3f hit_position = to_float(hit.voxel) + face_position;
+	sf::Vector3f light_position(frame.light[4], frame.light[5], frame.light[6]);
+
+	if (hit.shadowed < 0)
+		hit.shadowed = cast_light_intersection_ray(normalize(light_position - hit_position), hit_position, frame);
+
+	if (hit.shadowed)
+		return white_light(voxel_color, sf::Vector3f(1.0f, 1.0f, 1.0f), hit.face_mask);
+
+	return view_light(
+		voxel_color,
+		hit_position - light_position,
+		sf::Vector4f(frame.light[0], frame.light[1], frame.light[2], frame.light[3]),
+		hit_position - frame.camera_position,
+		sf::Vector3i(hit.face_mask.x * hit.voxel_step.x, hit.face_mask.y * hit.voxel_step.y, hit.face_mask.z * hit.voxel_step.z)
+	);
+}
+
+bool Software_Caster::reproject(sf::Vector2i pixel, sf::Vector3f ray_dir, const FrameState &frame, RayHit &hit) const {
+
+	if (!frame.reproject)
+		return false;
+
+	// Stagger the refreshes so every frame traces about the same share of them. A packet
+	// refreshes all together, one lane due would send the whole packet out anyway
+	if ((pixel.x / PACKET_WIDTH + 3 * (pixel.y / PACKET_HEIGHT) + frame.frame_number) % REPROJECTION_REFRESH == 0)
+		return false;
+
+	float depth = history[pixel.x + static_cast<size_t>(viewport_resolution.x) * pixel.y].depth;
+
+	if (depth <= 0)
+		return false;
+
+	// Go out along the new ray as far as this pixel saw last time and find who saw that spot.
+	// Then again with how far away what they saw is, which settles on the right pixel
+	// unless the depth jumps around there
+	sf::Vector2i source;
+
+	for (int i = 0; i < 2; i++) {
+
+		if (!project(frame.camera_position + ray_dir * depth, history_frame, source))
+			return false;
+
+		float seen_depth = history[source.x + static_cast<size_t>(viewport_resolution.x) * source.y].depth;
+
+		if (seen_depth <= 0)
+			return false;
+
+		sf::Vector3f seen = history_frame.camera_position + ray_direction(source, history_frame) * seen_depth;
+		depth = length(seen - frame.camera_position);
+	}
+
+	// Around a depth edge something could have come out from behind something else
+	float nearest = FLT_MAX;
+	float farthest = 0;
+
+	sf::Vector2i low(std::max(source.x - 1, 0), std::max(source.y - 1, 0));
+	sf::Vector2i high(std::min(source.x + 1, viewport_resolution.x - 1), std::min(source.y + 1, viewport_resolution.y - 1));
+
+	for (int y = low.y; y <= high.y; y++) {
+		for (int x = low.x; x <= high.x; x++) {
+
+			float neighbour = history[x + static_cast<size_t>(viewport_resolution.x) * y].depth;
+
+			if (neighbour <= 0)
+				return false;
+
+			nearest = std::min(nearest, neighbour);
+			farthest = std::max(farthest, neighbour);
+		}
+	}
+
+	if (farthest - nearest > REPROJECTION_EDGE_DEPTH)
+		return false;
+
+	// The new ray can land on the voxel a neighbour saw instead. The clearance check in
+	// intersect_voxel means the first one it goes into is the hit
+	const PixelHistory *seen = &history[source.x + static_cast<size_t>(viewport_resolution.x) * source.y];
+
+	if (!intersect_voxel(frame.camera_position, ray_dir, seen->voxel, hit)) {
+
+		const PixelHistory *source_history = seen;
+		seen = nullptr;
+
+		for (int y = low.y; y <= high.y && seen == nullptr; y++) {
+			for (int x = low.x; x <= high.x && seen == nullptr; x++) {
+
+				const PixelHistory &candidate = history[x + static_cast<size_t>(viewport_resolution.x) * y];
+
+				if (candidate.voxel != source_history->voxel && intersect_voxel(frame.camera_position, ray_dir, candidate.voxel, hit))
+					seen = &candidate;
+			}
+		}
+
+		if (seen == nullptr)
+			return false;
+	}
+
+	hit.voxel_data = map->get_voxel(hit.voxel);
+
+	if (hit.voxel_data == 0)
+		return false;
+
+	if (!frame.light_moved && record(hit).face == seen->face)
+		hit.shadowed = seen->shadowed;
+
+	return true;
+}
+
+bool Software_Caster::project(sf::Vector3f position, const FrameState &frame, sf::Vector2i &pixel) const {
+
+	sf::Vector3f ray = position - frame.camera_position;
+
+	// ray_direction backwards, the yaw and then the pitch undone
+	ray = sf::Vector3f(
+		ray.x * frame.yaw_cos + ray.y * frame.yaw_sin,
+		ray.y * frame.yaw_cos - ray.x * frame.yaw_sin,
+		ray.z
+	);
+
+	ray = sf::Vector3f(
+		ray.x * frame.pitch_cos - ray.z * frame.pitch_sin,
+		ray.y,
+		ray.x * frame.pitch_sin + ray.z * frame.pitch_cos
+	);
+
+	// And the lens' -1.57 correction, which leaves the pitch and yaw it was built from
+	ray = sf::Vector3f(
+		ray.z * std::sin(1.57f) + ray.x * std::cos(1.57f),
+		ray.y,
+		ray.z * std::cos(1.57f) - ray.x * std::sin(1.57f)
+	);
+
+	float distance = length(ray);
+
+	if (distance <= 0)
+		return false;
+
+	float pitch = std::asin(std::fmax(-1.0f, std::fmin(1.0f, -ray.z / distance)));
+	float yaw = std::atan2(ray.y, ray.x);
+
+	pixel.x = static_cast<int>(std::floor(yaw / viewport_increment.x + 0.5f)) + viewport_resolution.x / 2;
+	pixel.y = static_cast<int>(std::floor(pitch / viewport_increment.y + 0.5f)) + viewport_resolution.y / 2;
+
+	return pixel.x >= 0 && pixel.y >= 0 && pixel.x < viewport_resolution.x && pixel.y < viewport_resolution.y;
+}
+
+bool Software_Caster::intersect_voxel(sf::Vector3f ray_pos, sf::Vector3f ray_dir, sf::Vector3i voxel, RayHit &hit) const {
+
+	sf::Vector3i start, voxel_step;
+	sf::Vector3f intersection_t, delta_t;
+	woo_setup(ray_pos, ray_dir, start, intersection_t, delta_t, voxel_step);
+
+	int target[3] = { voxel.x, voxel.y, voxel.z };
+	int from[3] = { start.x, start.y, start.z };
+	int step[3] = { voxel_step.x, voxel_step.y, voxel_step.z };
+	float t[3] = { intersection_t.x, intersection_t.y, intersection_t.z };
+	float dt[3] = { delta_t.x, delta_t.y, delta_t.z };
+
+	float first_t[3] = { t[0], t[1], t[2] };
+	int axis_crossings[3] = { 0, 0, 0 };
+
+	// The Woo loop would cross each axis this many times getting there. It comes in on the
+	// axis crossed last and has to come in before it leaves through any of them
+	float enter = -FLT_MAX;
+	float exit = FLT_MAX;
+	int face = -1;
+
+	for (int a = 0; a < 3; a++) {
+
+		if (step[a] == 0) {
+			if (target[a] != from[a])
+				return false;
+			continue;
+		}
+
+		int crossings = (target[a] - from[a]) * -step[a];
+
+		if (crossings < 0)
+			return false;
+
+		axis_crossings[a] = crossings;
+
+		float axis_enter = t[a] + (crossings - 1) * dt[a];
+		t[a] = t[a] + crossings * dt[a];
+		exit = std::fmin(exit, t[a]);
+
+		if (crossings > 0 && axis_enter > enter) {
+			enter = axis_enter;
+			face = a;
+		}
+	}
+
+	// Either the camera is in it or the ray passes it by
+	if (face < 0 || !(enter < exit))
+		return false;
+
+	// Going through it isn't hitting it if the ray ran into a neighbour first, which is all
+	// a ray skimming along a surface does. Walk back through the cells it came through
+	const OccupancyGrid &occupancy = map->get_occupancy();
+	int cell[3] = { target[0], target[1], target[2] };
+
+	for (int i = 0; i < REPROJECTION_CLEARANCE; i++) {
+
+		int entered = -1;
+		float latest = -FLT_MAX;
+
+		for (int a = 0; a < 3; a++) {
+
+			if (axis_crossings[a] == 0)
+				continue;
+
+			float axis_enter = first_t[a] + (axis_crossings[a] - 1) * dt[a];
+
+			if (axis_enter > latest) {
+				latest = axis_enter;
+				entered = a;
+			}
+		}
+
+		// Back at the camera
+		if (entered < 0)
+			break;
+
+		axis_crossings[entered]--;
+		cell[entered] += step[entered];
+
+		if (occupancy.is_solid(sf::Vector3i(cell[0], cell[1], cell[2])))
+			return false;
+	}
+
+	hit = RayHit();
+	hit.result = RayHit::HIT;
+	hit.voxel = voxel;
+	hit.voxel_step = voxel_step;
+	hit.delta_t = delta_t;
+	hit.intersection_t = sf::Vector3f(t[0], t[1], t[2]);
+	hit.face_mask = sf::Vector3i(face == 0 ? -1 : 0, face == 1 ? -1 : 0, face == 2 ? -1 : 0);
+
+	return true;
+}
+
+Software_Caster::PixelHistory Software_Caster::record(const RayHit &hit) const {
+
+	PixelHistory entry;
+
+	if (hit.result != RayHit::HIT)
+		return entry;
+
+	int axis = hit.face_mask.x ? 0 : hit.face_mask.y ? 1 : 2;
+	float t[3] = { hit.intersection_t.x, hit.intersection_t.y, hit.intersection_t.z };
+	float dt[3] = { hit.delta_t.x, hit.delta_t.y, hit.delta_t.z };
+	int step[3] = { hit.voxel_step.x, hit.voxel_step.y, hit.voxel_step.z };
+
+	entry.voxel = hit.voxel;
+	entry.depth = t[axis] - dt[axis];
+	entry.face = static_cast<int8_t>((axis + 1) * (step[axis] < 0 ? 1 : -1));
+	entry.shadowed = hit.shadowed > 0;
+
+	return entry;
+}
+
+bool Software_Caster::cast_light_intersection_ray(sf::Vector3f ray_dir, sf::Vector3f ray_pos, const FrameState &frame) const {
+
+	float distance_to_light = length(ray_pos - sf::Vector3f(frame.light[4], frame.light[5], frame.light[6]));
+
+	sf::Vector3i voxel, voxel_step;
+	sf::Vector3f intersection_t, delta_t;
+	woo_setup(ray_pos, ray_dir, voxel, intersection_t, delta_t, voxel_step);
+
+	sf::Vector3i dimensions = map->getDimensions();
+	sf::Vector3i face_mask(0, 0, 0);
+
+	const OccupancyGrid &occupancy = map->get_occupancy();
+
+	int length_cutoff = 0;
+	int mip_level = 1;
+
+	do {
+
+		woo_step(voxel, intersection_t, face_mask, delta_t, voxel_step);
+
+		if (outside(voxel, dimensions))
+			return false;
+
+		if (occupancy.is_solid(voxel))
+			return true;
+
+		if (++length_cutoff > MAX_SHADOW_STEPS)
+			return false;
+
+		empty_space_leap(mip_level, voxel, intersection_t, delta_t, voxel_step);
+
+	} while (intersection_t.x < distance_to_light - 1 ||
+		intersection_t.y < distance_to_light - 1 ||
+		intersection_t.z < distance_to_light - 1);
+
+	return false;
+}
+
+void Software_Caster::empty_space_leap(int &mip_level, sf::Vector3i &voxel, sf::Vector3f &intersection_t, sf::Vector3f delta_t, sf::Vector3i voxel_step) const {
+
+	if (dense_traversal == MIP_TRAVERSAL) {
+
+		const OccupancyPyramid &pyramid = map->get_occupancy_pyramid();
+
+		if (pyramid.levels == 0)
+			return;
+
+		int level = std::min(std::max(mip_level, 1), pyramid.levels);
+
+		while (level >= 1 && pyramid.is_occupied(level, voxel))
+			level--;
+
+		if (level == 0) {
+			mip_level = 1;
+			return;
+		}
+
+		while (level < pyramid.levels && !pyramid.is_occupied(level + 1, voxel))
+			level++;
+
+		mip_level = level;
+
+		sf::Vector3i box_min((voxel.x >> level) << level, (voxel.y >> level) << level, (voxel.z >> level) << level);
+		sf::Vector3i box_max = box_min + sf::Vector3i(1, 1, 1) * ((1 << level) - 1);
+
+		empty_box_leap(box_min, box_max, voxel, intersection_t, delta_t, voxel_step);
+		return;
+	}
+
+	sf::Vector3i field_dimensions = map->get_distance_field_dimensions();
+	sf::Vector3i block = voxel / DISTANCE_BLOCK;
+
+	int distance = map->get_distance_field()[block.x + field_dimensions.x * (block.y + field_dimensions.y * block.z)];
+
+	if (distance == 0)
+		return;
+
+	sf::Vector3i box_min = (block - sf::Vector3i(1, 1, 1) * (distance - 1)) * DISTANCE_BLOCK;
+	sf::Vector3i box_max = (block + sf::Vector3i(1, 1, 1) * distance) * DISTANCE_BLOCK - sf::Vector3i(1, 1, 1);
+
+	empty_box_leap(box_min, box_max, voxel, intersection_t, delta_t, voxel_step);
+}
+
+sf::Vector4f Software_Caster::sample_atlas(sf::Vector2f tile_face_position) const {
+
+	if (atlas_dim.x == 0 || tile_dim.x == 0 || tile_dim.y == 0)
+		return sf::Vector4f(0, 0, 0, 0);
+
+	// The kernel scales by atlas_dim / tile_dim and reads unfiltered, clamp where it wouldn't
+	sf::Vector2i scale(atlas_dim.x / tile_dim.x, atlas_dim.y / tile_dim.y);
+	int x = std::min(std::max(static_cast<int>(tile_face_position.x * scale.x), 0), atlas_dim.x - 1);
+	int y = std::min(std::max(static_cast<int>(tile_face_position.y * scale.y), 0), atlas_dim.y - 1);
+
+	const sf::Uint8 *texel = texture_atlas.getPixelsPtr() + 4 * (x + static_cast<size_t>(atlas_dim.x) * y);
+
+	return sf::Vector4f(texel[0], texel[1], texel[2], texel[3]) / 255.0f;
+}